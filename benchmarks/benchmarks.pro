@@ -0,0 +1,20 @@
+TEMPLATE = app
+TARGET = usd-startup-bench
+
+QT += core dbus
+QT -= gui
+CONFIG += no_keywords link_pkgconfig c++11 console
+CONFIG -= app_bundle
+
+PKGCONFIG += \
+        x11\
+        xtst
+
+SOURCES += \
+        $$PWD/main.cpp\
+        $$PWD/startup-bench.cpp
+
+HEADERS += \
+        $$PWD/startup-bench.h
+
+DESTDIR = $$PWD/
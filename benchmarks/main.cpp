@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <algorithm>
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+
+#include "startup-bench.h"
+
+/* 回归判定使用的指标 */
+static const char* gate_keys[] = {"manager_start_us", "ready_us", "peak_rss_bytes", "x_round_trips"};
+
+static qint64 median (QList<qint64> values)
+{
+    if (values.isEmpty()) return -1;
+
+    std::sort(values.begin(), values.end());
+
+    return values.at(values.size() / 2);
+}
+
+static QJsonObject summarize (const QList<BenchResult>& results)
+{
+    QJsonObject summary;
+    QMap<QString, QList<qint64>> plugins;
+
+    for (const char* key : gate_keys) {
+        QList<qint64> values;
+        for (const BenchResult& r : results) {
+            qint64 v = r.toJson().value(key).toVariant().toLongLong();
+            if (r.ok && v >= 0) values.append(v);
+        }
+        summary.insert(key, median(values));
+    }
+
+    for (const BenchResult& r : results) {
+        if (!r.ok) continue;
+        for (auto it = r.plugins.constBegin(); it != r.plugins.constEnd(); ++it) plugins[it.key()].append(it.value());
+    }
+
+    QJsonObject p;
+    for (auto it = plugins.constBegin(); it != plugins.constEnd(); ++it) p.insert(it.key(), median(it.value()));
+    summary.insert("plugins_us", p);
+
+    return summary;
+}
+
+/*
+ * 与基线比较，任何指标的中位数比基线多 maxRegression 百分比以上返回 false，
+ * 基线为本程序之前输出的 JSON
+ */
+static bool check_baseline (const QJsonObject& summary, const QString& fileName, double maxRegression)
+{
+    bool ok = true;
+    QFile file(fileName);
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        fprintf(stderr, "open baseline '%s' error\n", fileName.toUtf8().data());
+        return false;
+    }
+    QJsonObject baseline = QJsonDocument::fromJson(file.readAll()).object().value("summary").toObject();
+
+    for (const char* key : gate_keys) {
+        qint64 base = baseline.value(key).toVariant().toLongLong();
+        qint64 now = summary.value(key).toVariant().toLongLong();
+        if (base <= 0 || now < 0) continue;
+
+        double change = (double)(now - base) * 100 / base;
+        fprintf(stderr, "%-20s %12lld -> %12lld  %+.1f%%\n", key, base, now, change);
+        if (change > maxRegression) ok = false;
+    }
+
+    return ok;
+}
+
+int main (int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+
+    parser.setApplicationDescription("Headless startup benchmark for ukui-settings-daemon (Xvfb + private D-Bus + memory GSettings)");
+    parser.addHelpOption();
+    parser.addOptions({
+        {"daemon", "ukui-settings-daemon executable.", "path", "ukui-settings-daemon"},
+        {"plugin-dir", "Load plugins from <dir>.", "dir"},
+        {"plugins", "Comma separated plugin modules to load, all when omitted.", "list"},
+        {"lazy", "Start the daemon with --lazy."},
+        {"warm-cache", "Keep the plugin manifest cache between iterations."},
+        {"iterations", "Number of runs, the median is reported.", "n", "5"},
+        {"settle", "Startup is done when no span is added for <ms>.", "ms", "3000"},
+        {"timeout", "Give up a run after <ms>.", "ms", "60000"},
+        {"output", "Write the JSON report to <file> instead of stdout.", "file"},
+        {"baseline", "Compare with a previous JSON report, exit 1 on regression.", "file"},
+        {"max-regression", "Allowed regression against the baseline in percent.", "pct", "10"},
+    });
+    parser.process(app);
+
+    BenchOptions options;
+    options.daemon = parser.value("daemon");
+    options.pluginDir = parser.value("plugin-dir");
+    options.plugins = parser.value("plugins").split(",", QString::SkipEmptyParts);
+    options.warmCache = parser.isSet("warm-cache");
+    options.settle = parser.value("settle").toInt();
+    options.timeout = parser.value("timeout").toInt();
+    if (parser.isSet("lazy")) options.daemonArgs << "--lazy";
+
+    int iterations = qMax(1, parser.value("iterations").toInt());
+    QList<BenchResult> results;
+    QJsonArray runs;
+    StartupBench bench(options);
+
+    for (int i = 0; i < iterations; ++i) {
+        BenchResult r = bench.runOnce();
+        fprintf(stderr, "run %d/%d: %s managerStart %lld us, ready %lld us, rss %lld KiB, round-trips %lld\n",
+                i + 1, iterations, r.ok ? "ok" : "failed", r.managerStart, r.ready, r.peakRss / 1024, r.roundTrips);
+        results.append(r);
+        runs.append(r.toJson());
+    }
+
+    QJsonObject summary = summarize(results);
+    QJsonObject report;
+    report.insert("plugins", QJsonArray::fromStringList(options.plugins));
+    report.insert("lazy", parser.isSet("lazy"));
+    report.insert("warm_cache", options.warmCache);
+    report.insert("runs", runs);
+    report.insert("summary", summary);
+
+    QByteArray json = QJsonDocument(report).toJson();
+    if (parser.isSet("output")) {
+        QFile file(parser.value("output"));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size()) {
+            fprintf(stderr, "write '%s' error\n", parser.value("output").toUtf8().data());
+            return 2;
+        }
+    } else {
+        fwrite(json.constData(), 1, json.size(), stdout);
+    }
+
+    for (const BenchResult& r : results) {
+        if (!r.ok) return 2;
+    }
+
+    if (parser.isSet("baseline")
+            && !check_baseline(summary, parser.value("baseline"), parser.value("max-regression").toDouble())) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,378 @@
+#include <time.h>
+
+#include <QDir>
+#include <QFile>
+#include <QThread>
+#include <QJsonArray>
+#include <QDBusReply>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QDBusInterface>
+#include <QDBusConnection>
+#include <QDBusConnectionInterface>
+
+// Xlib macros (None, Bool, Status) break Qt headers included after them
+#include "startup-bench.h"
+
+/* same as daemon/global.h, the bench does not build against the daemon */
+#define UKUI_SETTINGS_DAEMON_DBUS_NAME      "org.ukui.SettingsDaemon"
+#define UKUI_SETTINGS_DAEMON_DBUS_PATH      "/daemon/registry"
+#define PLUGIN_DIR_ENV                      "USD_PLUGIN_DIR"
+#define PLUGIN_SET_ENV                      "USD_PLUGINS"
+
+#define BENCH_POLL_INTERVAL         50          // ms
+#define BENCH_XVFB_TIMEOUT          10000       // ms
+#define BENCH_STOP_TIMEOUT          5000        // ms
+#define BENCH_DISPLAY_FIRST         90
+
+static qint64 monotonic_usec ()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (qint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static qint64 peak_rss (qint64 pid)
+{
+    QFile file(QString("/proc/%1/status").arg(pid));
+    if (!file.open(QIODevice::ReadOnly)) return -1;
+
+    for (QByteArray line = file.readLine(); !line.isEmpty(); line = file.readLine()) {
+        if (line.startsWith("VmHWM:")) {
+            return line.mid(6).trimmed().split(' ').first().toLongLong() * 1024;
+        }
+    }
+
+    return -1;
+}
+
+QJsonObject BenchResult::toJson() const
+{
+    QJsonObject json;
+    QJsonObject p;
+    QJsonObject d;
+
+    for (auto it = plugins.constBegin(); it != plugins.constEnd(); ++it) p.insert(it.key(), it.value());
+    for (auto it = deferred.constBegin(); it != deferred.constEnd(); ++it) d.insert(it.key(), it.value());
+
+    json.insert("ok", ok);
+    json.insert("manager_start_us", managerStart);
+    json.insert("manager_start_span_us", managerStartSpan);
+    json.insert("ready_us", ready);
+    json.insert("plugins_us", p);
+    json.insert("deferred_us", d);
+    json.insert("peak_rss_bytes", peakRss);
+    json.insert("x_round_trips", roundTrips);
+    json.insert("x_requests", requests);
+
+    return json;
+}
+
+StartupBench::StartupBench(const BenchOptions& options)
+{
+    mOptions = options;
+    mControl = nullptr;
+    mData = nullptr;
+    mContext = 0;
+    mRequests = 0;
+    mRoundTrips = 0;
+}
+
+StartupBench::~StartupBench()
+{
+    cleanup();
+}
+
+BenchResult StartupBench::runOnce()
+{
+    BenchResult result;
+
+    result.ok = false;
+    result.managerStart = -1;
+    result.managerStartSpan = -1;
+    result.ready = -1;
+    result.peakRss = -1;
+    result.roundTrips = -1;
+    result.requests = -1;
+
+    if (!mOptions.warmCache) QFile::remove(mCacheDir.filePath("ukui-settings-daemon/plugins.cache"));
+
+    if (!startXvfb()) {
+        fprintf(stderr, "start Xvfb error\n");
+        cleanup();
+        return result;
+    }
+    if (!startBus()) {
+        fprintf(stderr, "start dbus-daemon error\n");
+        cleanup();
+        return result;
+    }
+    if (!startRecord()) {
+        fprintf(stderr, "Xvfb has no RECORD extension, X round-trips are not counted\n");
+    }
+
+    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+    env.insert("DISPLAY", mDisplayName);
+    env.insert("DBUS_SESSION_BUS_ADDRESS", mBusAddress);
+    env.insert("GSETTINGS_BACKEND", "memory");
+    env.insert("XDG_CACHE_HOME", mCacheDir.path());
+    env.insert("NO_AT_BRIDGE", "1");
+    env.remove("WAYLAND_DISPLAY");
+    if (!mOptions.pluginDir.isEmpty()) env.insert(PLUGIN_DIR_ENV, mOptions.pluginDir);
+    if (!mOptions.plugins.isEmpty()) env.insert(PLUGIN_SET_ENV, mOptions.plugins.join(","));
+    mDaemon.setProcessEnvironment(env);
+    mDaemon.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    mDaemon.setStandardOutputFile(QProcess::nullDevice());
+
+    qint64 launch = monotonic_usec();
+    mDaemon.start(mOptions.daemon, mOptions.daemonArgs);
+    if (!mDaemon.waitForStarted()) {
+        fprintf(stderr, "start '%s' error: %s\n", mOptions.daemon.toUtf8().data(), mDaemon.errorString().toUtf8().data());
+        cleanup();
+        return result;
+    }
+
+    result.ok = waitReady(result, launch);
+    result.peakRss = peak_rss(mDaemon.processId());
+
+    stopRecord();
+    if (0 != mContext) {
+        result.requests = mRequests;
+        result.roundTrips = mRoundTrips;
+    }
+
+    stopDaemon();
+    cleanup();
+
+    return result;
+}
+
+bool StartupBench::startXvfb()
+{
+    int display = BENCH_DISPLAY_FIRST;
+
+    // a free display has neither lock file nor socket
+    for (; display < BENCH_DISPLAY_FIRST + 100; ++display) {
+        if (!QFile::exists(QString("/tmp/.X%1-lock").arg(display))
+                && !QFile::exists(QString("/tmp/.X11-unix/X%1").arg(display))) {
+            break;
+        }
+    }
+    mDisplayName = QString(":%1").arg(display);
+
+    mXvfb.setStandardOutputFile(QProcess::nullDevice());
+    mXvfb.setStandardErrorFile(QProcess::nullDevice());
+    mXvfb.start("Xvfb", QStringList() << mDisplayName << "-nolisten" << "tcp" << "-noreset"
+                << "+extension" << "RECORD" << "-screen" << "0" << "1920x1080x24");
+    if (!mXvfb.waitForStarted()) return false;
+
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < BENCH_XVFB_TIMEOUT) {
+        Display* dpy = XOpenDisplay(mDisplayName.toUtf8().data());
+        if (nullptr != dpy) {
+            XCloseDisplay(dpy);
+            return true;
+        }
+        if (mXvfb.state() == QProcess::NotRunning) return false;
+        QThread::msleep(BENCH_POLL_INTERVAL);
+    }
+
+    return false;
+}
+
+bool StartupBench::startBus()
+{
+    mBus.start("dbus-daemon", QStringList() << "--session" << "--nofork" << "--nopidfile" << "--print-address=1");
+    if (!mBus.waitForStarted()) return false;
+
+    QElapsedTimer timer;
+    timer.start();
+    while (!mBus.canReadLine() && timer.elapsed() < BENCH_XVFB_TIMEOUT) {
+        if (!mBus.waitForReadyRead(BENCH_POLL_INTERVAL) && mBus.state() == QProcess::NotRunning) return false;
+    }
+    mBusAddress = QString::fromUtf8(mBus.readLine()).trimmed();
+
+    return !mBusAddress.isEmpty();
+}
+
+/* 只记录之后连接的客户端，即守护进程 */
+bool StartupBench::startRecord()
+{
+    int major = 0;
+    int minor = 0;
+    XRecordRange* range = nullptr;
+    XRecordClientSpec clients = XRecordFutureClients;
+
+    mRequests = 0;
+    mRoundTrips = 0;
+
+    mControl = XOpenDisplay(mDisplayName.toUtf8().data());
+    mData = XOpenDisplay(mDisplayName.toUtf8().data());
+    if (nullptr == mControl || nullptr == mData) return false;
+    if (!XRecordQueryVersion(mControl, &major, &minor)) return false;
+
+    range = XRecordAllocRange();
+    if (nullptr == range) return false;
+    range->core_requests.first = 1;
+    range->core_requests.last = 127;
+    range->core_replies.first = 1;
+    range->core_replies.last = 127;
+    range->ext_requests.ext_major.first = 128;
+    range->ext_requests.ext_major.last = 255;
+    range->ext_requests.ext_minor.first = 0;
+    range->ext_requests.ext_minor.last = 65535;
+    range->ext_replies.ext_major.first = 128;
+    range->ext_replies.ext_major.last = 255;
+    range->ext_replies.ext_minor.first = 0;
+    range->ext_replies.ext_minor.last = 65535;
+
+    mContext = XRecordCreateContext(mControl, 0, &clients, 1, &range, 1);
+    XFree(range);
+    if (0 == mContext) return false;
+    XSync(mControl, False);
+
+    if (!XRecordEnableContextAsync(mData, mContext, recordCallback, (XPointer)this)) {
+        XRecordFreeContext(mControl, mContext);
+        mContext = 0;
+        return false;
+    }
+
+    return true;
+}
+
+void StartupBench::stopRecord()
+{
+    if (0 == mContext) return;
+
+    XRecordProcessReplies(mData);
+    XRecordDisableContext(mControl, mContext);
+    XSync(mControl, False);
+    XRecordProcessReplies(mData);
+}
+
+void StartupBench::recordCallback(XPointer closure, XRecordInterceptData* data)
+{
+    StartupBench* bench = (StartupBench*)closure;
+
+    if (XRecordFromClient == data->category) {
+        bench->mRequests++;
+    } else if (XRecordFromServer == data->category) {
+        // only replies are in the range
+        bench->mRoundTrips++;
+    }
+
+    XRecordFreeData(data);
+}
+
+/*
+ * 守护进程注册 D-Bus 名字后一直取启动记录，
+ * 记录在 settle 毫秒内不再变化时认为所有插件(包括延后到空闲时的工作)已就绪。
+ */
+bool StartupBench::waitReady(BenchResult& result, qint64 launch)
+{
+    bool registered = false;
+    int spans = -1;
+    qint64 lastChange = 0;
+    QString timeline;
+    QString connName = QString("usd-bench-%1").arg(mDisplayName);
+
+    QDBusConnection bus = QDBusConnection::connectToBus(mBusAddress, connName);
+    if (!bus.isConnected()) return false;
+
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < mOptions.timeout) {
+        if (0 != mContext) XRecordProcessReplies(mData);
+        if (mDaemon.state() == QProcess::NotRunning) {
+            fprintf(stderr, "daemon exited with %d\n", mDaemon.exitCode());
+            break;
+        }
+
+        if (!registered) {
+            registered = bus.interface()->isServiceRegistered(UKUI_SETTINGS_DAEMON_DBUS_NAME);
+            if (!registered) {
+                QThread::msleep(BENCH_POLL_INTERVAL);
+                continue;
+            }
+        }
+
+        // blocks until managerStart() has returned to the main loop
+        QDBusInterface iface(UKUI_SETTINGS_DAEMON_DBUS_NAME, UKUI_SETTINGS_DAEMON_DBUS_PATH, "", bus);
+        iface.setTimeout(mOptions.timeout);
+        QDBusReply<QString> reply = iface.call("GetStartupTimeline");
+        if (reply.isValid()) {
+            timeline = reply.value();
+            int count = timeline.count("\"ph\"");
+            if (count != spans) {
+                spans = count;
+                lastChange = timer.elapsed();
+            } else if (timer.elapsed() - lastChange >= mOptions.settle) {
+                break;
+            }
+        }
+        QThread::msleep(BENCH_POLL_INTERVAL);
+    }
+
+    if (timeline.isEmpty()) {
+        QDBusConnection::disconnectFromBus(connName);
+        return false;
+    }
+
+    QJsonArray events = QJsonDocument::fromJson(timeline.toUtf8()).object().value("traceEvents").toArray();
+    for (const QJsonValue& v : events) {
+        QJsonObject event = v.toObject();
+        QString cat = event.value("cat").toString();
+        QString name = event.value("name").toString();
+        qint64 end = (qint64)event.value("ts").toDouble() + (qint64)event.value("dur").toDouble() - launch;
+
+        if ("daemon" == cat && "managerStart" == name) {
+            result.managerStart = end;
+            result.managerStartSpan = (qint64)event.value("dur").toDouble();
+        } else if ("activate" == cat) {
+            result.plugins.insert(name, end);
+        } else if ("idle" == cat) {
+            result.deferred.insert(name, qMax(end, result.deferred.value(name, 0)));
+        } else {
+            continue;
+        }
+        result.ready = qMax(result.ready, end);
+    }
+
+    QDBusConnection::disconnectFromBus(connName);
+
+    return result.managerStart >= 0;
+}
+
+void StartupBench::stopDaemon()
+{
+    if (mDaemon.state() == QProcess::NotRunning) return;
+
+    mDaemon.terminate();
+    if (!mDaemon.waitForFinished(BENCH_STOP_TIMEOUT)) {
+        mDaemon.kill();
+        mDaemon.waitForFinished();
+    }
+}
+
+void StartupBench::cleanup()
+{
+    if (0 != mContext) {
+        XRecordFreeContext(mControl, mContext);
+        mContext = 0;
+    }
+    if (nullptr != mData) {XCloseDisplay(mData); mData = nullptr;}
+    if (nullptr != mControl) {XCloseDisplay(mControl); mControl = nullptr;}
+
+    stopDaemon();
+    for (QProcess* p : {&mBus, &mXvfb}) {
+        if (p->state() == QProcess::NotRunning) continue;
+        p->terminate();
+        if (!p->waitForFinished(BENCH_STOP_TIMEOUT)) {
+            p->kill();
+            p->waitForFinished();
+        }
+    }
+}
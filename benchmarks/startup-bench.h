@@ -0,0 +1,82 @@
+#ifndef STARTUPBENCH_H
+#define STARTUPBENCH_H
+
+#include <QMap>
+#include <QString>
+#include <QProcess>
+#include <QStringList>
+#include <QJsonObject>
+#include <QTemporaryDir>
+
+#include <X11/Xlib.h>
+#include <X11/extensions/record.h>
+
+struct BenchOptions
+{
+    QString         daemon;         // ukui-settings-daemon 可执行文件
+    QString         pluginDir;      // 为空时使用守护进程默认目录
+    QStringList     plugins;        // 为空时加载全部插件
+    QStringList     daemonArgs;
+    bool            warmCache;      // 迭代之间保留 plugins.cache
+    int             settle;         // ms, 启动记录在这段时间内不再增加视为启动完成
+    int             timeout;        // ms
+};
+
+struct BenchResult
+{
+    bool                    ok;
+    qint64                  managerStart;   // us, 进程启动到 managerStart 返回
+    qint64                  managerStartSpan;// us, managerStart 自身耗时
+    qint64                  ready;          // us, 进程启动到最后一个插件就绪
+    QMap<QString, qint64>   plugins;        // us, 进程启动到插件 activate 返回
+    QMap<QString, qint64>   deferred;       // us, 进程启动到插件空闲回调结束
+    qint64                  peakRss;        // bytes, VmHWM
+    qint64                  roundTrips;     // 守护进程发出的需要回复的 X 请求数
+    qint64                  requests;       // 守护进程发出的全部 X 请求数
+
+    QJsonObject toJson () const;
+};
+
+/**
+ * 无界面启动基准:
+ * 每次迭代启动独立的 Xvfb、D-Bus 会话总线，守护进程使用 memory GSettings 后端，
+ * 通过 GetStartupTimeline 取启动记录，通过 XRecord 统计 X 请求和往返次数。
+ * 不需要 GPU 和网络。
+ */
+class StartupBench
+{
+public:
+    StartupBench(const BenchOptions& options);
+    ~StartupBench();
+
+    BenchResult runOnce ();
+
+private:
+    bool startXvfb ();
+    bool startBus ();
+    bool startRecord ();
+    void stopRecord ();
+    bool waitReady (BenchResult& result, qint64 launch);
+    void stopDaemon ();
+    void cleanup ();
+
+    static void recordCallback (XPointer closure, XRecordInterceptData* data);
+
+private:
+    BenchOptions            mOptions;
+    QTemporaryDir           mCacheDir;
+
+    QProcess                mXvfb;
+    QProcess                mBus;
+    QProcess                mDaemon;
+    QString                 mDisplayName;
+    QString                 mBusAddress;
+
+    Display*                mControl;
+    Display*                mData;
+    XRecordContext          mContext;
+    qint64                  mRequests;
+    qint64                  mRoundTrips;
+};
+
+#endif // STARTUPBENCH_H
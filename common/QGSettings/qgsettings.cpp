@@ -1,11 +1,23 @@
 #include "qgsettings.h"
 #include "qconftype.h"
+#include "settings-registry.h"
 
 #include <glib.h>
 #include <gio/gio.h>
 
+#include <QHash>
 #include <QDebug>
+#include <QMutex>
+#include <QTimer>
 #include <QString>
+#include <QStringList>
+#include <QMutexLocker>
+
+struct QGSettingsCacheEntry
+{
+    QByteArray          gkey;
+    QVariant            value;
+};
 
 struct QGSettingsPrivate
 {
@@ -15,12 +27,132 @@ struct QGSettingsPrivate
     GSettings           *settings;
     gulong              signalHandlerId;
 
+    /* 以调用者传入的 key 为索引，gkey 用于失效 */
+    bool                cached;
+    QMutex              cacheLock;
+    QHash<QString, QGSettingsCacheEntry> cache;
+    quint64             cacheHits;
+    quint64             cacheMisses;
+
+    /* 未写入的值，只在所属线程访问 */
+    bool                delayed;        // delay() 模式，直接写入 settings
+    int                 coalesce;
+    int                 transaction;
+    QTimer              *timer;
+    QHash<QByteArray, GVariant*> pending;
+    GSettings           *batch;         // 多个 key 一起写入时使用，首次需要时创建
+
+    /* changed 信号限速，notifyKeys 按首次改变的顺序保存 */
+    int                 notifyInterval;
+    QTimer              *notifyTimer;
+    QMutex              notifyLock;
+    QStringList         notifyKeys;
+    bool                notifyScheduled;
+    quint64             notifySuppressed;
+
+    void invalidate(const gchar *gkey);
+    void flush();
+    void deliver(QGSettings *self);
     static void settingChanged(GSettings *settings, const gchar *key, gpointer userData);
 };
 
+void QGSettingsPrivate::invalidate(const gchar *gkey)
+{
+    QMutexLocker locker(&cacheLock);
+
+    if (nullptr == gkey) {
+        cache.clear();
+        return;
+    }
+    for (auto it = cache.begin(); it != cache.end();) {
+        if (it.value().gkey == gkey)
+            it = cache.erase(it);
+        else
+            ++it;
+    }
+}
+
+void QGSettingsPrivate::flush()
+{
+    QHash<QByteArray, GVariant*> writes;
+
+    if (timer) timer->stop();
+    writes.swap(pending);
+    if (writes.isEmpty()) return;
+
+    if (1 == writes.size() || delayed) {
+        for (auto it = writes.constBegin(); it != writes.constEnd(); ++it) {
+            g_settings_set_value(settings, it.key().constData(), it.value());
+        }
+    } else {
+        /**
+         * g_settings_delay() cannot be undone and the shared object is written
+         * directly by other users, so batch through a delayed object of our own,
+         * created once and kept until the QGSettings is destroyed
+         */
+        if (nullptr == batch) {
+            if (path.isEmpty()) {
+                batch = g_settings_new(schemaId.constData());
+            } else {
+                batch = g_settings_new_with_path(schemaId.constData(), path.constData());
+            }
+            g_settings_delay(batch);
+        }
+        for (auto it = writes.constBegin(); it != writes.constEnd(); ++it) {
+            g_settings_set_value(batch, it.key().constData(), it.value());
+        }
+        g_settings_apply(batch);
+    }
+
+    for (auto it = writes.constBegin(); it != writes.constEnd(); ++it) {
+        if (cached) invalidate(it.key().constData());
+        g_variant_unref(it.value());
+    }
+}
+
+void QGSettingsPrivate::deliver(QGSettings *self)
+{
+    QStringList keys;
+
+    {
+        QMutexLocker locker(&notifyLock);
+        keys.swap(notifyKeys);
+        notifyScheduled = false;
+    }
+    // nothing changed during the window, the next change is delivered at once
+    if (keys.isEmpty()) return;
+
+    if (notifyInterval > 0) notifyTimer->start();
+    for (const QString& key : keys) {
+        Q_EMIT self->changed(key);
+    }
+}
+
 void QGSettingsPrivate::settingChanged(GSettings *, const gchar *key, gpointer userData)
 {
     QGSettings *self = (QGSettings *)userData;
+    QGSettingsPrivate *priv = self->mPriv;
+
+    // before the signal, so receivers read the new value
+    if (priv->cached) priv->invalidate(key);
+
+    if (priv->notifyInterval > 0) {
+        QMutexLocker locker(&priv->notifyLock);
+        QString qkey = QString::fromUtf8(key);
+
+        if (priv->notifyKeys.contains(qkey)) {
+            // receivers read the latest value when it is delivered
+            priv->notifySuppressed++;
+            return;
+        }
+        priv->notifyKeys.append(qkey);
+        if (priv->notifyScheduled) return;
+        priv->notifyScheduled = true;
+        locker.unlock();
+
+        QMetaObject::invokeMethod(self, "notifyChanged", Qt::AutoConnection);
+        return;
+    }
 
     /**
      * 这里不属于 QObject的子类，只能通过此方法强制调用 QObject 子类的方法或信号
@@ -40,18 +172,29 @@ QGSettings::QGSettings(const QByteArray &schemaId, const QByteArray &path, QObje
     mPriv = new QGSettingsPrivate;
     mPriv->schemaId = schemaId;
     mPriv->path = path;
-
-    if (mPriv->path.isEmpty()) {
-        mPriv->settings = g_settings_new(mPriv->schemaId.constData());
-    } else {
-        mPriv->settings = g_settings_new_with_path(mPriv->schemaId.constData(), mPriv->path.constData());
-    }
+    mPriv->cached = false;
+    mPriv->cacheHits = 0;
+    mPriv->cacheMisses = 0;
+    mPriv->delayed = false;
+    mPriv->coalesce = 0;
+    mPriv->transaction = 0;
+    mPriv->timer = nullptr;
+    mPriv->batch = nullptr;
+    mPriv->notifyInterval = 0;
+    mPriv->notifyTimer = nullptr;
+    mPriv->notifyScheduled = false;
+    mPriv->notifySuppressed = 0;
+
+    // shared with other users of the same schema, delay() detaches
+    mPriv->settings = SettingsRegistry::acquire(mPriv->schemaId.constData(), mPriv->path.constData());
     g_object_get(mPriv->settings, "settings-schema", &mPriv->schema, NULL);
     mPriv->signalHandlerId = g_signal_connect(mPriv->settings, "changed", G_CALLBACK(QGSettingsPrivate::settingChanged), this);
 }
 
 QGSettings::~QGSettings()
 {
+    mPriv->flush();
+    if (mPriv->batch) g_object_unref (mPriv->batch);
     if (mPriv->schema) {
         g_settings_sync ();
         g_signal_handler_disconnect(mPriv->settings, mPriv->signalHandlerId);
@@ -63,15 +206,64 @@ QGSettings::~QGSettings()
 
 QVariant QGSettings::get(const QString &key) const
 {
+    if (!mPriv->pending.isEmpty()) {
+        gchar *gkey = unqtify_name(key);
+        GVariant *value = mPriv->pending.value(gkey);
+        g_free(gkey);
+        if (value) return qconf_types_to_qvariant(value);
+    }
+
+    if (mPriv->cached) {
+        QMutexLocker locker(&mPriv->cacheLock);
+        auto it = mPriv->cache.constFind(key);
+        if (it != mPriv->cache.constEnd()) {
+            mPriv->cacheHits++;
+            return it.value().value;
+        }
+        mPriv->cacheMisses++;
+    }
+
     gchar *gkey = unqtify_name(key);
     GVariant *value = g_settings_get_value(mPriv->settings, gkey);
     QVariant qvalue = qconf_types_to_qvariant(value);
     g_variant_unref(value);
+
+    if (mPriv->cached) {
+        QMutexLocker locker(&mPriv->cacheLock);
+        QGSettingsCacheEntry& entry = mPriv->cache[key];
+        entry.gkey = gkey;
+        entry.value = qvalue;
+    }
     g_free(gkey);
 
     return qvalue;
 }
 
+void QGSettings::setCached(bool cached)
+{
+    mPriv->cached = cached;
+    if (!cached) mPriv->invalidate(nullptr);
+}
+
+bool QGSettings::isCached() const
+{
+    return mPriv->cached;
+}
+
+quint64 QGSettings::cacheHits() const
+{
+    QMutexLocker locker(&mPriv->cacheLock);
+
+    return mPriv->cacheHits;
+}
+
+quint64 QGSettings::cacheMisses() const
+{
+    QMutexLocker locker(&mPriv->cacheLock);
+
+    return mPriv->cacheMisses;
+}
+
 void QGSettings::set(const QString &key, const QVariant &value)
 {
     if (!trySet(key, value))
@@ -87,8 +279,33 @@ bool QGSettings::trySet(const QString &key, const QVariant &value)
     GVariant *cur = g_settings_get_value(mPriv->settings, gkey);
 
     GVariant *new_value = qconf_types_collect_from_variant(g_variant_get_type (cur), value);
-    if (new_value)
-        success = g_settings_set_value(mPriv->settings, gkey, new_value);
+    if (new_value) {
+        g_variant_ref_sink(new_value);
+        GVariant *pend = mPriv->pending.value(gkey);
+
+        if (g_variant_equal(pend ? pend : cur, new_value)) {
+            // nothing to write
+            success = true;
+        } else if (mPriv->transaction > 0 || mPriv->coalesce > 0) {
+            GSettingsSchemaKey *schemaKey = g_settings_schema_get_key(mPriv->schema, gkey);
+            success = g_settings_schema_key_range_check(schemaKey, new_value);
+            g_settings_schema_key_unref(schemaKey);
+            if (success) {
+                if (pend) g_variant_unref(pend);
+                if (g_variant_equal(cur, new_value)) {
+                    // back to the stored value
+                    mPriv->pending.remove(gkey);
+                } else {
+                    mPriv->pending.insert(gkey, g_variant_ref(new_value));
+                }
+                if (mPriv->transaction == 0 && !mPriv->timer->isActive()) mPriv->timer->start();
+            }
+        } else {
+            success = g_settings_set_value(mPriv->settings, gkey, new_value);
+            if (success && mPriv->cached) mPriv->invalidate(gkey);
+        }
+        g_variant_unref(new_value);
+    }
 
     g_free(gkey);
     g_variant_unref (cur);
@@ -96,9 +313,89 @@ bool QGSettings::trySet(const QString &key, const QVariant &value)
     return success;
 }
 
+void QGSettings::setCoalesce(int msec)
+{
+    if (nullptr == mPriv->timer) {
+        mPriv->timer = new QTimer(this);
+        mPriv->timer->setSingleShot(true);
+        connect(mPriv->timer, &QTimer::timeout, this, [this] () { mPriv->flush(); });
+    }
+
+    mPriv->coalesce = qMax(0, msec);
+    mPriv->timer->setInterval(mPriv->coalesce);
+    if (0 == mPriv->coalesce && 0 == mPriv->transaction) mPriv->flush();
+}
+
+void QGSettings::beginTransaction()
+{
+    if (nullptr == mPriv->timer) setCoalesce(0);
+
+    mPriv->transaction++;
+}
+
+void QGSettings::endTransaction()
+{
+    if (mPriv->transaction <= 0) return;
+
+    if (0 != --mPriv->transaction) return;
+
+    // with coalescing the transaction's writes join the pending window
+    if (mPriv->coalesce > 0) {
+        if (!mPriv->pending.isEmpty() && !mPriv->timer->isActive()) mPriv->timer->start();
+    } else {
+        mPriv->flush();
+    }
+}
+
+void QGSettings::sync()
+{
+    mPriv->flush();
+}
+
+void QGSettings::setNotifyInterval(int msec)
+{
+    if (nullptr == mPriv->notifyTimer) {
+        mPriv->notifyTimer = new QTimer(this);
+        mPriv->notifyTimer->setSingleShot(true);
+        connect(mPriv->notifyTimer, &QTimer::timeout, this, [this] () { mPriv->deliver(this); });
+    }
+
+    mPriv->notifyInterval = qMax(0, msec);
+    mPriv->notifyTimer->setInterval(mPriv->notifyInterval);
+    if (0 == mPriv->notifyInterval) {
+        mPriv->notifyTimer->stop();
+        mPriv->deliver(this);
+    }
+}
+
+int QGSettings::notifyInterval() const
+{
+    return mPriv->notifyInterval;
+}
+
+quint64 QGSettings::notifySuppressed() const
+{
+    QMutexLocker locker(&mPriv->notifyLock);
+
+    return mPriv->notifySuppressed;
+}
+
+void QGSettings::notifyChanged()
+{
+    // the timeout delivers what changed inside the window
+    if (mPriv->notifyTimer->isActive()) return;
+
+    mPriv->deliver(this);
+}
+
 void QGSettings::setEnum(char *key,int value)
 {
+    if (g_settings_get_enum (mPriv->settings,key) == value && !mPriv->pending.contains(key)) return;
+
+    // keep the order of writes
+    mPriv->flush();
     g_settings_set_enum (mPriv->settings,key,value);
+    if (mPriv->cached) mPriv->invalidate(key);
 }
 
 int QGSettings::getEnum(const char *key)
@@ -115,12 +412,28 @@ char **QGSettings::getStrv(const char *key)
 
 void QGSettings::delay()
 {
+    if (mPriv->delayed) return;
+
+    mPriv->flush();
+    // delay-apply mode must not affect the other users of the shared object
+    g_signal_handler_disconnect(mPriv->settings, mPriv->signalHandlerId);
+    g_object_unref(mPriv->settings);
+    if (mPriv->path.isEmpty()) {
+        mPriv->settings = g_settings_new(mPriv->schemaId.constData());
+    } else {
+        mPriv->settings = g_settings_new_with_path(mPriv->schemaId.constData(), mPriv->path.constData());
+    }
+    mPriv->signalHandlerId = g_signal_connect(mPriv->settings, "changed", G_CALLBACK(QGSettingsPrivate::settingChanged), this);
+
+    mPriv->delayed = true;
     g_settings_delay(mPriv->settings);
 }
 
 void QGSettings::apply()
 {
+    mPriv->flush();
     g_settings_apply(mPriv->settings);
+    if (mPriv->cached) mPriv->invalidate(nullptr);
 }
 
 QStringList QGSettings::keys() const
@@ -172,7 +485,10 @@ QVariantList QGSettings::choices(const QString &qkey) const
 void QGSettings::reset(const QString &qkey)
 {
     gchar *key = unqtify_name(qkey);
+    GVariant *pend = mPriv->pending.take(key);
+    if (pend) g_variant_unref(pend);
     g_settings_reset(mPriv->settings, key);
+    if (mPriv->cached) mPriv->invalidate(key);
     g_free(key);
 }
 
@@ -23,6 +23,51 @@ public:
      */
     QVariant get (const QString& key) const;
 
+    /**
+     * 缓存模式: get() 的结果按 key 缓存，key 改变(changed)或通过本对象写入时失效。
+     * 默认关闭，关闭时清空缓存
+     */
+    void setCached (bool cached);
+    bool isCached () const;
+
+    /**
+     * 缓存命中和未命中的次数
+     */
+    quint64 cacheHits () const;
+    quint64 cacheMisses () const;
+
+    /**
+     * 写入合并: 写入先保存在本地，同一 key 只保留最后一次的值，
+     * msec 毫秒后一次写入后端。0 (默认) 时立即写入。
+     * 未写入的值对本对象的 get() 可见
+     */
+    void setCoalesce (int msec);
+
+    /**
+     * 事务: 最外层 endTransaction() 时把期间的写入作为一次修改写入后端，可以嵌套，
+     * 设置了写入合并时在合并窗口结束时写入。通常使用 QGSettingsTransaction
+     * 一次写入多个 key 时，首次会另建一个 delay 模式的 GSettings 并保留到本对象析构
+     */
+    void beginTransaction ();
+    void endTransaction ();
+
+    /**
+     * 立即写入所有未写入的值
+     */
+    void sync ();
+
+    /**
+     * changed 信号限速: 第一次改变立即发射，之后 msec 毫秒内的改变合并，
+     * 窗口结束时每个 key 只发射一次(此时 get() 得到最新值)。0 (默认) 时不限速
+     */
+    void setNotifyInterval (int msec);
+    int notifyInterval () const;
+
+    /**
+     * 因限速合并而未发射的 changed 次数
+     */
+    quint64 notifySuppressed () const;
+
     /**
      * 根据 key 设定值
      */
@@ -70,7 +115,7 @@ public:
     char **getStrv(const char *key);
 
     /**
-     *
+     * 与当前值(或未写入的值)相同时不写入
      */
     bool trySet (const QString& key, const QVariant& value);
 
@@ -101,10 +146,29 @@ Q_SIGNALS:
      */
     void changed (const QString& key);
 
+private:
+    Q_INVOKABLE void notifyChanged ();
+
 private:
     struct QGSettingsPrivate* mPriv;
     friend struct QGSettingsPrivate;
 
 };
 
+/**
+ * 作用域内对 settings 的写入作为一次修改写入后端
+ */
+class QGSettingsTransaction
+{
+public:
+    explicit QGSettingsTransaction(QGSettings* settings) : mSettings(settings) { mSettings->beginTransaction(); }
+    ~QGSettingsTransaction() { mSettings->endTransaction(); }
+
+private:
+    QGSettingsTransaction(const QGSettingsTransaction&)=delete;
+    QGSettingsTransaction& operator= (const QGSettingsTransaction&)=delete;
+
+    QGSettings*         mSettings;
+};
+
 #endif // QGSETTINGS_H
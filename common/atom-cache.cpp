@@ -0,0 +1,106 @@
+#include "atom-cache.h"
+#include "resource-usage.h"
+
+#include <string.h>
+
+#include <QVector>
+#include <QMutexLocker>
+
+AtomCache* AtomCache::mCache = nullptr;
+
+AtomCache::AtomCache()
+{
+    mHits = 0;
+    mRoundTrips = 0;
+
+    ResourceUsage::instance()->registerCounter("atom-cache", "hits", this, [this] () -> qint64 {
+        return hits();
+    });
+    ResourceUsage::instance()->registerCounter("atom-cache", "round_trips", this, [this] () -> qint64 {
+        return roundTrips();
+    });
+}
+
+AtomCache* AtomCache::instance()
+{
+    static QBasicMutex lock;
+    QMutexLocker locker(&lock);
+
+    if (nullptr == mCache) mCache = new AtomCache;
+
+    return mCache;
+}
+
+Atom AtomCache::atom(Display* display, const char* name, bool onlyIfExists)
+{
+    return instance()->lookup(display, name, onlyIfExists);
+}
+
+Atom AtomCache::lookup(Display* display, const char* name, bool onlyIfExists)
+{
+    if (nullptr == display || nullptr == name) return None;
+
+    {
+        QMutexLocker locker(&mLock);
+        const QHash<QByteArray, Atom>& atoms = mAtoms[display];
+        auto it = atoms.constFind(QByteArray::fromRawData(name, strlen(name)));
+        // a missing name is created when it is not only looked up
+        if (it != atoms.constEnd() && (None != it.value() || onlyIfExists)) {
+            ++mHits;
+            return it.value();
+        }
+        ++mRoundTrips;
+    }
+
+    // no lock across the round-trip
+    Atom atom = XInternAtom(display, name, onlyIfExists ? True : False);
+
+    QMutexLocker locker(&mLock);
+    mAtoms[display].insert(QByteArray(name), atom);
+
+    return atom;
+}
+
+void AtomCache::preload(Display* display, const char* const* names, int count, bool onlyIfExists)
+{
+    QVector<Atom> atoms(count);
+
+    if (nullptr == display || count <= 0) return;
+
+    // the status only tells whether every name was found
+    XInternAtoms(display, (char**) names, count, onlyIfExists ? True : False, atoms.data());
+
+    QMutexLocker locker(&mLock);
+    QHash<QByteArray, Atom>& cache = mAtoms[display];
+    ++mRoundTrips;
+    for (int i = 0; i < count; ++i) {
+        cache.insert(QByteArray(names[i]), atoms.at(i));
+    }
+}
+
+void AtomCache::forgetMissing(Display* display)
+{
+    QMutexLocker locker(&mLock);
+    QHash<QByteArray, Atom>& cache = mAtoms[display];
+
+    for (auto it = cache.begin(); it != cache.end();) {
+        if (None == it.value())
+            it = cache.erase(it);
+        else
+            ++it;
+    }
+}
+
+qint64 AtomCache::hits()
+{
+    QMutexLocker locker(&mLock);
+
+    return mHits;
+}
+
+qint64 AtomCache::roundTrips()
+{
+    QMutexLocker locker(&mLock);
+
+    return mRoundTrips;
+}
@@ -0,0 +1,47 @@
+#ifndef ATOMCACHE_H
+#define ATOMCACHE_H
+
+#include <QHash>
+#include <QMutex>
+#include <QByteArray>
+
+#include <X11/Xlib.h>
+
+/**
+ * X atom 缓存:
+ * 按连接缓存 XInternAtom 的结果，命中时不再与 X 服务器往返。
+ * onlyIfExists 时不存在的名字也缓存为 None，之后可能被创建的名字(如设备属性)
+ * 在设备插入等时机调用 forgetMissing() 重新查询。
+ * preload() 用一次 XInternAtoms 取得一组名字。
+ * 只用于与进程同生命周期的连接，守护进程和插件共用一个实例，见 StartupTrace。线程安全。
+ */
+class AtomCache
+{
+public:
+    static AtomCache* instance ();
+
+    static Atom atom (Display* display, const char* name, bool onlyIfExists = false);
+
+    void preload (Display* display, const char* const* names, int count, bool onlyIfExists);
+    void forgetMissing (Display* display);
+
+    qint64 hits ();
+    qint64 roundTrips ();
+
+private:
+    AtomCache();
+    AtomCache(AtomCache&)=delete;
+    AtomCache& operator= (const AtomCache&)=delete;
+
+    Atom lookup (Display* display, const char* name, bool onlyIfExists);
+
+private:
+    QMutex                                          mLock;
+    QHash<Display*, QHash<QByteArray, Atom>>        mAtoms;
+    qint64                                          mHits;
+    qint64                                          mRoundTrips;
+
+    static AtomCache*                               mCache;
+};
+
+#endif // ATOMCACHE_H
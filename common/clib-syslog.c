@@ -1,64 +1,293 @@
 #include "clib-syslog.h"
 
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+typedef struct _LogRecord   LogRecord;
+typedef struct _LogRing     LogRing;
+
+struct _LogRecord
+{
+    int                 level;
+    struct timespec     time;
+    char                msg[LOG_RECORD_SIZE];
+};
+
+/*
+ * 单生产者单消费者环形缓冲区:
+ * head 只由所属线程写，tail 只由写日志的线程写
+ */
+struct _LogRing
+{
+    unsigned int        head;
+    unsigned int        tail;
+    unsigned int        dropped;
+    int                 orphan;             // 所属线程已退出，写完后释放
+    LogRing*            next;
+    LogRecord           records[LOG_RING_SIZE];
+};
+
+int syslog_level = LOG_LEVEL;
+
 static char sysCategory[128] = {0};
 static int sysFacility = 0;
+static int sysInited = 0;
+static FILE* sysFile = NULL;
+
+static LogRing* rings = NULL;
+static pthread_key_t ringKey;
+static pthread_once_t ringOnce = PTHREAD_ONCE_INIT;
+static __thread LogRing* threadRing = NULL;
+
+static pthread_mutex_t flushLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t wakeLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeCond = PTHREAD_COND_INITIALIZER;
+static int wakeFlag = 0;                    // 有日志等待写出，后台线程写出前清零
+static int wakeUrgent = 0;                  // wakeLock 保护
+
+static const char* level_str(int logLevel)
+{
+    switch (logLevel) {
+    case LOG_EMERG:
+        return "EMERG";
+    case LOG_ALERT:
+        return "ALERT";
+    case LOG_CRIT:
+        return "CRIT";
+    case LOG_ERR:
+        return "ERROR";
+    case LOG_WARNING:
+        return "WARNING";
+    case LOG_NOTICE:
+        return "NOTICE";
+    case LOG_INFO:
+        return "INFO";
+    case LOG_DEBUG:
+        return "DEBUG";
+    default:
+        return "UNKNOWN";
+    }
+}
+
+static void ring_release(void* data)
+{
+    LogRing* ring = (LogRing*)data;
+
+    threadRing = NULL;
+    __atomic_store_n(&ring->orphan, 1, __ATOMIC_RELEASE);
+}
+
+static void write_record(int logLevel, const struct timespec* time, const char* msg)
+{
+    if (NULL != sysFile) {
+        struct tm tm;
+        char stamp[32] = {0};
+        localtime_r(&time->tv_sec, &tm);
+        strftime(stamp, sizeof stamp, "%F %T", &tm);
+        fprintf(sysFile, "%s.%03ld %s\n", stamp, time->tv_nsec / 1000000, msg);
+    } else {
+        syslog(logLevel, "%s", msg);
+    }
+}
+
+/* 调用者持有 flushLock */
+static void drain_ring(LogRing* ring)
+{
+    unsigned int tail = ring->tail;
+    unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    unsigned int dropped = 0;
+
+    for (; tail != head; ++tail) {
+        LogRecord* record = &ring->records[tail & (LOG_RING_SIZE - 1)];
+        write_record(record->level, &record->time, record->msg);
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+    dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+    if (dropped > 0) {
+        char msg[192] = {0};
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        snprintf(msg, sizeof msg - 1, "WARNING [%s] %u log messages dropped", sysCategory, dropped);
+        write_record(LOG_WARNING, &now, msg);
+    }
+}
+
+/* 调用者持有 flushLock，生产者只在表头插入，所以只有表头需要 CAS */
+static void drain_rings(void)
+{
+    LogRing* prev = NULL;
+    LogRing* ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+
+    while (NULL != ring) {
+        LogRing* next = ring->next;
+        int orphan = __atomic_load_n(&ring->orphan, __ATOMIC_ACQUIRE);
+
+        drain_ring(ring);
+        if (!orphan) {
+            prev = ring;
+            ring = next;
+            continue;
+        }
+
+        if (NULL != prev) {
+            prev->next = next;
+        } else {
+            LogRing* expected = ring;
+            if (!__atomic_compare_exchange_n(&rings, &expected, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                /* 有新的线程插入了表头，重新找前驱 */
+                for (prev = expected; prev->next != ring; prev = prev->next);
+                prev->next = next;
+            }
+        }
+        free(ring);
+        ring = next;
+    }
+
+    if (NULL != sysFile) fflush(sysFile);
+}
+
+/* 没有日志时一直阻塞，不定时唤醒 */
+static void* flush_thread(void* data)
+{
+    (void)data;
+
+    for (;;) {
+        pthread_mutex_lock(&wakeLock);
+        while (!__atomic_load_n(&wakeFlag, __ATOMIC_ACQUIRE)) {
+            pthread_cond_wait(&wakeCond, &wakeLock);
+        }
+
+        /* 收集一批再写，错误日志不等待 */
+        if (!wakeUrgent) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += LOG_FLUSH_INTERVAL * 1000000L;
+            ts.tv_sec += ts.tv_nsec / 1000000000L;
+            ts.tv_nsec %= 1000000000L;
+            while (!wakeUrgent && ETIMEDOUT != pthread_cond_timedwait(&wakeCond, &wakeLock, &ts));
+        }
+        wakeUrgent = 0;
+        pthread_mutex_unlock(&wakeLock);
+
+        /* 清零之后写入的日志会再次唤醒 */
+        __atomic_exchange_n(&wakeFlag, 0, __ATOMIC_SEQ_CST);
+        syslog_flush();
+    }
+
+    return NULL;
+}
+
+static void log_once(void)
+{
+    pthread_t thread;
+    const char* file = getenv(LOG_FILE_ENV);
+
+    pthread_key_create(&ringKey, ring_release);
+
+    if (NULL != file && *file != '\0') sysFile = fopen(file, "a");
+
+    if (0 == pthread_create(&thread, NULL, flush_thread, NULL)) {
+        pthread_detach(thread);
+    }
+    atexit(syslog_flush);
+}
+
+static LogRing* get_ring(void)
+{
+    LogRing* ring = threadRing;
+
+    if (NULL != ring) return ring;
+
+    ring = (LogRing*)calloc(1, sizeof(LogRing));
+    if (NULL == ring) return NULL;
+
+    ring->next = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+    while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+
+    pthread_setspecific(ringKey, ring);
+    threadRing = ring;
+
+    return ring;
+}
 
 void syslog_init(const char *category, int facility)
 {
-    if (NULL == category) {
+    if (NULL == category || sysInited) {
         return;
     }
+    sysInited = 1;
 
     memset(sysCategory, 0, sizeof sysCategory);
     strncpy(sysCategory, category, sizeof sysCategory - 1);
     sysFacility = facility;
+
+    openlog("", LOG_NDELAY, sysFacility);
+    pthread_once(&ringOnce, log_once);
+}
+
+void syslog_set_level(int logLevel)
+{
+    if (logLevel < LOG_EMERG || logLevel > LOG_DEBUG) return;
+
+    __atomic_store_n(&syslog_level, logLevel, __ATOMIC_RELAXED);
+}
+
+int syslog_get_level(void)
+{
+    return __atomic_load_n(&syslog_level, __ATOMIC_RELAXED);
+}
+
+void syslog_flush(void)
+{
+    pthread_mutex_lock(&flushLock);
+    drain_rings();
+    pthread_mutex_unlock(&flushLock);
 }
 
 void syslog_info(int logLevel, const char *fileName, const char *functionName, int line, const char* fmt, ...)
 {
-    if (logLevel > LOG_LEVEL) return;
+    if (logLevel > syslog_level) return;
 
-    char buf[2048] = {0};
-    char *logLevelstr = NULL;
+    LogRing* ring = NULL;
+    LogRecord* record = NULL;
+    unsigned int head = 0;
+    unsigned int tail = 0;
     unsigned long tagLen = 0;
+    int urgent = 0;
     va_list para;
-    va_start(para, fmt);
 
-    memset(buf, 0, sizeof buf);
+    pthread_once(&ringOnce, log_once);
 
-    openlog("", LOG_NDELAY, sysFacility);
-    switch (logLevel) {
-    case LOG_EMERG:
-        logLevelstr = "EMERG";
-        break;
-    case LOG_ALERT:
-        logLevelstr = "ALERT";
-        break;
-    case LOG_CRIT:
-        logLevelstr = "CRIT";
-        break;
-    case LOG_ERR:
-        logLevelstr = "ERROR";
-        break;
-    case LOG_WARNING:
-        logLevelstr = "WARNING";
-        break;
-    case LOG_NOTICE:
-        logLevelstr = "NOTICE";
-        break;
-    case LOG_INFO:
-        logLevelstr = "INFO";
-        break;
-    case LOG_DEBUG:
-        logLevelstr = "DEBUG";
-        break;
-    default:
-        logLevelstr = "UNKNOWN";
+    ring = get_ring();
+    if (NULL == ring) return;
 
+    head = ring->head;
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= LOG_RING_SIZE) {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
     }
-    snprintf(buf, sizeof buf - 1, "%s [%s] %s %s line:%-5d ", logLevelstr, sysCategory, fileName, functionName, line);
-    tagLen = strlen(buf);
-    vsnprintf(buf + tagLen, sizeof buf - 1 - tagLen, (const char*)fmt, para);
-    closelog();
+
+    record = &ring->records[head & (LOG_RING_SIZE - 1)];
+    record->level = logLevel;
+    clock_gettime(CLOCK_REALTIME, &record->time);
+
+    va_start(para, fmt);
+    snprintf(record->msg, sizeof record->msg - 1, "%s [%s] %s %s line:%-5d ", level_str(logLevel), sysCategory, fileName, functionName, line);
+    tagLen = strlen(record->msg);
+    vsnprintf(record->msg + tagLen, sizeof record->msg - 1 - tagLen, (const char*)fmt, para);
     va_end(para);
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    /* 只有第一条等待写出的日志需要唤醒，错误日志或缓冲区过半时不等待收集 */
+    urgent = (logLevel <= LOG_ERR || head + 1 - tail == LOG_RING_SIZE / 2);
+    if (!__atomic_exchange_n(&wakeFlag, 1, __ATOMIC_SEQ_CST) || urgent) {
+        pthread_mutex_lock(&wakeLock);
+        if (urgent) wakeUrgent = 1;
+        pthread_cond_signal(&wakeCond);
+        pthread_mutex_unlock(&wakeLock);
+    }
 }
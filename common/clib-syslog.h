@@ -10,18 +10,24 @@
 extern "C" {
 #endif
 
-#ifdef QT_NO_DEBUG
+/* 默认级别，调试日志用 D-Bus 的 SetLogLevel 打开 */
 #define LOG_LEVEL LOG_INFO
-#else
-#define LOG_LEVEL LOG_DEBUG
-#endif
+
+#define LOG_FILE_ENV        "USD_LOG_FILE"      // 设置后日志写入该文件而不是 syslog
+#define LOG_RECORD_SIZE     512                 // 单条日志最大长度
+#define LOG_RING_SIZE       128                 // 每个线程缓存的日志条数，必须是 2 的幂
+#define LOG_FLUSH_INTERVAL  100                 // 后台线程收集一批日志再写出的时间(毫秒)，错误日志立即写出
+
 //__FILE__
 #define CT_SYSLOG(logLevel,...) {\
-    syslog_info(logLevel, "", __func__, __LINE__, ##__VA_ARGS__);\
+    if ((logLevel) <= syslog_level) syslog_info(logLevel, "", __func__, __LINE__, ##__VA_ARGS__);\
 }
 
+/* 当前日志级别，高于此级别的 CT_SYSLOG 只做一次比较 */
+extern int syslog_level;
+
 /*
- * 日志参数初始化
+ * 日志参数初始化，只有第一次调用生效
  * @param category: 标签
  * @param facility: 设备文件
  * @return
@@ -31,6 +37,8 @@ void syslog_init(const char *category, int facility);
 
 /*
  * 日志输出到system log，默认LOG_INFO级别
+ * 日志先格式化到当前线程的无锁环形缓冲区，由后台线程写到 syslog 或 LOG_FILE_ENV 指定的文件，
+ * 缓冲区满时丢弃并记录丢弃的条数
  * @param loglevel: 日志级别
  * @param file: 文件名
  * @param function: 函数
@@ -41,6 +49,22 @@ void syslog_init(const char *category, int facility);
  */
 void syslog_info(int logLevel, const char *file, const char *function, int line, const char* fmt, ...);
 
+/*
+ * 运行时修改日志级别
+ * @param logLevel: LOG_EMERG ~ LOG_DEBUG
+ * @return
+ *      void
+ */
+void syslog_set_level(int logLevel);
+int syslog_get_level(void);
+
+/*
+ * 立即写出所有线程缓存的日志，进程退出时自动调用
+ * @return
+ *      void
+ */
+void syslog_flush(void);
+
 #ifdef __cplusplus
 }
 #endif
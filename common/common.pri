@@ -6,18 +6,30 @@ INCLUDEPATH += -I $$PWD/
 
 PKGCONFIG += \
         glib-2.0\
-        gio-2.0 libxklavier \
-        x11 xrandr xtst
+        gio-2.0 gdk-3.0 libxklavier \
+        x11 xrandr xtst xi
 
 SOURCES += \
+    $$PWD/atom-cache.cpp \
     $$PWD/clib-syslog.c\
     $$PWD/QGSettings/qconftype.cpp\
     $$PWD/QGSettings/qgsettings.cpp \
+    $$PWD/startup-trace.cpp \
+    $$PWD/loop-watchdog.cpp \
+    $$PWD/resource-usage.cpp \
+    $$PWD/settings-registry.cpp \
+    $$PWD/xevent-dispatcher.cpp \
     $$PWD/xeventmonitor.cpp
 
 HEADERS += \
+    $$PWD/atom-cache.h \
     $$PWD/clib-syslog.h \
     $$PWD/plugin-interface.h\
     $$PWD/QGSettings/qconftype.h\
     $$PWD/QGSettings/qgsettings.h \
+    $$PWD/startup-trace.h \
+    $$PWD/loop-watchdog.h \
+    $$PWD/resource-usage.h \
+    $$PWD/settings-registry.h \
+    $$PWD/xevent-dispatcher.h \
     $$PWD/xeventmonitor.h
@@ -0,0 +1,231 @@
+#!/usr/bin/env python3
+#
+# 由 gschema XML 生成类型化的访问类，用法见 gschema.pri:
+#   gschema-gen.py org.ukui.peripherals-mouse.gschema.xml org.ukui.peripherals-mouse.gschema.h
+#
+# 每个 <schema> 生成一个类:
+#   enum Key        key 的编号，KeyCount 为个数
+#   keyId()         key 名到编号的完美哈希，不是本 schema 的 key 返回 -1
+#   keyName()       编号到 key 名
+#   get/set         按 key 类型生成的读写函数，枚举类型的 key 同时生成 C++ 枚举
+#
+
+import os
+import re
+import sys
+import xml.etree.ElementTree as ET
+
+TYPES = {
+    'b':  ('bool',        '{}.toBool()'),
+    'i':  ('int',         '{}.toInt()'),
+    'u':  ('uint',        '{}.toUInt()'),
+    'x':  ('qint64',      '{}.toLongLong()'),
+    't':  ('quint64',     '{}.toULongLong()'),
+    'd':  ('double',      '{}.toDouble()'),
+    's':  ('QString',     '{}.toString()'),
+    'as': ('QStringList', '{}.toStringList()'),
+}
+
+KEYWORDS = {
+    'auto', 'bool', 'break', 'case', 'char', 'class', 'const', 'continue', 'default', 'delete',
+    'do', 'double', 'else', 'enum', 'explicit', 'export', 'extern', 'false', 'float', 'for',
+    'friend', 'goto', 'if', 'inline', 'int', 'long', 'mutable', 'namespace', 'new', 'operator',
+    'private', 'protected', 'public', 'register', 'return', 'short', 'signed', 'sizeof', 'static',
+    'struct', 'switch', 'template', 'this', 'throw', 'true', 'try', 'typedef', 'typename', 'union',
+    'unsigned', 'using', 'virtual', 'void', 'volatile', 'while', 'signals', 'slots', 'emit',
+}
+
+MAX_SEED = 1 << 12
+
+
+def schema_hash(seed, key):
+    # same as gschema_hash() in gschema.h
+    h = 2166136261 ^ seed
+    for c in key.encode('utf-8'):
+        h ^= c
+        h = (h * 16777619) & 0xffffffff
+    return h
+
+
+def perfect_hash(keys):
+    # at least twice the keys, otherwise the search takes too long
+    size = 1
+    while size < 2 * len(keys):
+        size <<= 1
+
+    while True:
+        for seed in range(MAX_SEED):
+            table = [-1] * size
+            for i, key in enumerate(keys):
+                slot = schema_hash(seed, key) & (size - 1)
+                if table[slot] >= 0:
+                    break
+                table[slot] = i
+            else:
+                return seed, size, table
+        size <<= 1
+
+
+def camel(name, upper):
+    words = [w for w in re.split(r'[^0-9A-Za-z]+', name) if w]
+    s = ''.join(w[0].upper() + w[1:] for w in words)
+    if not upper:
+        s = s[0].lower() + s[1:]
+    if s[0].isdigit():
+        s = '_' + s
+    if s in KEYWORDS:
+        s += '_'
+    return s
+
+
+def class_name(schema_id):
+    # org.ukui.peripherals-mouse -> PeripheralsMouse
+    for prefix in ('org.ukui.', 'org.mate.', 'org.gnome.'):
+        if schema_id.startswith(prefix):
+            schema_id = schema_id[len(prefix):]
+            break
+    return camel(schema_id, True)
+
+
+def c_string(s):
+    return '"' + s.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+
+def generate_schema(out, schema, enums):
+    cls = class_name(schema.get('id'))
+    keys = [k for k in schema.findall('key')]
+    names = [k.get('name') for k in keys]
+    if len(names) > 127:
+        raise ValueError('%s: too many keys' % schema.get('id'))
+
+    used = []
+    for k in keys:
+        if k.get('enum') and k.get('enum') in enums and k.get('enum') not in used:
+            used.append(k.get('enum'))
+
+    out.append('class %s' % cls)
+    out.append('{')
+    out.append('public:')
+    out.append('    enum Key {')
+    for i, name in enumerate(names):
+        out.append('        Key%s = %d,' % (camel(name, True), i))
+    out.append('        KeyCount = %d' % len(names))
+    out.append('    };')
+    out.append('')
+
+    for enum_id in used:
+        enum_name = camel(enum_id.split('.')[-1], True)
+        out.append('    enum %s {' % enum_name)
+        values = enums[enum_id]
+        for j, (nick, value) in enumerate(values):
+            out.append('        %s%s = %s%s' % (enum_name, camel(nick, True), value, ',' if j + 1 < len(values) else ''))
+        out.append('    };')
+        out.append('')
+
+    out.append('    static const char* schemaId () { return %s; }' % c_string(schema.get('id')))
+    out.append('')
+
+    if names:
+        seed, size, table = perfect_hash(names)
+        out.append('    static const char* keyName (Key key)')
+        out.append('    {')
+        out.append('        static const char* const names[] = {')
+        for name in names:
+            out.append('            %s,' % c_string(name))
+        out.append('        };')
+        out.append('        return (key >= 0 && key < KeyCount) ? names[key] : nullptr;')
+        out.append('    }')
+        out.append('')
+        out.append('    static int keyId (const char* key, int len)')
+        out.append('    {')
+        out.append('        static const signed char table[%d] = {%s};' % (size, ', '.join(str(s) for s in table)))
+        out.append('        static const char* const names[] = {')
+        for name in names:
+            out.append('            %s,' % c_string(name))
+        out.append('        };')
+        out.append('        return gschema_lookup(%du, %du, table, names, key, len);' % (seed, size - 1))
+        out.append('    }')
+    else:
+        out.append('    static const char* keyName (Key) { return nullptr; }')
+        out.append('    static int keyId (const char*, int) { return -1; }')
+    out.append('')
+    out.append('    static int keyId (const QString& key)')
+    out.append('    {')
+    out.append('        QByteArray k = key.toUtf8();')
+    out.append('        return keyId(k.constData(), k.size());')
+    out.append('    }')
+    out.append('')
+    out.append('    explicit %s(QGSettings* settings) : mSettings(settings) {}' % cls)
+    out.append('')
+    out.append('    QGSettings* object () const { return mSettings; }')
+    out.append('')
+
+    for k in keys:
+        name = k.get('name')
+        getter = camel(name, False)
+        setter = 'set' + camel(name, True)
+        enum_id = k.get('enum')
+        if enum_id and enum_id in enums:
+            enum_name = camel(enum_id.split('.')[-1], True)
+            out.append('    %s %s () const { return (%s) mSettings->getEnum(%s); }'
+                       % (enum_name, getter, enum_name, c_string(name)))
+            out.append('    void %s (%s value) { mSettings->setEnum((char*) %s, value); }'
+                       % (setter, enum_name, c_string(name)))
+        elif k.get('type') in TYPES:
+            ctype, conv = TYPES[k.get('type')]
+            arg = ctype if ctype in ('bool', 'int', 'uint', 'qint64', 'quint64', 'double') else 'const %s&' % ctype
+            out.append('    %s %s () const { return %s; }'
+                       % (ctype, getter, conv.format('mSettings->get(QStringLiteral(%s))' % c_string(name))))
+            out.append('    void %s (%s value) { mSettings->set(QStringLiteral(%s), value); }'
+                       % (setter, arg, c_string(name)))
+        else:
+            # flags, tuples and dictionaries
+            out.append('    QVariant %s () const { return mSettings->get(QStringLiteral(%s)); }' % (getter, c_string(name)))
+            out.append('    void %s (const QVariant& value) { mSettings->set(QStringLiteral(%s), value); }'
+                       % (setter, c_string(name)))
+
+    out.append('')
+    out.append('private:')
+    out.append('    QGSettings*         mSettings;')
+    out.append('};')
+    out.append('')
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.stderr.write('usage: %s <schema.gschema.xml> <output.h>\n' % sys.argv[0])
+        return 1
+
+    root = ET.parse(sys.argv[1]).getroot()
+    enums = {}
+    for e in root.findall('enum'):
+        enums[e.get('id')] = [(v.get('nick'), v.get('value')) for v in e.findall('value')]
+
+    guard = re.sub(r'[^0-9A-Za-z]', '_', os.path.basename(sys.argv[2])).upper()
+    out = [
+        '/* Generated by gschema-gen.py from %s, do not edit */' % os.path.basename(sys.argv[1]),
+        '#ifndef %s' % guard,
+        '#define %s' % guard,
+        '',
+        '#include <QVariant>',
+        '#include <QStringList>',
+        '',
+        '#include "gschema.h"',
+        '',
+        'namespace Schema {',
+        '',
+    ]
+    for schema in root.findall('schema'):
+        generate_schema(out, schema, enums)
+    out.append('} // namespace Schema')
+    out.append('')
+    out.append('#endif // %s' % guard)
+
+    with open(sys.argv[2], 'w') as f:
+        f.write('\n'.join(out) + '\n')
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,39 @@
+#ifndef GSCHEMA_H
+#define GSCHEMA_H
+
+#include <string.h>
+
+#include <QString>
+#include <QByteArray>
+
+#include "QGSettings/qgsettings.h"
+
+/**
+ * gschema-gen.py 生成的访问类使用的公共部分，见 gschema.pri。
+ * 哈希函数必须与 gschema-gen.py 中的 schema_hash() 一致。
+ */
+inline unsigned int gschema_hash (unsigned int seed, const char* key, int len)
+{
+    unsigned int h = 2166136261u ^ seed;
+
+    for (int i = 0; i < len; ++i) {
+        h ^= (unsigned char) key[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+/* table 为生成的完美哈希表，mask + 1 为表长，不是 names 中的 key 时返回 -1 */
+inline int gschema_lookup (unsigned int seed, unsigned int mask, const signed char* table,
+                           const char* const* names, const char* key, int len)
+{
+    if (nullptr == key || len <= 0) return -1;
+
+    int id = table[gschema_hash(seed, key, len) & mask];
+    if (id < 0 || 0 != strncmp(names[id], key, len) || '\0' != names[id][len]) return -1;
+
+    return id;
+}
+
+#endif // GSCHEMA_H
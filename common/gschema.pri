@@ -0,0 +1,21 @@
+# 由 data/ 下的 gschema 生成类型化的访问类(见 gschema-gen.py)，用法:
+#   GSCHEMAS += org.ukui.peripherals-mouse
+#   include($$PWD/../../common/gschema.pri)
+# 然后 #include "org.ukui.peripherals-mouse.gschema.h"
+
+GSCHEMA_DIR = $$PWD/../data
+
+for(schema, GSCHEMAS) {
+    GSCHEMA_FILES += $$GSCHEMA_DIR/$${schema}.gschema.xml
+}
+
+gschema.input = GSCHEMA_FILES
+gschema.output = ${QMAKE_FILE_BASE}.h
+gschema.commands = python3 $$PWD/gschema-gen.py ${QMAKE_FILE_NAME} ${QMAKE_FILE_OUT}
+gschema.depends = $$PWD/gschema-gen.py
+gschema.variable_out = HEADERS
+gschema.CONFIG += no_link target_predeps
+
+QMAKE_EXTRA_COMPILERS += gschema
+
+HEADERS += $$PWD/gschema.h
@@ -0,0 +1,163 @@
+#include "loop-watchdog.h"
+#include "clib-syslog.h"
+#include "startup-trace.h"
+
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QMutexLocker>
+
+LoopWatchdog* LoopWatchdog::mWatchdog = nullptr;
+
+LoopWatchdog::LoopWatchdog()
+{
+    mThreshold = 0;
+    mInterval = 0;
+    mHeartbeat = nullptr;
+    mMainThread = nullptr;
+    mBeat.store(0);
+    mPlugin.store(nullptr);
+    mCallback.store(nullptr);
+}
+
+LoopWatchdog* LoopWatchdog::instance()
+{
+    if (nullptr == mWatchdog) mWatchdog = new LoopWatchdog;
+
+    return mWatchdog;
+}
+
+void LoopWatchdog::startWatch(int threshold)
+{
+    if (threshold <= 0 || isRunning()) return;
+
+    mThreshold = threshold;
+    mInterval = qMax(threshold / 4, LOOP_WATCHDOG_MIN_INTERVAL);
+    mMainThread = QThread::currentThread();
+    mBeat.store(StartupTrace::now());
+
+    mHeartbeat = new QTimer;
+    connect(mHeartbeat, &QTimer::timeout, [this] () { mBeat.store(StartupTrace::now()); });
+    mHeartbeat->start(mInterval);
+
+    start(QThread::LowPriority);
+    CT_SYSLOG(LOG_DEBUG, "main loop watchdog started, threshold %d ms", mThreshold);
+}
+
+void LoopWatchdog::stopWatch()
+{
+    if (!isRunning()) return;
+
+    requestInterruption();
+    wait();
+
+    if (nullptr != mHeartbeat) {delete mHeartbeat; mHeartbeat = nullptr;}
+}
+
+bool LoopWatchdog::isMainThread()
+{
+    return (nullptr != mMainThread) && (QThread::currentThread() == mMainThread);
+}
+
+void LoopWatchdog::enter(const char* plugin, const char* callback, const char** prevPlugin, const char** prevCallback)
+{
+    *prevPlugin = mPlugin.fetchAndStoreOrdered(plugin);
+    *prevCallback = mCallback.fetchAndStoreOrdered(callback);
+}
+
+void LoopWatchdog::leave(const char* prevPlugin, const char* prevCallback)
+{
+    mPlugin.store(prevPlugin);
+    mCallback.store(prevCallback);
+}
+
+void LoopWatchdog::run()
+{
+    bool        stalled = false;
+    qint64      stallBeat = 0;
+    const char* plugin = nullptr;
+    const char* callback = nullptr;
+
+    while (!isInterruptionRequested()) {
+        msleep(mInterval);
+
+        qint64 beat = mBeat.load();
+        if (!stalled) {
+            if (StartupTrace::now() - beat > (qint64)mThreshold * 1000) {
+                stalled = true;
+                stallBeat = beat;
+                plugin = mPlugin.load();
+                callback = mCallback.load();
+            }
+        } else if (beat != stallBeat) {
+            // the heartbeat is one interval late even without a stall
+            addStall(plugin, callback, beat - stallBeat - (qint64)mInterval * 1000);
+            stalled = false;
+        } else if (nullptr == plugin) {
+            plugin = mPlugin.load();
+            callback = mCallback.load();
+        }
+    }
+}
+
+void LoopWatchdog::addStall(const char* plugin, const char* callback, qint64 duration)
+{
+    QString name = (nullptr != plugin) ? plugin : "unknown";
+    QString cb = (nullptr != callback) ? callback : "";
+
+    CT_SYSLOG(LOG_WARNING, "main loop stalled %lld ms in '%s' '%s'", duration / 1000, name.toUtf8().data(), cb.toUtf8().data());
+
+    QMutexLocker locker(&mLock);
+    LoopStall& stall = mStalls[name];
+    if (0 == stall.count) {
+        stall.worst = 0;
+        stall.total = 0;
+    }
+    stall.count++;
+    stall.total += duration;
+    if (duration > stall.worst) {
+        stall.worst = duration;
+        stall.callback = cb;
+    }
+}
+
+QHash<QString, LoopStall> LoopWatchdog::getStalls()
+{
+    QMutexLocker locker(&mLock);
+
+    return mStalls;
+}
+
+QString LoopWatchdog::toJson()
+{
+    QJsonObject plugins;
+    QHash<QString, LoopStall> stalls = getStalls();
+
+    for (auto it = stalls.constBegin(); it != stalls.constEnd(); ++it) {
+        QJsonObject stall;
+        stall.insert("count", it.value().count);
+        stall.insert("worst_us", it.value().worst);
+        stall.insert("total_us", it.value().total);
+        stall.insert("worst_callback", it.value().callback);
+        plugins.insert(it.key(), stall);
+    }
+
+    QJsonObject json;
+    json.insert("threshold_ms", mThreshold);
+    json.insert("plugins", plugins);
+
+    return QString::fromUtf8(QJsonDocument(json).toJson(QJsonDocument::Compact));
+}
+
+WatchdogScope::WatchdogScope(const char* plugin, const char* callback)
+{
+    LoopWatchdog* watchdog = LoopWatchdog::instance();
+
+    // only the main loop is watched
+    mActive = watchdog->isMainThread();
+    if (mActive) watchdog->enter(plugin, callback, &mPrevPlugin, &mPrevCallback);
+}
+
+WatchdogScope::~WatchdogScope()
+{
+    if (mActive) LoopWatchdog::instance()->leave(mPrevPlugin, mPrevCallback);
+}
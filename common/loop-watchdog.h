@@ -0,0 +1,90 @@
+#ifndef LOOPWATCHDOG_H
+#define LOOPWATCHDOG_H
+
+#include <QHash>
+#include <QMutex>
+#include <QTimer>
+#include <QString>
+#include <QThread>
+#include <QAtomicInteger>
+#include <QAtomicPointer>
+
+#define LOOP_WATCHDOG_THRESHOLD_ENV                 "USD_WATCHDOG_THRESHOLD"
+#define LOOP_WATCHDOG_THRESHOLD                     200         // ms, 0 禁用
+#define LOOP_WATCHDOG_MIN_INTERVAL                  10          // ms
+
+/* 标记主循环当前正在执行的插件回调，参数必须是字符串常量 */
+#define USD_WATCHDOG_SCOPE(plugin, callback)        WatchdogScope usdWatchdogScope(plugin, callback)
+
+struct LoopStall
+{
+    qint64          count;
+    qint64          worst;          // 微秒
+    qint64          total;          // 微秒
+    QString         callback;       // 最长一次卡顿时的回调
+};
+
+/**
+ * 主循环卡顿监测:
+ * 主线程的定时器不断更新心跳，监测线程发现心跳超过阈值未更新时，
+ * 把这次卡顿记到 USD_WATCHDOG_SCOPE 标记的插件回调上。
+ * 守护进程和插件共用一个实例，见 StartupTrace。
+ */
+class LoopWatchdog : public QThread
+{
+    Q_OBJECT
+public:
+    static LoopWatchdog* instance ();
+
+    /* 在主线程中调用 */
+    void startWatch (int threshold);
+    void stopWatch ();
+
+    void enter (const char* plugin, const char* callback, const char** prevPlugin, const char** prevCallback);
+    void leave (const char* prevPlugin, const char* prevCallback);
+    bool isMainThread ();
+
+    QHash<QString, LoopStall> getStalls ();
+    QString toJson ();
+
+protected:
+    void run ();
+
+private:
+    LoopWatchdog();
+    LoopWatchdog(LoopWatchdog&)=delete;
+    LoopWatchdog& operator= (const LoopWatchdog&)=delete;
+
+    void addStall (const char* plugin, const char* callback, qint64 duration);
+
+private:
+    int                         mThreshold;
+    int                         mInterval;
+    QTimer*                     mHeartbeat;
+    QThread*                    mMainThread;
+    QAtomicInteger<qint64>      mBeat;
+    QAtomicPointer<const char>  mPlugin;
+    QAtomicPointer<const char>  mCallback;
+
+    QMutex                      mLock;
+    QHash<QString, LoopStall>   mStalls;
+
+    static LoopWatchdog*        mWatchdog;
+};
+
+class WatchdogScope
+{
+public:
+    WatchdogScope(const char* plugin, const char* callback);
+    ~WatchdogScope();
+
+private:
+    WatchdogScope(WatchdogScope&)=delete;
+    WatchdogScope& operator= (const WatchdogScope&)=delete;
+
+    bool                        mActive;
+    const char*                 mPrevPlugin;
+    const char*                 mPrevCallback;
+};
+
+#endif // LOOPWATCHDOG_H
@@ -0,0 +1,210 @@
+#include "resource-usage.h"
+#include "clib-syslog.h"
+
+#include <time.h>
+#include <stdio.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include <QFile>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QMutexLocker>
+
+ResourceUsage* ResourceUsage::mResourceUsage = nullptr;
+
+static __thread int scopeDepth = 0;
+
+static qint64 clock_usec (clockid_t clock)
+{
+    struct timespec ts;
+
+    if (0 != clock_gettime(clock, &ts)) return -1;
+
+    return (qint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static qint64 process_rss ()
+{
+    long pages = 0;
+    long resident = 0;
+
+    QFile file("/proc/self/statm");
+    if (!file.open(QIODevice::ReadOnly)) return -1;
+    if (2 != sscanf(file.readLine().constData(), "%ld %ld", &pages, &resident)) return -1;
+
+    return (qint64)resident * sysconf(_SC_PAGESIZE);
+}
+
+ResourceUsage::ResourceUsage()
+{
+    mDump = nullptr;
+}
+
+ResourceUsage* ResourceUsage::instance()
+{
+    static QBasicMutex lock;
+    QMutexLocker locker(&lock);
+
+    if (nullptr == mResourceUsage) mResourceUsage = new ResourceUsage;
+
+    return mResourceUsage;
+}
+
+qint64 ResourceUsage::heapInUse()
+{
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+    struct mallinfo2 info = mallinfo2();
+#else
+    struct mallinfo info = mallinfo();
+#endif
+
+    return (qint64)info.uordblks + (qint64)info.hblkhd;
+}
+
+qint64 ResourceUsage::threadCpuTime()
+{
+    return clock_usec(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void ResourceUsage::addCall(const char* plugin, qint64 cpu, qint64 heap)
+{
+    QMutexLocker locker(&mLock);
+    PluginUsage& usage = mUsage[plugin];
+
+    usage.calls++;
+    usage.cpu += cpu;
+    usage.heap += heap;
+}
+
+void ResourceUsage::registerThread(const char* plugin)
+{
+    ThreadUsage t;
+
+    t.plugin = plugin;
+    t.thread = pthread_self();
+    if (0 != pthread_getcpuclockid(t.thread, &t.clock)) return;
+
+    QMutexLocker locker(&mLock);
+    mThreads.append(t);
+}
+
+void ResourceUsage::unregisterThread()
+{
+    pthread_t self = pthread_self();
+    qint64 cpu = threadCpuTime();
+
+    QMutexLocker locker(&mLock);
+    for (int i = 0; i < mThreads.size(); ++i) {
+        if (pthread_equal(mThreads.at(i).thread, self)) {
+            mUsage[mThreads.at(i).plugin].threadCpu += cpu;
+            mThreads.removeAt(i);
+            break;
+        }
+    }
+}
+
+void ResourceUsage::registerCounter(const char* plugin, const char* name, const void* owner, Counter counter)
+{
+    CounterUsage c;
+
+    c.plugin = plugin;
+    c.name = name;
+    c.owner = owner;
+    c.counter = counter;
+
+    QMutexLocker locker(&mLock);
+    mCounters.append(c);
+}
+
+void ResourceUsage::unregisterCounters(const void* owner)
+{
+    QMutexLocker locker(&mLock);
+
+    for (int i = mCounters.size() - 1; i >= 0; --i) {
+        if (mCounters.at(i).owner == owner) mCounters.removeAt(i);
+    }
+}
+
+QString ResourceUsage::toJson()
+{
+    QJsonObject plugins;
+    QHash<QString, PluginUsage> usage;
+    QHash<QString, QJsonObject> counters;
+
+    {
+        QMutexLocker locker(&mLock);
+        usage = mUsage;
+        // running threads, finished threads are already in mUsage
+        for (const ThreadUsage& t : mThreads) {
+            qint64 cpu = clock_usec(t.clock);
+            if (cpu > 0) usage[t.plugin].threadCpu += cpu;
+        }
+        for (const CounterUsage& c : mCounters) {
+            counters[c.plugin].insert(c.name, c.counter());
+        }
+    }
+
+    for (auto it = usage.constBegin(); it != usage.constEnd(); ++it) {
+        QJsonObject p = counters.take(it.key());
+        p.insert("calls", it.value().calls);
+        p.insert("cpu_us", it.value().cpu);
+        p.insert("heap_bytes", it.value().heap);
+        p.insert("thread_cpu_us", it.value().threadCpu);
+        plugins.insert(it.key(), p);
+    }
+    for (auto it = counters.constBegin(); it != counters.constEnd(); ++it) {
+        plugins.insert(it.key(), it.value());
+    }
+
+    QJsonObject json;
+    json.insert("rss_bytes", process_rss());
+    json.insert("heap_bytes", heapInUse());
+    json.insert("cpu_us", clock_usec(CLOCK_PROCESS_CPUTIME_ID));
+    json.insert("plugins", plugins);
+
+    return QString::fromUtf8(QJsonDocument(json).toJson(QJsonDocument::Compact));
+}
+
+void ResourceUsage::startDump(int seconds)
+{
+    if (seconds <= 0 || nullptr != mDump) return;
+
+    mDump = new QTimer;
+    QObject::connect(mDump, &QTimer::timeout, [this] () {
+        // one line per plugin, a log record is limited to LOG_RECORD_SIZE
+        QJsonObject json = QJsonDocument::fromJson(toJson().toUtf8()).object();
+        QJsonObject plugins = json.take("plugins").toObject();
+        CT_SYSLOG(LOG_INFO, "resource usage: %s", QJsonDocument(json).toJson(QJsonDocument::Compact).constData());
+        for (auto it = plugins.constBegin(); it != plugins.constEnd(); ++it) {
+            CT_SYSLOG(LOG_INFO, "resource usage '%s': %s", it.key().toUtf8().data(),
+                      QJsonDocument(it.value().toObject()).toJson(QJsonDocument::Compact).constData());
+        }
+    });
+    mDump->start(seconds * 1000);
+}
+
+bool ResourceScope::heapEnabled()
+{
+    static const bool enabled = qEnvironmentVariableIntValue(RESOURCE_HEAP_ENV) > 0;
+
+    return enabled;
+}
+
+ResourceScope::ResourceScope(const char* plugin)
+{
+    mPlugin = (0 == scopeDepth++) ? plugin : nullptr;
+    if (nullptr == mPlugin) return;
+
+    mCpu = ResourceUsage::threadCpuTime();
+    mHeap = heapEnabled() ? ResourceUsage::heapInUse() : 0;
+}
+
+ResourceScope::~ResourceScope()
+{
+    --scopeDepth;
+    if (nullptr == mPlugin) return;
+
+    qint64 heap = heapEnabled() ? ResourceUsage::heapInUse() - mHeap : 0;
+    ResourceUsage::instance()->addCall(mPlugin, ResourceUsage::threadCpuTime() - mCpu, heap);
+}
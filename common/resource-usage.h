@@ -0,0 +1,101 @@
+#ifndef RESOURCEUSAGE_H
+#define RESOURCEUSAGE_H
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QTimer>
+#include <QString>
+#include <functional>
+#include <pthread.h>
+
+#define RESOURCE_DUMP_INTERVAL_ENV                  "USD_RESOURCE_DUMP_INTERVAL"    // 秒，定期把资源统计写入日志
+#define RESOURCE_HEAP_ENV                           "USD_RESOURCE_HEAP"             // 为 1 时统计回调的堆内存变化，mallinfo 会遍历所有 arena
+
+/* 统计从此处到作用域结束插件回调的 CPU 时间(和 RESOURCE_HEAP_ENV 打开时的堆内存变化)，嵌套时只统计最外层 */
+#define USD_RESOURCE_SCOPE(plugin)                  ResourceScope usdResourceScope(plugin)
+
+struct PluginUsage
+{
+    qint64          calls;
+    qint64          cpu;            // 回调的线程 CPU 时间，微秒
+    qint64          heap;           // 回调前后堆内存占用的变化，字节，RESOURCE_HEAP_ENV 未打开时为 0
+    qint64          threadCpu;      // 插件自己线程的 CPU 时间，微秒
+};
+
+/**
+ * 插件资源统计:
+ * 回调的 CPU 时间和堆内存变化(打开 RESOURCE_HEAP_ENV 时，mallinfo，进程级，其他线程同时分配时有误差)、
+ * 插件线程的 CPU 时间以及插件注册的缓存对象计数。
+ * 守护进程和插件共用一个实例，见 StartupTrace。
+ */
+class ResourceUsage
+{
+public:
+    typedef std::function<qint64 ()> Counter;
+
+    static ResourceUsage* instance ();
+    static qint64 heapInUse ();
+    static qint64 threadCpuTime ();
+
+    void addCall (const char* plugin, qint64 cpu, qint64 heap);
+
+    /* 在插件线程中调用 */
+    void registerThread (const char* plugin);
+    void unregisterThread ();
+
+    /* owner 用于注销，通常是插件的 manager 对象 */
+    void registerCounter (const char* plugin, const char* name, const void* owner, Counter counter);
+    void unregisterCounters (const void* owner);
+
+    QString toJson ();
+    void startDump (int seconds);
+
+private:
+    ResourceUsage();
+    ResourceUsage(ResourceUsage&)=delete;
+    ResourceUsage& operator= (const ResourceUsage&)=delete;
+
+    struct ThreadUsage
+    {
+        QString         plugin;
+        pthread_t       thread;
+        clockid_t       clock;
+    };
+
+    struct CounterUsage
+    {
+        QString         plugin;
+        QString         name;
+        const void*     owner;
+        Counter         counter;
+    };
+
+private:
+    QMutex                          mLock;
+    QTimer*                         mDump;
+    QHash<QString, PluginUsage>     mUsage;
+    QList<ThreadUsage>              mThreads;
+    QList<CounterUsage>             mCounters;
+
+    static ResourceUsage*           mResourceUsage;
+};
+
+class ResourceScope
+{
+public:
+    ResourceScope(const char* plugin);
+    ~ResourceScope();
+
+private:
+    ResourceScope(ResourceScope&)=delete;
+    ResourceScope& operator= (const ResourceScope&)=delete;
+
+    static bool heapEnabled ();
+
+    const char*             mPlugin;
+    qint64                  mCpu;
+    qint64                  mHeap;
+};
+
+#endif // RESOURCEUSAGE_H
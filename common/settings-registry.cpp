@@ -0,0 +1,69 @@
+#include "settings-registry.h"
+
+#include <QMutexLocker>
+
+SettingsRegistry* SettingsRegistry::mRegistry = nullptr;
+
+SettingsRegistry::SettingsRegistry()
+{
+}
+
+SettingsRegistry* SettingsRegistry::instance()
+{
+    static QBasicMutex lock;
+    QMutexLocker locker(&lock);
+
+    if (nullptr == mRegistry) mRegistry = new SettingsRegistry;
+
+    return mRegistry;
+}
+
+GSettings* SettingsRegistry::acquire(const char* schema, const char* path)
+{
+    return instance()->get(schema, path);
+}
+
+GSettings* SettingsRegistry::get(const char* schema, const char* path)
+{
+    GSettings* settings = nullptr;
+    QByteArray key = QByteArray(schema) + '\n' + QByteArray(path) + '\n'
+            + QByteArray::number((quintptr)g_main_context_get_thread_default());
+
+    QMutexLocker locker(&mLock);
+
+    GWeakRef* ref = mSettings.value(key);
+    if (ref) {
+        // NULL once the last user has dropped it
+        settings = (GSettings*)g_weak_ref_get(ref);
+        if (settings) return settings;
+    } else {
+        ref = new GWeakRef;
+        g_weak_ref_init(ref, nullptr);
+        mSettings.insert(key, ref);
+    }
+
+    if (nullptr == path || '\0' == path[0]) {
+        settings = g_settings_new(schema);
+    } else {
+        settings = g_settings_new_with_path(schema, path);
+    }
+    g_weak_ref_set(ref, settings);
+
+    return settings;
+}
+
+int SettingsRegistry::size()
+{
+    int n = 0;
+    QMutexLocker locker(&mLock);
+
+    for (GWeakRef* ref : mSettings) {
+        GObject* obj = (GObject*)g_weak_ref_get(ref);
+        if (obj) {
+            ++n;
+            g_object_unref(obj);
+        }
+    }
+
+    return n;
+}
@@ -0,0 +1,43 @@
+#ifndef SETTINGSREGISTRY_H
+#define SETTINGSREGISTRY_H
+
+#include <QHash>
+#include <QMutex>
+#include <QByteArray>
+
+#include <gio/gio.h>
+
+/**
+ * 进程内共享的 GSettings 对象:
+ * 同一 schema、path 和线程默认 main context (changed 信号在其中发出) 只创建一个 GSettings，
+ * 所有使用者共用一个 dconf 监听，修改只解析和分发一次。
+ * acquire() 返回的对象已增加引用，不再使用时 g_object_unref()，
+ * 不能调用 g_settings_delay()(会影响其他使用者)。
+ * 守护进程和插件共用一个实例，见 StartupTrace。线程安全。
+ */
+class SettingsRegistry
+{
+public:
+    static SettingsRegistry* instance ();
+
+    /* path 为空时使用 schema 的默认路径 */
+    static GSettings* acquire (const char* schema, const char* path = nullptr);
+
+    /* 当前仍在使用的对象数 */
+    int size ();
+
+private:
+    SettingsRegistry();
+    SettingsRegistry(SettingsRegistry&)=delete;
+    SettingsRegistry& operator= (const SettingsRegistry&)=delete;
+
+    GSettings* get (const char* schema, const char* path);
+
+private:
+    QMutex                          mLock;
+    QHash<QByteArray, GWeakRef*>    mSettings;
+
+    static SettingsRegistry*        mRegistry;
+};
+
+#endif // SETTINGSREGISTRY_H
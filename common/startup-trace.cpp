@@ -0,0 +1,103 @@
+#include "startup-trace.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QMutexLocker>
+
+StartupTrace* StartupTrace::mTrace = nullptr;
+
+StartupTrace::StartupTrace()
+{
+}
+
+StartupTrace* StartupTrace::instance()
+{
+    static QBasicMutex lock;
+    QMutexLocker locker(&lock);
+
+    if (nullptr == mTrace) mTrace = new StartupTrace;
+
+    return mTrace;
+}
+
+qint64 StartupTrace::now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (qint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void StartupTrace::addSpan(const char* category, const QString& name, qint64 start, qint64 end)
+{
+    StartupSpan span;
+
+    span.category = category;
+    span.name = name;
+    span.start = start;
+    span.duration = end - start;
+    span.tid = syscall(SYS_gettid);
+
+    QMutexLocker locker(&mLock);
+    if (mSpans.size() >= STARTUP_TRACE_MAX_SPANS) return;
+    mSpans.append(span);
+}
+
+QList<StartupSpan> StartupTrace::getSpans()
+{
+    QMutexLocker locker(&mLock);
+
+    return mSpans;
+}
+
+QString StartupTrace::toChromeTrace()
+{
+    QJsonArray events;
+    qint64 pid = getpid();
+
+    for (const StartupSpan& span : getSpans()) {
+        QJsonObject event;
+        event.insert("name", span.name);
+        event.insert("cat", span.category);
+        event.insert("ph", "X");
+        event.insert("ts", span.start);
+        event.insert("dur", span.duration);
+        event.insert("pid", pid);
+        event.insert("tid", span.tid);
+        events.append(event);
+    }
+
+    QJsonObject trace;
+    trace.insert("traceEvents", events);
+    trace.insert("displayTimeUnit", "ms");
+
+    return QString::fromUtf8(QJsonDocument(trace).toJson(QJsonDocument::Compact));
+}
+
+bool StartupTrace::writeChromeTrace(const QString& fileName)
+{
+    QFile file(fileName);
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+    file.write(toChromeTrace().toUtf8());
+    file.close();
+
+    return true;
+}
+
+TraceSpan::TraceSpan(const char* category, const QString& name)
+    : mCategory(category), mName(name), mStart(StartupTrace::now())
+{
+}
+
+TraceSpan::~TraceSpan()
+{
+    StartupTrace::instance()->addSpan(mCategory, mName, mStart, StartupTrace::now());
+}
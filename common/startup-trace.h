@@ -0,0 +1,68 @@
+#ifndef STARTUPTRACE_H
+#define STARTUPTRACE_H
+
+#include <QList>
+#include <QMutex>
+#include <QString>
+
+/* 最多记录的区间数，超过后丢弃 */
+#define STARTUP_TRACE_MAX_SPANS         4096
+
+/* 记录一个从此处到作用域结束的区间 */
+#define USD_TRACE_SPAN(category, name)  TraceSpan usdTraceSpan(category, name)
+
+struct StartupSpan
+{
+    QString         category;
+    QString         name;
+    qint64          start;          // CLOCK_MONOTONIC, 微秒
+    qint64          duration;       // 微秒
+    qint64          tid;
+};
+
+/**
+ * 启动耗时记录，守护进程和插件共用一个实例:
+ * 守护进程以 -rdynamic 链接，插件中对 instance() 的引用解析到守护进程的符号。
+ * 线程安全。
+ */
+class StartupTrace
+{
+public:
+    static StartupTrace* instance ();
+    static qint64 now ();
+
+    void addSpan (const char* category, const QString& name, qint64 start, qint64 end);
+    QList<StartupSpan> getSpans ();
+
+    /* Chrome trace-event JSON (chrome://tracing, perfetto) */
+    QString toChromeTrace ();
+    bool writeChromeTrace (const QString& fileName);
+
+private:
+    StartupTrace();
+    StartupTrace(StartupTrace&)=delete;
+    StartupTrace& operator= (const StartupTrace&)=delete;
+
+private:
+    QMutex                  mLock;
+    QList<StartupSpan>      mSpans;
+
+    static StartupTrace*    mTrace;
+};
+
+class TraceSpan
+{
+public:
+    TraceSpan(const char* category, const QString& name);
+    ~TraceSpan();
+
+private:
+    TraceSpan(TraceSpan&)=delete;
+    TraceSpan& operator= (const TraceSpan&)=delete;
+
+    const char*             mCategory;
+    QString                 mName;
+    qint64                  mStart;
+};
+
+#endif // STARTUPTRACE_H
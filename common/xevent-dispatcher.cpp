@@ -0,0 +1,135 @@
+#include "xevent-dispatcher.h"
+#include "startup-trace.h"
+#include "loop-watchdog.h"
+#include "resource-usage.h"
+
+#include <X11/Xlib.h>
+
+XEventDispatcher* XEventDispatcher::mDispatcher = nullptr;
+
+XEventDispatcher::XEventDispatcher()
+{
+    mInstalled = false;
+    mDepth = 0;
+}
+
+XEventDispatcher* XEventDispatcher::instance()
+{
+    if (nullptr == mDispatcher) mDispatcher = new XEventDispatcher;
+
+    return mDispatcher;
+}
+
+void XEventDispatcher::addHandler(const char* plugin, const char* name, int type, unsigned long window, GdkFilterFunc func, gpointer data)
+{
+    XEventHandler* h = new XEventHandler;
+
+    h->plugin = plugin;
+    h->name = name;
+    h->type = type;
+    h->window = window;
+    h->func = func;
+    h->data = data;
+
+    // plugins link their own copies of the name, look it up by content once here
+    h->usage = mUsage.value(plugin);
+    if (nullptr == h->usage) {
+        XEventHandlerUsage* usage = new XEventHandlerUsage{0, 0};
+        mUsage.insert(plugin, usage);
+        ResourceUsage::instance()->registerCounter(plugin, "x_event_calls", this, [usage] () -> qint64 {
+            return usage->calls;
+        });
+        ResourceUsage::instance()->registerCounter(plugin, "x_event_us", this, [usage] () -> qint64 {
+            return usage->time;
+        });
+        h->usage = usage;
+    }
+    mHandlers[slot(type, window)].append(h);
+
+    if (!mInstalled) {
+        gdk_window_add_filter(NULL, filter, this);
+        mInstalled = true;
+    }
+}
+
+void XEventDispatcher::removeHandler(GdkFilterFunc func, gpointer data)
+{
+    remove(func, data, true, XEVENT_ANY_WINDOW);
+}
+
+void XEventDispatcher::removeHandler(GdkFilterFunc func, gpointer data, unsigned long window)
+{
+    remove(func, data, false, window);
+}
+
+void XEventDispatcher::remove(GdkFilterFunc func, gpointer data, bool anyWindow, unsigned long window)
+{
+    for (auto it = mHandlers.begin(); it != mHandlers.end();) {
+        QList<XEventHandler*>& list = it.value();
+        for (int i = list.size() - 1; i >= 0; --i) {
+            XEventHandler* h = list.at(i);
+            if (h->func != func || h->data != data || (!anyWindow && h->window != window)) continue;
+            list.removeAt(i);
+            // a running dispatch may still hold it
+            h->func = nullptr;
+            mRemoved.append(h);
+        }
+        if (list.isEmpty())
+            it = mHandlers.erase(it);
+        else
+            ++it;
+    }
+
+    if (0 == mDepth) {
+        qDeleteAll(mRemoved);
+        mRemoved.clear();
+    }
+}
+
+GdkFilterReturn XEventDispatcher::filter(GdkXEvent* xevent, GdkEvent* event, gpointer data)
+{
+    XEventDispatcher* self = (XEventDispatcher*) data;
+    XEvent* xev = (XEvent*) xevent;
+    QList<XEventHandler*> handlers;
+
+    // same order as GDK, filters for all windows before the window filters
+    handlers += self->mHandlers.value(slot(XEVENT_ANY_TYPE, XEVENT_ANY_WINDOW));
+    handlers += self->mHandlers.value(slot(xev->type, XEVENT_ANY_WINDOW));
+    // only core events have a window at this offset
+    if (xev->type < LASTEvent && GenericEvent != xev->type && None != xev->xany.window) {
+        handlers += self->mHandlers.value(slot(XEVENT_ANY_TYPE, xev->xany.window));
+        handlers += self->mHandlers.value(slot(xev->type, xev->xany.window));
+    }
+    if (handlers.isEmpty()) return GDK_FILTER_CONTINUE;
+
+    return self->dispatch(xevent, event, handlers);
+}
+
+GdkFilterReturn XEventDispatcher::dispatch(GdkXEvent* xevent, GdkEvent* event, const QList<XEventHandler*>& handlers)
+{
+    GdkFilterReturn ret = GDK_FILTER_CONTINUE;
+
+    ++mDepth;
+    for (XEventHandler* h : handlers) {
+        // removed by an earlier handler of this event
+        if (nullptr == h->func) continue;
+
+        qint64 start = StartupTrace::now();
+        {
+            USD_RESOURCE_SCOPE(h->plugin);
+            USD_WATCHDOG_SCOPE(h->plugin, h->name);
+            ret = h->func(xevent, event, h->data);
+        }
+        h->usage->calls++;
+        h->usage->time += StartupTrace::now() - start;
+
+        if (GDK_FILTER_CONTINUE != ret) break;
+    }
+
+    if (0 == --mDepth && !mRemoved.isEmpty()) {
+        qDeleteAll(mRemoved);
+        mRemoved.clear();
+    }
+
+    return ret;
+}
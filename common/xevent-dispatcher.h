@@ -0,0 +1,76 @@
+#ifndef XEVENTDISPATCHER_H
+#define XEVENTDISPATCHER_H
+
+#include <QHash>
+#include <QList>
+#include <QByteArray>
+
+#include <gdk/gdk.h>
+
+/* 任意事件类型、任意窗口 */
+#define XEVENT_ANY_TYPE                 0
+#define XEVENT_ANY_WINDOW               0UL
+
+struct XEventHandlerUsage
+{
+    qint64              calls;
+    qint64              time;           // 微秒
+};
+
+struct XEventHandler
+{
+    const char*         plugin;
+    const char*         name;
+    int                 type;
+    unsigned long       window;
+    GdkFilterFunc       func;
+    gpointer            data;
+    XEventHandlerUsage* usage;          // 插件的统计，分发时不再查找
+};
+
+/**
+ * GDK X 事件分发:
+ * 只安装一个 GDK 过滤器，插件按 (事件类型, 窗口) 注册处理函数，每个事件最多查找四次哈希表，
+ * 没有插件关心的事件不调用任何处理函数。
+ * type 是核心事件类型或扩展事件号(如 xkbEventBase + XkbEventCode、DevicePresence 得到的类型)，
+ * XEVENT_ANY_TYPE 接收所有事件。
+ * window 只对核心事件有效，扩展事件必须使用 XEVENT_ANY_WINDOW。
+ * 调用顺序同 GDK: 任意窗口的处理函数在前，处理函数返回非 GDK_FILTER_CONTINUE 时停止。
+ * 每次调用计入插件的资源统计和主循环卡顿监测，插件的调用次数和耗时见 GetResourceUsage。
+ * 守护进程和插件共用一个实例，见 StartupTrace。只能在主线程中使用。
+ */
+class XEventDispatcher
+{
+public:
+    static XEventDispatcher* instance ();
+
+    /* plugin、name 必须是字符串常量 */
+    void addHandler (const char* plugin, const char* name, int type, unsigned long window, GdkFilterFunc func, gpointer data);
+
+    /* 删除 func、data 的全部注册，可以在处理函数中调用 */
+    void removeHandler (GdkFilterFunc func, gpointer data);
+    /* 只删除 window 上的注册 */
+    void removeHandler (GdkFilterFunc func, gpointer data, unsigned long window);
+
+private:
+    XEventDispatcher();
+    XEventDispatcher(XEventDispatcher&)=delete;
+    XEventDispatcher& operator= (const XEventDispatcher&)=delete;
+
+    static quint64 slot (int type, unsigned long window) { return ((quint64)(quint32)type << 32) | (quint32)window; }
+    static GdkFilterReturn filter (GdkXEvent* xevent, GdkEvent* event, gpointer data);
+
+    void remove (GdkFilterFunc func, gpointer data, bool anyWindow, unsigned long window);
+    GdkFilterReturn dispatch (GdkXEvent* xevent, GdkEvent* event, const QList<XEventHandler*>& handlers);
+
+private:
+    bool                                        mInstalled;
+    int                                         mDepth;         // 正在分发的层数，大于 0 时推迟释放
+    QHash<quint64, QList<XEventHandler*>>       mHandlers;
+    QList<XEventHandler*>                       mRemoved;
+    QHash<QByteArray, XEventHandlerUsage*>      mUsage;         // 只在注册时查找，不释放
+
+    static XEventDispatcher*                    mDispatcher;
+};
+
+#endif // XEVENTDISPATCHER_H
@@ -20,14 +20,20 @@
  */
 
 #include "xeventmonitor.h"
+#include "clib-syslog.h"
+#include "resource-usage.h"
 #include <iostream>
-#include <QVector>
-#include <QSet>
 #include <X11/Xlibint.h>
 #include <X11/XKBlib.h>
 #include <X11/Xlib.h>
 #include <X11/extensions/record.h>
+#include <X11/extensions/XInput2.h>
 #include <X11/keysym.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
 
 // Virtual button codes that are not defined by X11.
 #define Button1            1
@@ -40,9 +46,21 @@
 #define XButton1           8
 #define XButton2           9
 
-XEventMonitor *XEventMonitor::instance_ = new XEventMonitor();
+#define KEYMAP_SIZE        256
+#define EVENT_QUEUE_SIZE   1024                 // 必须是 2 的幂
 
-QVector<KeySym> ModifiersVec{
+// not created at static initialization, every plugin links its own copy of common/
+XEventMonitor *XEventMonitor::instance_ = nullptr;
+
+XEventMonitor *XEventMonitor::instance()
+{
+    if (nullptr == instance_) instance_ = new XEventMonitor();
+
+    return instance_;
+}
+
+// bit i of the modifier mask is ModifiersVec[i]
+static const KeySym ModifiersVec[] = {
     XK_Control_L,
     XK_Control_R,
     XK_Shift_L,
@@ -52,6 +70,16 @@ QVector<KeySym> ModifiersVec{
     XK_Alt_L,
     XK_Alt_R
 };
+static const int ModifiersNum = sizeof(ModifiersVec) / sizeof(ModifiersVec[0]);
+
+struct MonitorEvent
+{
+    int         type;           // KeyPress ... MotionNotify
+    int         keyCode;
+    int         x;
+    int         y;
+    KeyCombo    combo;
+};
 
 class XEventMonitorPrivate
 {
@@ -62,109 +90,699 @@ public:
 
 protected:
     XEventMonitor *q_ptr;
-    QSet<KeySym> modifiers;
+    unsigned int modifiers;
+
+    enum {
+        RecordKeys      = 1 << 0,
+        RecordButtons   = 1 << 1,
+        RecordMotion    = 1 << 2
+    };
+
+    Display *display;               // XRecord 控制连接，XInput2 事件连接
+    Display *dataDisplay;           // XRecord 数据连接
+    XRecordContext context;
+    int recording;                  // 当前 context 录制的事件，只由记录线程访问
+    bool recordEnded;
+    QAtomicInt wanted;              // 有接收者的事件
+    int wakeFd[2];
+
+    /* XInput2 */
+    bool useRaw;
+    int xiOpcode;
+    bool rawMotion;                 // 本批事件中有未发出的移动事件
+    bool buttonMapDirty;
+    int buttonMapSize;
+    unsigned char buttonMap[256];
+
+    /*
+     * raw 事件没有服务器的自动重复，按 XKB 的重复设置补出和 XRecord 看到的一样的
+     * KeyRelease/KeyPress 对，只有最后按下的键重复
+     */
+    int repeatKey;                  // 等待重复的键，0 表示没有
+    qint64 repeatDeadline;          // 下次重复的时间(毫秒，CLOCK_MONOTONIC)
+    bool repeatEnabled;
+    unsigned int repeatDelay;
+    unsigned int repeatInterval;
+    unsigned char repeatKeys[XkbPerKeyBitArraySize];
+
+    /*
+     * 记录线程自己的连接，只用于取键盘映射，
+     * 映射变化时(MappingNotify/XkbMapNotify)标记为过期，下一个按键时重新获取
+     */
+    Display *keymapDisplay;
+    int xkbEventBase;
+    bool keymapDirty;
+    KeySym keymap[XkbNumKbdGroups][KEYMAP_SIZE];
+    unsigned int modifierBits[KEYMAP_SIZE];
+
+    /*
+     * 记录线程写、主线程读的无锁单生产者单消费者队列，
+     * 队列从空变为非空时唤醒主线程一次，主线程一次取完。
+     * 鼠标移动只保留最新位置，队列中最多有一个未处理的移动事件
+     */
+    MonitorEvent queue[EVENT_QUEUE_SIZE];
+    QAtomicInteger<quint32> head;       // 只由记录线程写
+    QAtomicInteger<quint32> tail;       // 只由主线程写
+    QAtomicInt wakeScheduled;
+    QAtomicInt motionQueued;
+    QAtomicInteger<quint32> lastMotion; // x 在高 16 位，y 在低 16 位
+    QAtomicInt dropped;
 
     bool filterWheelEvent(int detail);
     static void callback(XPointer trash, XRecordInterceptData* data);
     void handleRecordEvent(XRecordInterceptData *);
-    void emitButtonSignal(const char *member, xEvent *event);
-    void emitKeySignal(const char *member, xEvent *event);
-    void updateModifier(xEvent *event, bool isAdd);
+    bool pushEvent(const MonitorEvent &ev);
+    void pushButtonEvent(int type, int x, int y);
+    void pushKeyEvent(int type, int keyCode);
+    void pushMotionEvent(int x, int y);
+    void drainEvents();
+    void updateModifier(int keyCode, bool isAdd);
+    void updateKeymap();
+    void setRecordMask(int mask);
+    bool probeRawEvents();
+    void setRawMask(int mask);
+    void handleRawEvents();
+    void flushRawMotion();
+    void updateRawRepeat(int keyCode, bool isPress);
+    void repeatRawKey();
+    int repeatTimeout();
+    int mapButton(int button);
+    bool queryPointer(int *x, int *y);
+    void closeDisplays();
+    void updateWanted();
+    void wake();
+    KeySym keycodeToKeysym(int keyCode, int group);
 
 private:
     Q_DECLARE_PUBLIC(XEventMonitor)
 };
 
 XEventMonitorPrivate::XEventMonitorPrivate(XEventMonitor *parent)
-    : q_ptr(parent)
+    : q_ptr(parent),
+      modifiers(0),
+      display(nullptr),
+      dataDisplay(nullptr),
+      context(0),
+      recording(0),
+      recordEnded(true),
+      wanted(0),
+      useRaw(false),
+      xiOpcode(-1),
+      rawMotion(false),
+      buttonMapDirty(true),
+      buttonMapSize(0),
+      repeatKey(0),
+      repeatDeadline(0),
+      repeatEnabled(false),
+      repeatDelay(0),
+      repeatInterval(0),
+      keymapDisplay(nullptr),
+      xkbEventBase(-1),
+      keymapDirty(true),
+      head(0),
+      tail(0),
+      wakeScheduled(0),
+      motionQueued(0),
+      lastMotion(0),
+      dropped(0)
 {
-
+    memset(keymap, 0, sizeof(keymap));
+    memset(modifierBits, 0, sizeof(modifierBits));
+    memset(repeatKeys, 0, sizeof(repeatKeys));
+    if (pipe2(wakeFd, O_CLOEXEC | O_NONBLOCK) < 0) {
+        wakeFd[0] = wakeFd[1] = -1;
+    }
 }
 
 XEventMonitorPrivate::~XEventMonitorPrivate()
 {
+    closeDisplays();
+    if (wakeFd[0] >= 0) close(wakeFd[0]);
+    if (wakeFd[1] >= 0) close(wakeFd[1]);
+}
+
+void XEventMonitorPrivate::updateKeymap()
+{
+    XkbDescPtr xkb = nullptr;
 
+    keymapDirty = false;
+    repeatEnabled = false;
+    memset(keymap, 0, sizeof(keymap));
+    memset(modifierBits, 0, sizeof(modifierBits));
+    if (!keymapDisplay) return;
+
+    while (XPending(keymapDisplay)) {
+        XEvent ev;
+        XNextEvent(keymapDisplay, &ev);
+    }
+
+    xkb = XkbGetMap(keymapDisplay, XkbKeySymsMask, XkbUseCoreKbd);
+    if (!xkb) return;
+
+    for (int keyCode = xkb->min_key_code; keyCode <= xkb->max_key_code && keyCode < KEYMAP_SIZE; ++keyCode) {
+        int groups = XkbKeyNumGroups(xkb, keyCode);
+        for (int group = 0; group < XkbNumKbdGroups; ++group) {
+            // groups the key does not have wrap around, as XkbKeycodeToKeysym does
+            int g = groups > 0 ? group % groups : 0;
+            if (groups > 0 && XkbKeyGroupWidth(xkb, keyCode, g) > 0) {
+                keymap[group][keyCode] = XkbKeySymEntry(xkb, keyCode, 0, g);
+            }
+        }
+        for (int i = 0; i < ModifiersNum; ++i) {
+            if (keymap[0][keyCode] == ModifiersVec[i]) modifierBits[keyCode] = 1u << i;
+        }
+    }
+
+    if (Success == XkbGetControls(keymapDisplay, XkbRepeatKeysMask | XkbPerKeyRepeatMask, xkb) && xkb->ctrls) {
+        repeatEnabled = (xkb->ctrls->enabled_ctrls & XkbRepeatKeysMask) && xkb->ctrls->repeat_interval > 0;
+        repeatDelay = xkb->ctrls->repeat_delay;
+        repeatInterval = xkb->ctrls->repeat_interval;
+        memcpy(repeatKeys, xkb->ctrls->per_key_repeat, sizeof(repeatKeys));
+    }
+
+    XkbFreeKeyboard(xkb, 0, True);
+
+    // a notify read while waiting for the map is not seen by poll()
+    if (XEventsQueued(keymapDisplay, QueuedAlready) > 0) keymapDirty = true;
 }
 
-void XEventMonitorPrivate::emitButtonSignal(const char *member, xEvent *event)
+KeySym XEventMonitorPrivate::keycodeToKeysym(int keyCode, int group)
 {
-    int x = event->u.keyButtonPointer.rootX;
-    int y = event->u.keyButtonPointer.rootY;
-    QMetaObject::invokeMethod(q_ptr, member,
-                              Qt::DirectConnection,
-                              Q_ARG(int, x),
-                              Q_ARG(int, y));
+    if (keymapDirty) updateKeymap();
+    if (keyCode < 0 || keyCode >= KEYMAP_SIZE || group < 0 || group >= XkbNumKbdGroups) return NoSymbol;
+
+    return keymap[group][keyCode];
 }
-#include <syslog.h>
-void XEventMonitorPrivate::emitKeySignal(const char *member, xEvent *event)
+
+/* 记录线程，队列满时丢弃并返回 false */
+bool XEventMonitorPrivate::pushEvent(const MonitorEvent &ev)
 {
-    Display *display = XOpenDisplay(NULL);
+    quint32 h = head.load();
 
-    int keyCode = event->u.u.detail;
-    KeySym keySym = XkbKeycodeToKeysym(display, event->u.u.detail, 0, 0);
+    if (h - tail.loadAcquire() >= EVENT_QUEUE_SIZE) {
+        dropped.ref();
+        return false;
+    }
 
-    QString keyStrSplice;
-    for(auto modifier : modifiers)
-    {
-        keyStrSplice += QString(XKeysymToString(modifier)) + "+";
+    queue[h & (EVENT_QUEUE_SIZE - 1)] = ev;
+    head.storeRelease(h + 1);
+
+    if (wakeScheduled.testAndSetOrdered(0, 1)) {
+        QMetaObject::invokeMethod(q_ptr, "drainEvents", Qt::QueuedConnection);
     }
-    //按键是修饰键
-    if(ModifiersVec.contains(keySym) && !modifiers.isEmpty())
-        keyStrSplice.remove(keyStrSplice.length() - 1, 1);
-    else
-        keyStrSplice += XKeysymToString(keySym);
 
-    QMetaObject::invokeMethod(q_ptr, member,
-                              Qt::AutoConnection,
-                              Q_ARG(int, keyCode));
-    QMetaObject::invokeMethod(q_ptr, member,
-                              Qt::AutoConnection,
-                              Q_ARG(QString, keyStrSplice));
+    return true;
+}
+
+void XEventMonitorPrivate::pushButtonEvent(int type, int x, int y)
+{
+    MonitorEvent ev;
+
+    ev.type = type;
+    ev.keyCode = 0;
+    ev.x = x;
+    ev.y = y;
+    ev.combo = 0;
+    pushEvent(ev);
+}
+
+void XEventMonitorPrivate::pushMotionEvent(int x, int y)
+{
+    quint32 pos = ((quint32)(quint16)x << 16) | (quint16)y;
+
+    lastMotion.storeRelease(pos);
+    // the queued motion event is delivered with the latest position
+    if (!motionQueued.testAndSetOrdered(0, 1)) return;
+
+    MonitorEvent ev;
+    ev.type = MotionNotify;
+    ev.keyCode = 0;
+    ev.x = 0;
+    ev.y = 0;
+    ev.combo = 0;
+    // nothing is queued, the next motion must try again
+    if (!pushEvent(ev)) motionQueued.storeRelease(0);
+}
+
+void XEventMonitorPrivate::pushKeyEvent(int type, int keyCode)
+{
+    MonitorEvent ev;
+
+    ev.type = type;
+    ev.keyCode = keyCode;
+    ev.x = 0;
+    ev.y = 0;
+    // names use the first group so shortcuts match in every layout
+    ev.combo = XEventMonitor::keyCombo(modifiers, keycodeToKeysym(ev.keyCode, 0));
+    pushEvent(ev);
+}
+
+/* 主线程 */
+void XEventMonitorPrivate::drainEvents()
+{
+    Q_Q(XEventMonitor);
+    static const QMetaMethod keyPressString = QMetaMethod::fromSignal(
+                static_cast<void (XEventMonitor::*)(const QString &)>(&XEventMonitor::keyPress));
+    static const QMetaMethod keyReleaseString = QMetaMethod::fromSignal(
+                static_cast<void (XEventMonitor::*)(const QString &)>(&XEventMonitor::keyRelease));
+
+    // events pushed from now on schedule another wakeup
+    wakeScheduled.storeRelease(0);
+
+    quint32 t = tail.load();
+    quint32 h = head.loadAcquire();
+    for (; t != h; ++t) {
+        MonitorEvent ev = queue[t & (EVENT_QUEUE_SIZE - 1)];
+        tail.storeRelease(t + 1);
+
+        switch (ev.type) {
+        case ButtonPress:
+            Q_EMIT q->buttonPress(ev.x, ev.y);
+            break;
+        case ButtonRelease:
+            Q_EMIT q->buttonRelease(ev.x, ev.y);
+            break;
+        case MotionNotify: {
+            motionQueued.storeRelease(0);
+            quint32 pos = lastMotion.loadAcquire();
+            Q_EMIT q->buttonDrag((qint16)(pos >> 16), (qint16)(pos & 0xffff));
+            break;
+        }
+        case KeyPress:
+            Q_EMIT q->keyPress(ev.keyCode);
+            Q_EMIT q->keyComboPress(ev.combo);
+            // the string form is only built for its listeners
+            if (q->isSignalConnected(keyPressString))
+                Q_EMIT q->keyPress(XEventMonitor::keyComboToString(ev.combo));
+            break;
+        case KeyRelease:
+            Q_EMIT q->keyRelease(ev.keyCode);
+            Q_EMIT q->keyComboRelease(ev.combo);
+            if (q->isSignalConnected(keyReleaseString))
+                Q_EMIT q->keyRelease(XEventMonitor::keyComboToString(ev.combo));
+            break;
+        default:
+            break;
+        }
+    }
 
-    XCloseDisplay(display);
+    int n = dropped.fetchAndStoreOrdered(0);
+    if (n > 0) CT_SYSLOG(LOG_WARNING, "xeventmonitor dropped %d events", n);
 }
 
+/*
+ * 优先使用 XInput2 raw 事件(XI 2.1 起发给所有选择了它的客户端)，否则使用 XRecord。
+ * 只选择有接收者的信号需要的事件，接收者变化时(connectNotify/disconnectNotify)
+ * 通过 wakeFd 唤醒记录线程重新选择，stop() 同样通过 wakeFd 结束线程
+ */
 void XEventMonitorPrivate::run()
 {
-    Display* display = XOpenDisplay(0);
-    if (display == 0) {
+    display = XOpenDisplay(0);
+    keymapDisplay = XOpenDisplay(0);
+    if (display == 0 || keymapDisplay == 0) {
         fprintf(stderr, "unable to open display\n");
+        closeDisplays();
         return;
     }
 
+    int opcode, errorBase, major = XkbMajorVersion, minor = XkbMinorVersion;
+    if (XkbQueryExtension(keymapDisplay, &opcode, &xkbEventBase, &errorBase, &major, &minor)) {
+        XkbSelectEvents(keymapDisplay, XkbUseCoreKbd,
+                        XkbNewKeyboardNotifyMask | XkbMapNotifyMask | XkbControlsNotifyMask,
+                        XkbNewKeyboardNotifyMask | XkbMapNotifyMask | XkbControlsNotifyMask);
+    } else {
+        xkbEventBase = -1;
+    }
+    updateKeymap();
+
+    useRaw = qgetenv(XEVENTMONITOR_BACKEND_ENV) != "xrecord" && probeRawEvents();
+    if (!useRaw) {
+        dataDisplay = XOpenDisplay(0);
+        if (dataDisplay == 0) {
+            fprintf(stderr, "unable to open second display\n");
+            closeDisplays();
+            return;
+        }
+    }
+    CT_SYSLOG(LOG_DEBUG, "xeventmonitor uses %s", useRaw ? "XInput2 raw events" : "XRecord");
+
+    // receivers connected before the thread was started
+    updateWanted();
+
+    while (!q_ptr->isInterruptionRequested()) {
+        int mask = wanted.load();
+        if (mask != recording) {
+            if (useRaw)
+                setRawMask(mask);
+            else
+                setRecordMask(mask);
+        }
+
+        struct pollfd fds[3];
+        fds[0].fd = wakeFd[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = ConnectionNumber(keymapDisplay);
+        fds[1].events = POLLIN;
+        fds[2].fd = ConnectionNumber(useRaw ? display : dataDisplay);
+        fds[2].events = POLLIN;
+        fds[2].revents = 0;
+        if (poll(fds, (useRaw || 0 != context) ? 3 : 2, repeatTimeout()) < 0 && errno != EINTR) {
+            fprintf(stderr, "poll error: %s\n", strerror(errno));
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            char buf[64];
+            while (read(wakeFd[0], buf, sizeof(buf)) > 0);
+        }
+        // only MappingNotify and the selected XKB notifies arrive here
+        if (fds[1].revents & POLLIN) {
+            while (XPending(keymapDisplay)) {
+                XEvent ev;
+                XNextEvent(keymapDisplay, &ev);
+            }
+            keymapDirty = true;
+        }
+        if (useRaw) {
+            handleRawEvents();
+            repeatRawKey();
+        } else if (0 != context) {
+            XRecordProcessReplies(dataDisplay);
+        }
+    }
+
+    if (useRaw)
+        setRawMask(0);
+    else
+        setRecordMask(0);
+    closeDisplays();
+}
+
+bool XEventMonitorPrivate::probeRawEvents()
+{
+    int event, error;
+    int major = 2, minor = 1;
+
+    if (!XQueryExtension(display, "XInputExtension", &xiOpcode, &event, &error)) return false;
+    if (XIQueryVersion(display, &major, &minor) != Success) return false;
+
+    // before 2.1 raw events only go to the grabbing client
+    return major > 2 || (major == 2 && minor >= 1);
+}
+
+void XEventMonitorPrivate::setRawMask(int mask)
+{
+    XIEventMask evmask;
+    unsigned char bits[XIMaskLen(XI_LASTEVENT)];
+
+    memset(bits, 0, sizeof(bits));
+    if (mask & RecordKeys) {
+        XISetMask(bits, XI_RawKeyPress);
+        XISetMask(bits, XI_RawKeyRelease);
+    }
+    if (mask & RecordButtons) {
+        XISetMask(bits, XI_RawButtonPress);
+        XISetMask(bits, XI_RawButtonRelease);
+    }
+    if (mask & RecordMotion) {
+        XISetMask(bits, XI_RawMotion);
+    }
+
+    // one event per physical event, from the master device
+    evmask.deviceid = XIAllMasterDevices;
+    evmask.mask_len = sizeof(bits);
+    evmask.mask = bits;
+    XISelectEvents(display, DefaultRootWindow(display), &evmask, 1);
+    XSync(display, False);
+
+    if (!(mask & RecordKeys)) {
+        modifiers = 0;
+        repeatKey = 0;
+    }
+    rawMotion = false;
+    recording = mask;
+    CT_SYSLOG(LOG_DEBUG, "xeventmonitor selects%s%s%s", (mask & RecordKeys) ? " keys" : "",
+              (mask & RecordButtons) ? " buttons" : "", (mask & RecordMotion) ? " motion" : "");
+}
+
+/*
+ * raw 事件没有指针坐标，按钮事件和一批事件中的移动事件各查询一次指针位置，
+ * 按钮号是物理按钮，按 XGetPointerMapping 转换为逻辑按钮，与 XRecord 一致
+ */
+void XEventMonitorPrivate::handleRawEvents()
+{
+    for (;;) {
+        while (XPending(display) > 0) {
+            XEvent ev;
+            XNextEvent(display, &ev);
+
+            if (ev.type == MappingNotify) {
+                if (ev.xmapping.request == MappingPointer) buttonMapDirty = true;
+                continue;
+            }
+
+            XGenericEventCookie *cookie = &ev.xcookie;
+            if (cookie->type != GenericEvent || cookie->extension != xiOpcode || !XGetEventData(display, cookie)) {
+                continue;
+            }
+
+            XIRawEvent *raw = (XIRawEvent *)cookie->data;
+            switch (cookie->evtype) {
+            case XI_RawKeyPress:
+            case XI_RawKeyRelease:
+                flushRawMotion();
+                updateRawRepeat(raw->detail, cookie->evtype == XI_RawKeyPress);
+                updateModifier(raw->detail, cookie->evtype == XI_RawKeyPress);
+                pushKeyEvent(cookie->evtype == XI_RawKeyPress ? KeyPress : KeyRelease, raw->detail);
+                break;
+            case XI_RawButtonPress:
+            case XI_RawButtonRelease: {
+                int button = mapButton(raw->detail);
+                int x, y;
+                if (filterWheelEvent(button) && queryPointer(&x, &y)) {
+                    if (rawMotion) {
+                        rawMotion = false;
+                        pushMotionEvent(x, y);
+                    }
+                    pushButtonEvent(cookie->evtype == XI_RawButtonPress ? ButtonPress : ButtonRelease, x, y);
+                }
+                break;
+            }
+            case XI_RawMotion:
+                rawMotion = true;
+                break;
+            default:
+                break;
+            }
+            XFreeEventData(display, cookie);
+        }
+
+        // events read while waiting for the pointer reply are queued
+        if (!rawMotion) break;
+        flushRawMotion();
+    }
+}
+
+void XEventMonitorPrivate::flushRawMotion()
+{
+    int x, y;
+
+    if (!rawMotion) return;
+    rawMotion = false;
+    if (queryPointer(&x, &y)) pushMotionEvent(x, y);
+}
+
+static qint64 monotonic_msec()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (qint64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* 新按下的键取代正在重复的键，不重复的键(通常是修饰键)停止重复 */
+void XEventMonitorPrivate::updateRawRepeat(int keyCode, bool isPress)
+{
+    if (!isPress) {
+        if (keyCode == repeatKey) repeatKey = 0;
+        return;
+    }
+
+    if (keymapDirty) updateKeymap();
+    repeatKey = 0;
+    if (!repeatEnabled || keyCode <= 0 || keyCode >= KEYMAP_SIZE) return;
+    if (!(repeatKeys[keyCode / 8] & (1 << (keyCode % 8)))) return;
+
+    repeatKey = keyCode;
+    repeatDeadline = monotonic_msec() + repeatDelay;
+}
+
+void XEventMonitorPrivate::repeatRawKey()
+{
+    qint64 now;
+
+    if (0 == repeatKey) return;
+    now = monotonic_msec();
+    if (now < repeatDeadline) return;
+
+    // the server's autorepeat without detectable autorepeat, as XRecord sees it
+    pushKeyEvent(KeyRelease, repeatKey);
+    pushKeyEvent(KeyPress, repeatKey);
+    repeatDeadline = now + repeatInterval;
+}
+
+/* poll() 的超时，没有等待重复的键时一直等待 */
+int XEventMonitorPrivate::repeatTimeout()
+{
+    if (!useRaw || 0 == repeatKey) return -1;
+
+    return (int)qMax<qint64>(0, repeatDeadline - monotonic_msec());
+}
+
+bool XEventMonitorPrivate::queryPointer(int *x, int *y)
+{
+    Window root, child;
+    int winX, winY;
+    unsigned int mask;
+
+    return XQueryPointer(display, DefaultRootWindow(display), &root, &child, x, y, &winX, &winY, &mask);
+}
+
+int XEventMonitorPrivate::mapButton(int button)
+{
+    if (buttonMapDirty) {
+        buttonMapSize = XGetPointerMapping(display, buttonMap, sizeof(buttonMap));
+        buttonMapDirty = false;
+    }
+    if (button >= 1 && button <= buttonMapSize) return buttonMap[button - 1];
+
+    return button;
+}
+
+void XEventMonitorPrivate::setRecordMask(int mask)
+{
+    XRecordRange* ranges[3] = {nullptr};
+    int nranges = 0;
     // Receive from ALL clients, including future clients.
     XRecordClientSpec clients = XRecordAllClients;
-    XRecordRange* range = XRecordAllocRange();
-    if (range == 0) {
+
+    if (0 != context) {
+        XRecordDisableContext(display, context);
+        XSync(display, False);
+        // the async enable ends with XRecordEndOfData
+        for (int i = 0; i < 10 && !recordEnded; ++i) {
+            struct pollfd fd = {ConnectionNumber(dataDisplay), POLLIN, 0};
+            XRecordProcessReplies(dataDisplay);
+            if (!recordEnded) poll(&fd, 1, 100);
+        }
+        XRecordFreeContext(display, context);
+        XSync(display, False);
+        context = 0;
+    }
+
+    // modifier state is unknown while keys are not recorded
+    if (!(mask & RecordKeys)) modifiers = 0;
+    recording = mask;
+    if (0 == mask) return;
+
+    if (mask & RecordKeys) {
+        // KeyPress and KeyRelease
+        ranges[nranges] = XRecordAllocRange();
+        if (ranges[nranges]) {
+            memset(ranges[nranges], 0, sizeof(XRecordRange));
+            ranges[nranges]->device_events.first = KeyPress;
+            ranges[nranges]->device_events.last  = KeyRelease;
+            ++nranges;
+        }
+    }
+    if (mask & RecordButtons) {
+        ranges[nranges] = XRecordAllocRange();
+        if (ranges[nranges]) {
+            memset(ranges[nranges], 0, sizeof(XRecordRange));
+            ranges[nranges]->device_events.first = ButtonPress;
+            ranges[nranges]->device_events.last  = ButtonRelease;
+            ++nranges;
+        }
+    }
+    if (mask & RecordMotion) {
+        ranges[nranges] = XRecordAllocRange();
+        if (ranges[nranges]) {
+            memset(ranges[nranges], 0, sizeof(XRecordRange));
+            ranges[nranges]->device_events.first = MotionNotify;
+            ranges[nranges]->device_events.last  = MotionNotify;
+            ++nranges;
+        }
+    }
+    if (0 == nranges) {
         fprintf(stderr, "unable to allocate XRecordRange\n");
         return;
     }
 
-    // Receive KeyPress, KeyRelease, ButtonPress, ButtonRelease and MotionNotify events.
-    memset(range, 0, sizeof(XRecordRange));
-    range->device_events.first = KeyPress;
-    range->device_events.last  = MotionNotify;
-
     // And create the XRECORD context.
-    XRecordContext context = XRecordCreateContext(display, 0, &clients, 1, &range, 1);
+    context = XRecordCreateContext(display, 0, &clients, 1, ranges, nranges);
+    for (int i = 0; i < nranges; ++i) XFree(ranges[i]);
     if (context == 0) {
         fprintf(stderr, "XRecordCreateContext failed\n");
         return;
     }
-    XFree(range);
+    XSync(display, False);
 
-    XSync(display, True);
-
-    Display* display_datalink = XOpenDisplay(0);
-    if (display_datalink == 0) {
-        fprintf(stderr, "unable to open second display\n");
-        return;
-    }
-    if (!XRecordEnableContext(display_datalink, context,  callback, (XPointer) this)) {
+    recordEnded = false;
+    if (!XRecordEnableContextAsync(dataDisplay, context, callback, (XPointer) this)) {
         fprintf(stderr, "XRecordEnableContext() failed\n");
+        XRecordFreeContext(display, context);
+        context = 0;
         return;
     }
+    CT_SYSLOG(LOG_DEBUG, "xeventmonitor records%s%s%s", (mask & RecordKeys) ? " keys" : "",
+              (mask & RecordButtons) ? " buttons" : "", (mask & RecordMotion) ? " motion" : "");
+}
 
+void XEventMonitorPrivate::closeDisplays()
+{
+    if (keymapDisplay) {XCloseDisplay(keymapDisplay); keymapDisplay = nullptr;}
+    if (dataDisplay) {XCloseDisplay(dataDisplay); dataDisplay = nullptr;}
+    if (display) {XCloseDisplay(display); display = nullptr;}
+    keymapDirty = true;
+    buttonMapDirty = true;
+    recording = 0;
+}
+
+/* 任意线程 */
+void XEventMonitorPrivate::updateWanted()
+{
+    Q_Q(XEventMonitor);
+    static const QMetaMethod keySignals[] = {
+        QMetaMethod::fromSignal(static_cast<void (XEventMonitor::*)(int)>(&XEventMonitor::keyPress)),
+        QMetaMethod::fromSignal(static_cast<void (XEventMonitor::*)(int)>(&XEventMonitor::keyRelease)),
+        QMetaMethod::fromSignal(static_cast<void (XEventMonitor::*)(const QString &)>(&XEventMonitor::keyPress)),
+        QMetaMethod::fromSignal(static_cast<void (XEventMonitor::*)(const QString &)>(&XEventMonitor::keyRelease)),
+        QMetaMethod::fromSignal(&XEventMonitor::keyComboPress),
+        QMetaMethod::fromSignal(&XEventMonitor::keyComboRelease),
+    };
+    static const QMetaMethod buttonSignals[] = {
+        QMetaMethod::fromSignal(&XEventMonitor::buttonPress),
+        QMetaMethod::fromSignal(&XEventMonitor::buttonRelease),
+    };
+    static const QMetaMethod motionSignal = QMetaMethod::fromSignal(&XEventMonitor::buttonDrag);
+    int mask = 0;
+
+    for (const QMetaMethod &m : keySignals) {
+        if (q->isSignalConnected(m)) mask |= RecordKeys;
+    }
+    for (const QMetaMethod &m : buttonSignals) {
+        if (q->isSignalConnected(m)) mask |= RecordButtons;
+    }
+    if (q->isSignalConnected(motionSignal)) mask |= RecordMotion;
+
+    if (wanted.fetchAndStoreOrdered(mask) != mask) wake();
+}
+
+void XEventMonitorPrivate::wake()
+{
+    if (wakeFd[1] >= 0 && write(wakeFd[1], "w", 1) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "wake xeventmonitor error: %s\n", strerror(errno));
+    }
 }
 
 void XEventMonitorPrivate::callback(XPointer ptr, XRecordInterceptData* data)
@@ -175,36 +793,33 @@ void XEventMonitorPrivate::callback(XPointer ptr, XRecordInterceptData* data)
 void XEventMonitorPrivate::handleRecordEvent(XRecordInterceptData* data)
 {
 
-    if (data->category == XRecordFromServer) {
+    if (data->category == XRecordEndOfData) {
+        recordEnded = true;
+    } else if (data->category == XRecordFromServer) {
         xEvent * event = (xEvent *)data->data;
         switch (event->u.u.type)
         {
         case ButtonPress:
+        case ButtonRelease:
             if (filterWheelEvent(event->u.u.detail)) {
-                emitButtonSignal("buttonPress", event);
+                pushButtonEvent(event->u.u.type, event->u.keyButtonPointer.rootX, event->u.keyButtonPointer.rootY);
             }
             break;
         case MotionNotify:
-            emitButtonSignal("buttonDrag", event);
-            break;
-        case ButtonRelease:
-            if (filterWheelEvent(event->u.u.detail)) {
-                emitButtonSignal("buttonRelease", event);
-            }
+            pushMotionEvent(event->u.keyButtonPointer.rootX, event->u.keyButtonPointer.rootY);
             break;
         case KeyPress:
-            updateModifier(event, true);
-            emitKeySignal("keyPress", event);
+            updateModifier(event->u.u.detail, true);
+            pushKeyEvent(KeyPress, event->u.u.detail);
             break;
         case KeyRelease:
-            updateModifier(event, false);
-            emitKeySignal("keyRelease", event);
+            updateModifier(event->u.u.detail, false);
+            pushKeyEvent(KeyRelease, event->u.u.detail);
             break;
         default:
             break;
         }
     }
-    fflush(stdout);
     XRecordFreeData(data);
 }
 
@@ -213,24 +828,15 @@ bool XEventMonitorPrivate::filterWheelEvent(int detail)
     return detail != WheelUp && detail != WheelDown && detail != WheelLeft && detail != WheelRight;
 }
 
-void XEventMonitorPrivate::updateModifier(xEvent *event, bool isAdd)
+void XEventMonitorPrivate::updateModifier(int keyCode, bool isAdd)
 {
-    Display *display = XOpenDisplay(NULL);
-    KeySym keySym = XkbKeycodeToKeysym(display, event->u.u.detail, 0, 0);
+    if (keymapDirty) updateKeymap();
 
-    if(ModifiersVec.contains(keySym))
-    {
-        if(isAdd)
-        {
-            modifiers.insert(keySym);
-        }
-        else
-        {
-            modifiers.remove(keySym);
-        }
-    }
-
-    XCloseDisplay(display);
+    unsigned int bit = modifierBits[keyCode & (KEYMAP_SIZE - 1)];
+    if (isAdd)
+        modifiers |= bit;
+    else
+        modifiers &= ~bit;
 }
 
 XEventMonitor::XEventMonitor(QObject *parent)
@@ -238,20 +844,70 @@ XEventMonitor::XEventMonitor(QObject *parent)
       d_ptr(new XEventMonitorPrivate(this))
 {
     Q_D(XEventMonitor);
+    qRegisterMetaType<KeyCombo>("KeyCombo");
 }
 
 XEventMonitor::~XEventMonitor()
 {
+    stop();
+}
+
+void XEventMonitor::stop()
+{
+    if (!isRunning()) return;
+
     requestInterruption();
-    quit();
+    d_ptr->wake();
     wait();
 }
 
+void XEventMonitor::connectNotify(const QMetaMethod &signal)
+{
+    Q_UNUSED(signal);
+    d_ptr->updateWanted();
+}
+
+void XEventMonitor::disconnectNotify(const QMetaMethod &signal)
+{
+    Q_UNUSED(signal);
+    d_ptr->updateWanted();
+}
+
+void XEventMonitor::drainEvents()
+{
+    d_ptr->drainEvents();
+}
+
+QString XEventMonitor::keyComboToString(KeyCombo combo)
+{
+    unsigned int modifiers = keyComboModifiers(combo);
+    KeySym keySym = keyComboKeySym(combo);
+    bool isModifier = false;
+    QString keyStrSplice;
+
+    for (int i = 0; i < ModifiersNum; ++i)
+    {
+        if (modifiers & (1u << i))
+            keyStrSplice += QString(XKeysymToString(ModifiersVec[i])) + "+";
+        if (keySym == ModifiersVec[i])
+            isModifier = true;
+    }
+    //按键是修饰键
+    if(isModifier && modifiers)
+        keyStrSplice.remove(keyStrSplice.length() - 1, 1);
+    else
+        keyStrSplice += XKeysymToString(keySym);
+
+    return keyStrSplice;
+}
+
 void XEventMonitor::run()
 {
     if(!isInterruptionRequested())
     {
+        ResourceUsage::instance()->registerThread("xeventmonitor");
         d_ptr->run();
+        ResourceUsage::instance()->unregisterThread();
     }
 }
 
@@ -264,6 +920,7 @@ bool checkCapsState()
         unsigned int n;
         XkbGetIndicatorState(display, XkbUseCoreKbd, &n);
         capsState = (n & 0x01) == 1;
+        XCloseDisplay(display);
     }
     return capsState;
 }
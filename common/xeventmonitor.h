@@ -28,13 +28,47 @@
 #include <X11/XKBlib.h>
 #include <X11/Xlib.h>
 
+///
+/// \brief 按键组合 id，高 32 位是按下的修饰键(XEventMonitor::Modifier)，低 32 位是按键的 KeySym
+///
+typedef quint64 KeyCombo;
+
+#define XEVENTMONITOR_BACKEND_ENV   "USD_XEVENTMONITOR_BACKEND"     // 设为 xrecord 时不使用 XInput2
+
 class XEventMonitorPrivate;
 class XEventMonitor : public QThread
 {
     Q_OBJECT
 
 public:
-    static XEventMonitor *instance() { return instance_; }
+    enum Modifier {
+        ControlL    = 1 << 0,
+        ControlR    = 1 << 1,
+        ShiftL      = 1 << 2,
+        ShiftR      = 1 << 3,
+        SuperL      = 1 << 4,
+        SuperR      = 1 << 5,
+        AltL        = 1 << 6,
+        AltR        = 1 << 7
+    };
+
+    ///
+    /// \brief 第一次调用时创建，必须在主线程中调用，事件从主线程的事件循环发出
+    ///
+    static XEventMonitor *instance();
+
+    ///
+    /// \brief 结束监听线程，之后可以再次 start()
+    ///
+    void stop();
+
+    static KeyCombo keyCombo(unsigned int modifiers, KeySym keySym) { return ((KeyCombo)modifiers << 32) | (quint32)keySym; }
+    static unsigned int keyComboModifiers(KeyCombo combo) { return combo >> 32; }
+    static KeySym keyComboKeySym(KeyCombo combo) { return (KeySym)(combo & 0xffffffff); }
+    ///
+    /// \brief 按键组合的名称，如 Control_L+r，按键本身是修饰键时只包含修饰键的名称
+    ///
+    static QString keyComboToString(KeyCombo combo);
 
 private:
     XEventMonitor(QObject *parent = 0);
@@ -63,6 +97,8 @@ Q_SIGNALS:
     ///
     /// \brief keyPress
     /// \param 按键键码，不包含修饰键
+    /// 按住按键时和 XRecord 一样每次重复发出 keyRelease/keyPress，
+    /// XInput2 raw 事件本身没有重复，按 XKB 的重复延迟、间隔和按键设置补出
     ///
     void keyPress(int keyCode);
     void keyRelease(int keyCode);
@@ -73,6 +109,12 @@ Q_SIGNALS:
     ///
     void keyPress(const QString &key);
     void keyRelease(const QString &key);
+
+    ///
+    /// \brief 按键组合，需要名称时用 keyComboToString()
+    ///
+    void keyComboPress(KeyCombo combo);
+    void keyComboRelease(KeyCombo combo);
     ///
     ///
     ///
@@ -81,6 +123,11 @@ Q_SIGNALS:
 
 protected:
     void run();
+    void connectNotify(const QMetaMethod &signal) override;
+    void disconnectNotify(const QMetaMethod &signal) override;
+
+private:
+    Q_INVOKABLE void drainEvents();
     
 private:
     Q_DECLARE_PRIVATE(XEventMonitor)
@@ -1,7 +1,7 @@
 TEMPLATE = app
 TARGET = ukui-settings-daemon
 
-QT += core gui dbus
+QT += core gui dbus concurrent
 CONFIG += no_keywords link_prl link_pkgconfig c++11 debug
 CONFIG -= app_bundle
 
@@ -18,26 +18,35 @@ PKGCONFIG += \
         gio-2.0\
         gobject-2.0\
         dbus-glib-1\
-        gmodule-2.0
+        gmodule-2.0\
+        x11\
+        xi
 
 LIBS += \
         -lmate-desktop-2
 
 SOURCES += \
         $$PWD/main.cpp\
+        $$PWD/plugin-cache.cpp\
         $$PWD/plugin-info.cpp\
         $$PWD/plugin-manager.cpp\
+        $$PWD/plugin-trigger.cpp\
         $$PWD/manager-interface.cpp
 
 HEADERS += \
+        $$PWD/plugin-cache.h\
         $$PWD/plugin-info.h\
         $$PWD/plugin-manager.h\
+        $$PWD/plugin-trigger.h\
         $$PWD/manager-interface.h \
         $$PWD/global.h
 
 OTHER_FILES += \
         $$PWD/.gitignore
 
+# plugins share the daemon's copy of common/ singletons (StartupTrace)
+QMAKE_LFLAGS += -rdynamic
+
 DESTDIR = $$PWD/
 
 ukui_daemon.path = /usr/bin/
@@ -16,6 +16,10 @@
 #define USD_MANAGER_DBUS_PATH                       "/org/ukui/SettingsDaemon"
 #define DEFAULT_SETTINGS_PREFIX                     "org.ukui.SettingsDaemon"
 #define PLUGIN_EXT                                  ".ukui-settings-plugin"
+#define STARTUP_TRACE_FILE_ENV                      "USD_STARTUP_TRACE_FILE"        // write chrome trace to this file
+#define STARTUP_TRACE_FLUSH_DELAY                   30000                           // ms, wait for deferred plugin work
 #define UKUI_SETTINGS_PLUGINDIR                     "/usr/local/lib/ukui-settings-daemon"       // plugin dir
+#define PLUGIN_DIR_ENV                              "USD_PLUGIN_DIR"                // load plugins from this dir instead
+#define PLUGIN_SET_ENV                              "USD_PLUGINS"                   // comma separated modules to load, all when unset
 
 #endif // GLOBAL_H
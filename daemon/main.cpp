@@ -2,11 +2,14 @@
 #include <libmate-desktop/mate-gsettings.h>
 
 #include "clib-syslog.h"
+#include "loop-watchdog.h"
+#include "resource-usage.h"
 #include "plugin-manager.h"
 #include "manager-interface.h"
 
 #include <QDebug>
 #include <QObject>
+#include <QTimer>
 #include <QDBusReply>
 #include <QApplication>
 #include <QDBusConnectionInterface>
@@ -17,6 +20,7 @@ static void stop_daemon ();
 
 static bool no_daemon       = true;
 static bool replace         = false;
+static bool lazy            = false;
 
 int main (int argc, char* argv[])
 {
@@ -32,6 +36,9 @@ int main (int argc, char* argv[])
 
     if (replace) stop_daemon ();
 
+    ResourceUsage::instance()->startDump(qEnvironmentVariableIntValue(RESOURCE_DUMP_INTERVAL_ENV));
+
+    PluginManager::setLazyMode(lazy);
     manager = PluginManager::getInstance();
     if (nullptr == manager) {
         CT_SYSLOG(LOG_ERR, "get plugin manager error");
@@ -44,10 +51,20 @@ int main (int argc, char* argv[])
     }
 
     CT_SYSLOG(LOG_INFO, "ukui-settings-daemon started!");
+
+    // managerStart() runs before the loop, the heartbeat could not fire during it
+    QTimer::singleShot(0, [] () {
+        if (qEnvironmentVariableIsSet(LOOP_WATCHDOG_THRESHOLD_ENV)) {
+            LoopWatchdog::instance()->startWatch(qEnvironmentVariableIntValue(LOOP_WATCHDOG_THRESHOLD_ENV));
+        } else {
+            LoopWatchdog::instance()->startWatch(LOOP_WATCHDOG_THRESHOLD);
+        }
+    });
     app.exec();
 out:
 
     if (manager != NULL) delete manager;
+    LoopWatchdog::instance()->stopWatch();
 
     CT_SYSLOG(LOG_DEBUG, "SettingsDaemon finished");
 
@@ -63,6 +80,8 @@ static void parse_args (int argc, char *argv[])
             replace = true;
         } else if (0 == QString::compare(QString(argv[i]).trimmed(), QString("--daemon"))) {
             no_daemon = false;
+        } else if (0 == QString::compare(QString(argv[i]).trimmed(), QString("--lazy"))) {
+            lazy = true;
         } else {
             if (argc > 1) {
                 print_help();
@@ -75,11 +94,12 @@ static void parse_args (int argc, char *argv[])
 
 static void print_help()
 {
-    fprintf(stdout, "%s\n%s\n%s\n%s\n\n", \
+    fprintf(stdout, "%s\n%s\n%s\n%s\n%s\n\n", \
                 "Useage: ukui-setting-daemon <option> [...]", \
                 "options:",\
                 "    --replace   Replace the current daemon", \
-                "    --daemon    Become a daemon(not support now)");
+                "    --daemon    Become a daemon(not support now)", \
+                "    --lazy      Load plugins with 'Triggers' only when triggered");
 }
 
 
@@ -50,6 +50,37 @@ public Q_SLOTS:
         return asyncCallWithArgumentList(QStringLiteral("managerStop"), argumentList);
     }
 
+    inline QDBusPendingReply<QString> GetStartupTimeline()
+    {
+        QList<QVariant> argumentList;
+        return asyncCallWithArgumentList(QStringLiteral("GetStartupTimeline"), argumentList);
+    }
+
+    inline QDBusPendingReply<QString> GetMainLoopStalls()
+    {
+        QList<QVariant> argumentList;
+        return asyncCallWithArgumentList(QStringLiteral("GetMainLoopStalls"), argumentList);
+    }
+
+    inline QDBusPendingReply<QString> GetResourceUsage()
+    {
+        QList<QVariant> argumentList;
+        return asyncCallWithArgumentList(QStringLiteral("GetResourceUsage"), argumentList);
+    }
+
+    inline QDBusPendingReply<int> GetLogLevel()
+    {
+        QList<QVariant> argumentList;
+        return asyncCallWithArgumentList(QStringLiteral("GetLogLevel"), argumentList);
+    }
+
+    inline QDBusPendingReply<> SetLogLevel(int level)
+    {
+        QList<QVariant> argumentList;
+        argumentList << QVariant::fromValue(level);
+        return asyncCallWithArgumentList(QStringLiteral("SetLogLevel"), argumentList);
+    }
+
     inline QDBusPendingReply<QString> onPluginActivated()
     {
         QList<QVariant> argumentList;
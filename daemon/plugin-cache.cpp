@@ -0,0 +1,133 @@
+#include "plugin-cache.h"
+#include "clib-syslog.h"
+
+#include <glib.h>
+#include <sys/stat.h>
+
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QDataStream>
+
+static QDataStream& operator<< (QDataStream& out, const PluginCacheEntry& entry)
+{
+    out << entry.file << entry.mtime << entry.location << entry.name << entry.desc
+        << entry.website << entry.copyright << entry.authors << entry.depends
+        << entry.triggers << entry.priority << entry.schema << entry.schemaExists;
+
+    return out;
+}
+
+static QDataStream& operator>> (QDataStream& in, PluginCacheEntry& entry)
+{
+    in >> entry.file >> entry.mtime >> entry.location >> entry.name >> entry.desc
+       >> entry.website >> entry.copyright >> entry.authors >> entry.depends
+       >> entry.triggers >> entry.priority >> entry.schema >> entry.schemaExists;
+
+    return in;
+}
+
+PluginCache::PluginCache(const QString& pluginDir)
+{
+    const char* const* langs = g_get_language_names();
+
+    mPluginDir = pluginDir;
+    mFile = QString("%1/%2").arg(g_get_user_cache_dir()).arg(PLUGIN_CACHE_FILE);
+    mLocale = (nullptr != langs && nullptr != langs[0]) ? langs[0] : "C";
+}
+
+PluginCache::~PluginCache()
+{
+}
+
+qint64 PluginCache::fileMtime(const QString& fileName)
+{
+    struct stat st;
+
+    if (0 != stat(fileName.toUtf8().data(), &st)) return -1;
+
+    return (qint64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+bool PluginCache::load()
+{
+    quint32     magic = 0;
+    quint32     version = 0;
+    qint64      dirMtime = 0;
+    quint32     count = 0;
+    QString     locale;
+    QString     pluginDir;
+
+    mEntries.clear();
+
+    QFile file(mFile);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    uchar* data = file.map(0, file.size());
+    if (nullptr == data) return false;
+
+    QByteArray buf = QByteArray::fromRawData((const char*)data, file.size());
+    QDataStream in(buf);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    in >> magic >> version;
+    if (PLUGIN_CACHE_MAGIC != magic || PLUGIN_CACHE_VERSION != version) {
+        CT_SYSLOG(LOG_DEBUG, "plugin cache '%s' has wrong version", mFile.toUtf8().data());
+        return false;
+    }
+
+    in >> pluginDir >> dirMtime >> locale >> count;
+    if (pluginDir != mPluginDir || dirMtime != fileMtime(mPluginDir) || locale != mLocale) {
+        CT_SYSLOG(LOG_DEBUG, "plugin cache '%s' is out of date", mFile.toUtf8().data());
+        return false;
+    }
+
+    for (quint32 i = 0; i < count && QDataStream::Ok == in.status(); ++i) {
+        PluginCacheEntry entry;
+        in >> entry;
+        if (entry.mtime != fileMtime(entry.file)) {
+            CT_SYSLOG(LOG_DEBUG, "plugin file '%s' has changed", entry.file.toUtf8().data());
+            mEntries.clear();
+            return false;
+        }
+        mEntries.append(entry);
+    }
+
+    if (QDataStream::Ok != in.status()) {
+        CT_SYSLOG(LOG_ERR, "plugin cache '%s' is corrupted", mFile.toUtf8().data());
+        mEntries.clear();
+        return false;
+    }
+
+    return true;
+}
+
+bool PluginCache::save()
+{
+    QDir().mkpath(QFileInfo(mFile).absolutePath());
+
+    QSaveFile file(mFile);
+    if (!file.open(QIODevice::WriteOnly)) {
+        CT_SYSLOG(LOG_ERR, "open plugin cache '%s' error", mFile.toUtf8().data());
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << (quint32)PLUGIN_CACHE_MAGIC << (quint32)PLUGIN_CACHE_VERSION;
+    out << mPluginDir << fileMtime(mPluginDir) << mLocale << (quint32)mEntries.size();
+    for (const PluginCacheEntry& entry : mEntries) out << entry;
+
+    return file.commit();
+}
+
+void PluginCache::addEntry(const PluginCacheEntry& entry)
+{
+    mEntries.append(entry);
+}
+
+QList<PluginCacheEntry>& PluginCache::getEntries()
+{
+    return mEntries;
+}
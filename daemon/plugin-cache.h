@@ -0,0 +1,62 @@
+#ifndef PLUGINCACHE_H
+#define PLUGINCACHE_H
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+#define PLUGIN_CACHE_MAGIC                          0x55534450      // "USDP"
+#define PLUGIN_CACHE_VERSION                        2
+#define PLUGIN_CACHE_FILE                           "ukui-settings-daemon/plugins.cache"
+
+namespace UkuiSettingsDaemon {
+class PluginCache;
+}
+
+/* 插件描述文件解析后的内容 */
+struct PluginCacheEntry
+{
+    QString                 file;
+    qint64                  mtime;
+    QString                 location;
+    QString                 name;
+    QString                 desc;
+    QString                 website;
+    QString                 copyright;
+    QStringList             authors;
+    QStringList             depends;
+    QStringList             triggers;
+    qint32                  priority;
+    QString                 schema;         // 解析出的 gsettings schema id
+    bool                    schemaExists;   // schema 是否已安装
+};
+
+/**
+ * 插件描述文件的二进制缓存，位于 $XDG_CACHE_HOME/ukui-settings-daemon/plugins.cache
+ * 插件目录、每个描述文件的 mtime 和当前语言都相同时缓存有效，
+ * 热启动时只需 mmap 读一次缓存文件，不再逐个解析 GKeyFile，
+ * 也不再逐个查询插件的 schema 是否存在。
+ */
+class PluginCache
+{
+public:
+    explicit PluginCache()=delete;
+    PluginCache(const QString& pluginDir);
+    ~PluginCache();
+
+    bool load ();
+    bool save ();
+
+    void addEntry (const PluginCacheEntry& entry);
+    QList<PluginCacheEntry>& getEntries ();
+
+    static qint64 fileMtime (const QString& fileName);
+
+private:
+    QString                 mFile;
+    QString                 mLocale;
+    QString                 mPluginDir;
+    QList<PluginCacheEntry> mEntries;
+};
+
+#endif // PLUGINCACHE_H
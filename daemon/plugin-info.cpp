@@ -1,27 +1,35 @@
 #include "plugin-info.h"
 #include "global.h"
 #include "clib-syslog.h"
+#include "startup-trace.h"
+#include "resource-usage.h"
+#include "plugin-manager.h"
 
 #include <QDebug>
 #include <QFile>
 
-PluginInfo::PluginInfo(QString& fileName)
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * Only parse the plugin file into a cache entry, it creates no QObject and
+ * touches neither X nor GSettings, so it is safe to be called from the
+ * worker thread pool.
+ */
+PluginCacheEntry PluginInfo::readPluginFile(const QString& fileName)
 {
     int         priority;
     char*       str = NULL;
     GError*     error = NULL;
     GKeyFile*   pluginFile = NULL;
+    PluginCacheEntry entry;
 
-    mPriority = 0;
-    mActive = false;
-    mEnabled = true;
-    mPlugin = nullptr;
-    mModule = nullptr;
-    mAvailable = true;
-    mSettings = nullptr;
+    USD_TRACE_SPAN("manifest", fileName);
 
-    QByteArray* bt = new QByteArray(fileName.toUtf8().data());
-    mFile = *bt;
+    entry.file = fileName;
+    entry.mtime = PluginCache::fileMtime(fileName);
+    entry.priority = PLUGIN_PRIORITY_DEFAULT;
+    entry.schemaExists = false;
 
     pluginFile = g_key_file_new();
     if (!g_key_file_load_from_file(pluginFile, (char*)fileName.toUtf8().data(), G_KEY_FILE_NONE, &error)) {
@@ -29,7 +37,7 @@ PluginInfo::PluginInfo(QString& fileName)
         g_object_unref(error);
         error = nullptr;
         g_object_unref(pluginFile);
-        return;
+        return entry;
     }
     if (!g_key_file_has_key(pluginFile, PLUGIN_GROUP, "IAge", &error)) {
         CT_SYSLOG(LOG_ERR, "IAge key does not exist in file: %s, error: '%s'", fileName.toUtf8().data(), error->message);
@@ -46,7 +54,7 @@ PluginInfo::PluginInfo(QString& fileName)
     /* Get Location */
     str = g_key_file_get_string (pluginFile, PLUGIN_GROUP, "Module", &error);
     if ((str != NULL) && (*str != '\0')) {
-        mLocation = str;
+        entry.location = str;
     } else {
         g_free (str);
         CT_SYSLOG(LOG_ERR, "Could not find 'Module' in %s, error: '%s'", fileName.toUtf8().data(), error->message);
@@ -56,7 +64,7 @@ PluginInfo::PluginInfo(QString& fileName)
     /* Get Name */
     str = g_key_file_get_locale_string (pluginFile, PLUGIN_GROUP, "Name", NULL, &error);
     if (str != NULL) {
-        mName = str;
+        entry.name = str;
     } else {
         CT_SYSLOG(LOG_ERR, "Could not find %s, error '%s'", fileName.toUtf8().data(), error->message);
         g_object_unref(error);
@@ -66,7 +74,7 @@ PluginInfo::PluginInfo(QString& fileName)
     /* Get Description */
     str = g_key_file_get_locale_string (pluginFile, PLUGIN_GROUP, "Description", NULL, &error);
     if (str != NULL) {
-        mDesc = QString(str);
+        entry.desc = QString(str);
     } else {
         CT_SYSLOG(LOG_ERR, "Could not find 'Description' in %s, error: '%s'", fileName.toUtf8().data(), error->message);
         g_object_unref(error);
@@ -74,10 +82,9 @@ PluginInfo::PluginInfo(QString& fileName)
     }
 
     /* Get Authors */
-    mAuthors = new QList<QString>();
     char** author = g_key_file_get_string_list (pluginFile, PLUGIN_GROUP, "Authors", NULL, &error);
     if (nullptr != author) {
-        for (int i = 0; author[i] != NULL; ++i) mAuthors->append(author[i]);
+        for (int i = 0; author[i] != NULL; ++i) entry.authors.append(author[i]);
     } else {
         CT_SYSLOG(LOG_ERR, "Could not find 'Authors' in %s, error: '%s'", fileName.toUtf8().data(), error->message);
         g_object_unref(error);
@@ -89,7 +96,7 @@ PluginInfo::PluginInfo(QString& fileName)
     /* Get Copyright */
     str = g_key_file_get_string (pluginFile, PLUGIN_GROUP, "Copyright", &error);
     if (str != NULL) {
-        mCopyright = str;
+        entry.copyright = str;
     } else {
         CT_SYSLOG(LOG_ERR, "Could not find 'Copyright' in %s, error: '%s'", fileName.toUtf8().data(), error->message);
         g_object_unref(error);
@@ -99,7 +106,7 @@ PluginInfo::PluginInfo(QString& fileName)
     /* Get Website */
     str = g_key_file_get_string (pluginFile, PLUGIN_GROUP, "Website", &error);
     if (str != NULL) {
-         mWebsite = str;
+         entry.website = str;
     } else {
         CT_SYSLOG(LOG_ERR, "Could not find 'Website' in %s, error: '%s'", fileName.toUtf8().data(), error->message);
 
@@ -107,16 +114,59 @@ PluginInfo::PluginInfo(QString& fileName)
         error = nullptr;
     }
 
+    /* Get Depends, optional: module names that must be activated first */
+    char** depend = g_key_file_get_string_list (pluginFile, PLUGIN_GROUP, "Depends", NULL, NULL);
+    if (nullptr != depend) {
+        for (int i = 0; depend[i] != NULL; ++i) {
+            if (*depend[i] != '\0') entry.depends.append(depend[i]);
+        }
+    }
+    g_strfreev (depend);
+    depend = nullptr;
+
+    /* Get Triggers, optional: conditions to load the plugin in lazy mode */
+    char** trigger = g_key_file_get_string_list (pluginFile, PLUGIN_GROUP, "Triggers", NULL, NULL);
+    if (nullptr != trigger) {
+        for (int i = 0; trigger[i] != NULL; ++i) {
+            if (*trigger[i] != '\0') entry.triggers.append(trigger[i]);
+        }
+    }
+    g_strfreev (trigger);
+    trigger = nullptr;
+
     /* Get Priority */
     priority = g_key_file_get_integer (pluginFile, PLUGIN_GROUP, "Priority", NULL);
     if (priority >= PLUGIN_PRIORITY_MAX) {
-         this->mPriority = priority;
+         entry.priority = priority;
     } else {
-         this->mPriority = PLUGIN_PRIORITY_DEFAULT;
+         entry.priority = PLUGIN_PRIORITY_DEFAULT;
     }
 
     if (nullptr != error) g_object_unref(error);
     if (nullptr != pluginFile) g_key_file_free (pluginFile);
+
+    return entry;
+}
+
+PluginInfo::PluginInfo(const PluginCacheEntry& entry)
+{
+    mActive = false;
+    mEnabled = true;
+    mPlugin = nullptr;
+    mModule = nullptr;
+    mAvailable = true;
+    mSettings = nullptr;
+
+    mFile = entry.file;
+    mLocation = entry.location;
+    mName = entry.name;
+    mDesc = entry.desc;
+    mWebsite = entry.website;
+    mCopyright = entry.copyright;
+    mAuthors = new QList<QString>(entry.authors);
+    mDepends = entry.depends;
+    mTriggerList = entry.triggers;
+    mPriority = entry.priority;
 }
 
 PluginInfo::~PluginInfo()
@@ -126,6 +176,39 @@ PluginInfo::~PluginInfo()
     if (nullptr != mSettings) {delete mSettings; mSettings = nullptr;}
 }
 
+/*
+ * Only read the module file into the page cache, no code of the module
+ * runs, so it is safe to be called from the worker thread pool.
+ */
+bool PluginInfo::pluginPrefetch()
+{
+    int         fd;
+    int         ret;
+    QString     path = modulePath();
+
+    if (!mAvailable || path.isEmpty()) return false;
+
+    fd = open(path.toUtf8().data(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    ret = posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+
+    return 0 == ret;
+}
+
+/*
+ * dlopen runs the static initializers of the module and of the common/
+ * code linked into it, they may create QObjects, so only call it from
+ * the main thread.
+ */
+bool PluginInfo::pluginLoad()
+{
+    if (!mAvailable) return false;
+    if (nullptr != mModule) return mModule->isLoaded();
+
+    return loadPluginLibrary(*this);
+}
+
 bool PluginInfo::pluginActivate()
 {
     bool res = false;
@@ -139,6 +222,9 @@ bool PluginInfo::pluginActivate()
     }
 
     if (res && (nullptr != mPlugin)) {
+        QByteArray id = mLocation.toUtf8();
+        USD_TRACE_SPAN("activate", mName);
+        USD_RESOURCE_SCOPE(id.constData());
         mPlugin->activate();
         mActive = true;
         res = true;
@@ -181,6 +267,53 @@ bool PluginInfo::pluginIsAvailable()
     return this->mAvailable;
 }
 
+bool PluginInfo::pluginHasTriggers()
+{
+    return !mTriggerList.isEmpty();
+}
+
+/*
+ * Lazy mode: do not load the module until one of its triggers fires,
+ * if no trigger can be watched the plugin is activated at once.
+ * Triggers that failed to start are deleted, mTriggers only holds
+ * the ones being watched.
+ */
+bool PluginInfo::pluginWatchTriggers()
+{
+    bool ready = false;
+
+    if (!mAvailable) return false;
+    if (mActive || !mTriggers.isEmpty()) return true;
+
+    for (const QString& t : mTriggerList) {
+        PluginTrigger* trigger = PluginTrigger::parse(t, this);
+        if (nullptr == trigger) {
+            CT_SYSLOG(LOG_ERR, "Bad trigger '%s' in plugin '%s'", t.toUtf8().data(), mName.toUtf8().data());
+            continue;
+        }
+        int state = trigger->start();
+        if (PluginTrigger::TRIGGER_FAILED == state) {
+            CT_SYSLOG(LOG_ERR, "Unable to watch trigger '%s' of plugin '%s'", t.toUtf8().data(), mName.toUtf8().data());
+            delete trigger;
+            continue;
+        }
+        mTriggers.append(trigger);
+        connect(trigger, SIGNAL(triggered()), this, SLOT(pluginTriggerSlot()));
+        if (PluginTrigger::TRIGGER_READY == state) {
+            ready = true;
+            break;
+        }
+    }
+
+    if (ready || mTriggers.isEmpty()) {
+        pluginTriggerSlot();
+    } else {
+        CT_SYSLOG(LOG_DEBUG, "plugin '%s' is waiting for triggers", mName.toUtf8().data());
+    }
+
+    return true;
+}
+
 QString& PluginInfo::getPluginName()
 {
     return this->mName;
@@ -196,6 +329,11 @@ QList<QString>& PluginInfo::getPluginAuthors()
     return *mAuthors;
 }
 
+QStringList& PluginInfo::getPluginDepends()
+{
+    return this->mDepends;
+}
+
 QString& PluginInfo::getPluginWebsite()
 {
     return this->mWebsite;
@@ -247,7 +385,35 @@ void PluginInfo::pluginSchemaSlot(QString)
     // if configure deactivity plugin, activate() else deactivate()
 }
 
-bool loadPluginModule(PluginInfo& pinfo)
+void PluginInfo::pluginTriggerSlot()
+{
+    // this slot may be called from a trigger's signal, never delete it here
+    while (!mTriggers.isEmpty()) {
+        PluginTrigger* trigger = mTriggers.takeFirst();
+        trigger->stop();
+        disconnect(trigger, nullptr, this, nullptr);
+        trigger->deleteLater();
+    }
+
+    if (!PluginManager::dependsActivated(this)) {
+        CT_SYSLOG(LOG_ERR, "skip lazy plugin '%s', depends are not activated", mName.toUtf8().data());
+        return;
+    }
+    CT_SYSLOG(LOG_DEBUG, "start lazy plugin: %s ...", mName.toUtf8().data());
+    pluginActivate();
+}
+
+QString PluginInfo::modulePath()
+{
+    if (mFile.isEmpty() || mLocation.isEmpty()) return QString();
+
+    QStringList l = mFile.split("/");
+    l.pop_back();
+
+    return l.join("/") + "/lib" + mLocation + ".so";
+}
+
+bool loadPluginLibrary(PluginInfo& pinfo)
 {
     QString     path;
 
@@ -255,15 +421,9 @@ bool loadPluginModule(PluginInfo& pinfo)
     if (pinfo.mLocation.isNull() || pinfo.mLocation.isEmpty()) {CT_SYSLOG(LOG_ERR, "Plugin location is error"); return false;}
     if (!pinfo.mAvailable) {CT_SYSLOG(LOG_ERR, "Plugin is not available"); return false;}
 
-    QFile file(pinfo.mFile);
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) return false;
-
-    QStringList l = pinfo.mFile.split("/");
-    l.pop_back();
-    path = l.join("/") + "/lib" + pinfo.mLocation + ".so";
-
-    if (path.isEmpty() || path.isNull()) {CT_SYSLOG(LOG_ERR, "error module path:'%s'", path.toUtf8().data()); return false;}
+    path = pinfo.modulePath();
 
+    USD_TRACE_SPAN("dlopen", pinfo.mLocation);
     pinfo.mModule = new QLibrary(path);
     pinfo.mModule->setLoadHints(QLibrary::ResolveAllSymbolsHint | QLibrary::ExportExternalSymbolsHint);
     if (!(pinfo.mModule->load())) {
@@ -271,12 +431,22 @@ bool loadPluginModule(PluginInfo& pinfo)
         pinfo.mAvailable = false;
         return false;
     }
+
+    return true;
+}
+
+bool loadPluginModule(PluginInfo& pinfo)
+{
+    if (nullptr == pinfo.mModule && !loadPluginLibrary(pinfo)) return false;
+    if (!pinfo.mModule->isLoaded()) {CT_SYSLOG(LOG_ERR, "Plugin module is not loaded"); return false;}
+
     typedef PluginInterface* (*createPlugin) ();
     createPlugin p = (createPlugin)pinfo.mModule->resolve("createSettingsPlugin");
     if (!p) {
         CT_SYSLOG(LOG_ERR, "create module class failed, error: '%s'", pinfo.mModule->errorString().toUtf8().data());
         return false;
     }
+    USD_TRACE_SPAN("create", pinfo.mName);
     pinfo.mPlugin = (PluginInterface*)p();
 
     return true;
@@ -1,10 +1,13 @@
 #ifndef PluginInfo_H
 #define PluginInfo_H
 #include "plugin-interface.h"
+#include "plugin-cache.h"
+#include "plugin-trigger.h"
 
 #include <glib-object.h>
 #include <QLibrary>
 #include <QObject>
+#include <QStringList>
 #include <string>
 
 #include <QGSettings/qgsettings.h>
@@ -18,14 +21,18 @@ class PluginInfo : public QObject
     Q_OBJECT
 public:
     explicit PluginInfo()=delete;
-    PluginInfo(QString& fileName);
+    PluginInfo(const PluginCacheEntry& entry);
     ~PluginInfo();
 
+    bool pluginLoad ();
+    bool pluginPrefetch ();
     bool pluginEnabled ();
     bool pluginActivate ();
     bool pluginDeactivate ();
     bool pluginIsactivate ();
     bool pluginIsAvailable ();
+    bool pluginHasTriggers ();
+    bool pluginWatchTriggers ();
 
     int getPluginPriority ();
     QString& getPluginName ();
@@ -34,16 +41,24 @@ public:
     QString& getPluginCopyright ();
     QString& getPluginDescription ();
     QList<QString>& getPluginAuthors ();
+    QStringList& getPluginDepends ();
 
     void setPluginPriority (int priority);
     void setPluginSchema (QString& schema);
 
     bool operator== (PluginInfo&);
 
+    /* 解析插件描述文件，不创建 QObject，可在线程池中调用 */
+    static PluginCacheEntry readPluginFile (const QString& fileName);
+
 public Q_SLOTS:
     void pluginSchemaSlot (QString key);
+    void pluginTriggerSlot ();
 
 private:
+    QString modulePath ();
+
+    friend bool loadPluginLibrary(PluginInfo&);
     friend bool loadPluginModule(PluginInfo&);
 
 private:
@@ -65,6 +80,9 @@ private:
     PluginInterface*        mPlugin;
 
     QList<QString>*         mAuthors;
+    QStringList             mDepends;
+    QStringList             mTriggerList;
+    QList<PluginTrigger*>   mTriggers;
 };
 
 #endif // PluginInfo_H
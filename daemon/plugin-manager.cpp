@@ -2,9 +2,14 @@
 
 #include "global.h"
 #include "clib-syslog.h"
+#include "loop-watchdog.h"
+#include "startup-trace.h"
+#include "resource-usage.h"
 #include "plugin-info.h"
+#include "plugin-cache.h"
 
 #include <glib.h>
+#include <algorithm>
 #include <stdio.h>
 #include <fcntl.h>
 #include <stdlib.h>
@@ -14,15 +19,35 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <QSet>
+#include <QHash>
 #include <QDebug>
+#include <QFuture>
+#include <QTimer>
 #include <QDBusError>
+#include <QtConcurrent>
 #include <QDBusConnectionInterface>
 
+bool PluginManager::mLazy = false;
 QList<PluginInfo*>* PluginManager::mPlugin = nullptr;
 PluginManager* PluginManager::mPluginManager = nullptr;
 
-static bool is_schema (QString& schema);
+static static PluginCacheEntry read_plugin_file (const QString& fileName)
+{
+    PluginCacheEntry entry = PluginInfo::readPluginFile(fileName);
+    resolve_schema(entry);
+
+    return entry;
+}
+
+bool is_schema (QString& schema);
+static void resolve_schema (PluginCacheEntry& entry);
+static PluginCacheEntry read_plugin_file (const QString& fileName);
+static void sort_plugins (QList<PluginInfo*>& plugins);
+static bool depends_activated (PluginInfo* info, QHash<QString, PluginInfo*>& modules);
+static QSet<PluginInfo*> deferred_plugins (QList<PluginInfo*>& plugins, QHash<QString, PluginInfo*>& modules);
 static bool register_manager(PluginManager& pm);
+static void write_startup_trace ();
 
 PluginManager::PluginManager()
 {
@@ -50,73 +75,129 @@ PluginManager* PluginManager::getInstance()
     return mPluginManager;
 }
 
+void PluginManager::setLazyMode(bool lazy)
+{
+    mLazy = lazy;
+}
+
+bool PluginManager::dependsActivated(PluginInfo* info)
+{
+    QHash<QString, PluginInfo*> modules;
+
+    if (nullptr == mPlugin) return false;
+    for (PluginInfo* p : *mPlugin) modules.insert(p->getPluginLocation(), p);
+
+    return depends_activated(info, modules);
+}
+
 bool PluginManager::managerStart()
 {
     GDir*                   dir = NULL;
-    QString                 schema;
     GError*                 error = NULL;
     const char*             name = NULL;
 
     CT_SYSLOG(LOG_DEBUG, "Starting settings manager");
+    USD_TRACE_SPAN("daemon", "managerStart");
 
     QString path(UKUI_SETTINGS_PLUGINDIR);
-    dir = g_dir_open ((char*)path.toUtf8().data(), 0, &error);
-    if (NULL == dir) {
-        CT_SYSLOG(LOG_ERR, "%s", error->message);
-        g_error_free(error);
-        error = nullptr;
-        return false;
-    }
-
-    while ((name = g_dir_read_name(dir))) {
-        char* filename = NULL;
-        if (!g_str_has_suffix(name, PLUGIN_EXT)) {
-            continue;
+    if (!qgetenv(PLUGIN_DIR_ENV).isEmpty()) path = qgetenv(PLUGIN_DIR_ENV);
+    PluginCache cache(path);
+    if (cache.load()) {
+        CT_SYSLOG(LOG_DEBUG, "load plugins from cache");
+        for (const PluginCacheEntry& entry : cache.getEntries()) {
+            add_plugin(new PluginInfo(entry), entry);
+        }
+    } else {
+        // parse plugin files and look up their schemas concurrently on the worker pool
+        QList<QFuture<PluginCacheEntry>> reads;
+        dir = g_dir_open ((char*)path.toUtf8().data(), 0, &error);
+        if (NULL == dir) {
+            CT_SYSLOG(LOG_ERR, "%s", error->message);
+            g_error_free(error);
+            error = nullptr;
+            return false;
         }
-        filename = g_build_filename((char*)path.toUtf8().data(), name, NULL);
-        if (g_file_test(filename, G_FILE_TEST_IS_REGULAR)) {
-            QString ftmp(filename);
-            PluginInfo* info = new PluginInfo(ftmp);
-            if (info == NULL) {
+
+        while ((name = g_dir_read_name(dir))) {
+            char* filename = NULL;
+            if (!g_str_has_suffix(name, PLUGIN_EXT)) {
                 continue;
             }
-
-            if (mPlugin->contains(info)) {
-                CT_SYSLOG(LOG_DEBUG, "The list has contain this plugin, '%s'", ftmp.toUtf8().data());
-                if (info != NULL) delete info;
+            filename = g_build_filename((char*)path.toUtf8().data(), name, NULL);
+            if (g_file_test(filename, G_FILE_TEST_IS_REGULAR)) {
+                reads.append(QtConcurrent::run(read_plugin_file, QString(filename)));
             }
+            g_free(filename);
+        }
+        g_dir_close(dir);
 
-            // check plugin's schema
-            schema = QString("%1.plugins.%2").arg(DEFAULT_SETTINGS_PREFIX).arg(info->getPluginLocation().toUtf8().data());
-            if (is_schema (schema)) {
-                CT_SYSLOG(LOG_DEBUG, "right schema '%s'", schema.toUtf8().data());
-                info->setPluginSchema(schema);
-                mPlugin->insert(0, info);
-            } else {
-                CT_SYSLOG(LOG_ERR, "Ignoring unknown schema '%s'", schema.toUtf8().data());
-                if (info != NULL) delete info;
-            }
+        for (QFuture<PluginCacheEntry>& read : reads) {
+            PluginCacheEntry entry = read.result();
+            cache.addEntry(entry);
+            add_plugin(new PluginInfo(entry), entry);
         }
-        g_free(filename);
+
+        if (!cache.save()) CT_SYSLOG(LOG_ERR, "save plugin cache error");
     }
-    g_dir_close(dir);
 
-    // FIXME:// sort plugin
+    sort_plugins (*mPlugin);
+
+    /**
+     * read all modules into the page cache concurrently on the worker pool,
+     * then dlopen and activate them one by one on the main thread in
+     * dependency/priority order: static initializers of a module must not
+     * run on a pool thread that has no event loop.
+     */
+    QHash<QString, PluginInfo*> modules;
+    QList<QFuture<bool>> loads;
+    QSet<PluginInfo*> deferred;
+    for (int i = 0; i < mPlugin->size(); ++i) {
+        PluginInfo* info = mPlugin->at(i);
+        modules.insert(info->getPluginLocation(), info);
+    }
+    if (mLazy) deferred = deferred_plugins (*mPlugin, modules);
+    for (int i = 0; i < mPlugin->size(); ++i) {
+        PluginInfo* info = mPlugin->at(i);
+        if (deferred.contains(info)) {
+            loads.append(QFuture<bool>());
+        } else {
+            loads.append(QtConcurrent::run(info, &PluginInfo::pluginPrefetch));
+        }
+    }
 
     CT_SYSLOG(LOG_DEBUG, "Now Activity plugins ...");
     for (int i = 0; i < mPlugin->size(); ++i) {
         PluginInfo* info = mPlugin->at(i);
+        if (deferred.contains(info)) continue;
+        loads[i].waitForFinished();
+        info->pluginLoad();
+        if (!depends_activated(info, modules)) {
+            CT_SYSLOG(LOG_ERR, "skip plugin '%s', depends are not activated", info->getPluginName().toUtf8().data());
+            continue;
+        }
         CT_SYSLOG(LOG_DEBUG, "start activity plugin: %s ...", info->getPluginName().toUtf8().data());
         info->pluginActivate();
     }
+    if (mLazy) {
+        for (int i = 0; i < mPlugin->size(); ++i) {
+            PluginInfo* info = mPlugin->at(i);
+            if (deferred.contains(info)) info->pluginWatchTriggers();
+        }
+    }
     CT_SYSLOG(LOG_DEBUG, "All plugins has been activited!");
 
+    // include the work plugins defer to idle callbacks
+    if (!qgetenv(STARTUP_TRACE_FILE_ENV).isEmpty()) {
+        QTimer::singleShot(STARTUP_TRACE_FLUSH_DELAY, [] () { write_startup_trace(); });
+    }
+
     return true;
 }
 
 void PluginManager::managerStop()
 {
     CT_SYSLOG(LOG_DEBUG, "Stopping settings manager");
+    write_startup_trace();
     while (!mPlugin->isEmpty()) {
         PluginInfo* plugin = mPlugin->takeFirst();
         plugin->pluginDeactivate();
@@ -127,23 +208,186 @@ void PluginManager::managerStop()
     QCoreApplication::exit();
 }
 
+QString PluginManager::GetStartupTimeline()
+{
+    return StartupTrace::instance()->toChromeTrace();
+}
+
+void PluginManager::add_plugin(PluginInfo* info, const PluginCacheEntry& entry)
+{
+    QString schema = entry.schema;
+
+    if (mPlugin->contains(info)) {
+        CT_SYSLOG(LOG_DEBUG, "The list has contain this plugin, '%s'", info->getPluginName().toUtf8().data());
+        delete info;
+        return;
+    }
+
+    // USD_PLUGINS restricts the plugin set, used by the startup benchmark
+    QByteArray set = qgetenv(PLUGIN_SET_ENV);
+    if (!set.isEmpty() && !QString(set).split(",", QString::SkipEmptyParts).contains(info->getPluginLocation())) {
+        CT_SYSLOG(LOG_DEBUG, "plugin '%s' is not in %s", info->getPluginLocation().toUtf8().data(), PLUGIN_SET_ENV);
+        delete info;
+        return;
+    }
+
+    // plugin's schema is resolved by resolve_schema() or read from the cache
+    if (entry.schemaExists) {
+        CT_SYSLOG(LOG_DEBUG, "right schema '%s'", schema.toUtf8().data());
+        info->setPluginSchema(schema);
+        mPlugin->insert(0, info);
+    } else {
+        CT_SYSLOG(LOG_ERR, "Ignoring unknown schema '%s'", schema.toUtf8().data());
+        delete info;
+    }
+}
+
+QString PluginManager::GetMainLoopStalls()
+{
+    return LoopWatchdog::instance()->toJson();
+}
+
+QString PluginManager::GetResourceUsage()
+{
+    return ResourceUsage::instance()->toJson();
+}
+
+int PluginManager::GetLogLevel()
+{
+    return syslog_get_level();
+}
+
+void PluginManager::SetLogLevel(int level)
+{
+    CT_SYSLOG(LOG_INFO, "set log level to %d", level);
+    syslog_set_level(level);
+}
+
 bool PluginManager::managerAwake()
 {
     CT_SYSLOG(LOG_DEBUG, "Awake called")
     return managerStart();
 }
 
-static bool is_item_in_schema (const char* const* items, QString& item)
+/*
+ * Topological sort by 'Depends', plugins which are ready at the
+ * same time are ordered by priority (PLUGIN_PRIORITY_MAX first).
+ */
+static void sort_plugins (QList<PluginInfo*>& plugins)
+{
+    QList<PluginInfo*> sorted;
+    QList<PluginInfo*> pending;
+    QHash<QString, PluginInfo*> modules;
+
+    for (PluginInfo* info : plugins) modules.insert(info->getPluginLocation(), info);
+
+    pending = plugins;
+    std::stable_sort(pending.begin(), pending.end(), [] (PluginInfo* a, PluginInfo* b) {
+        return a->getPluginPriority() < b->getPluginPriority();
+    });
+
+    while (!pending.isEmpty()) {
+        int i = 0;
+        for (; i < pending.size(); ++i) {
+            bool ready = true;
+            for (const QString& dep : pending.at(i)->getPluginDepends()) {
+                PluginInfo* d = modules.value(dep, nullptr);
+                if (nullptr != d && d != pending.at(i) && !sorted.contains(d)) {
+                    ready = false;
+                    break;
+                }
+            }
+            if (ready) break;
+        }
+
+        if (i >= pending.size()) {
+            CT_SYSLOG(LOG_ERR, "plugin depends has a cycle, start from '%s'", pending.first()->getPluginName().toUtf8().data());
+            i = 0;
+        }
+        sorted.append(pending.takeAt(i));
+    }
+
+    plugins = sorted;
+}
+
+static bool depends_activated (PluginInfo* info, QHash<QString, PluginInfo*>& modules)
 {
-    while (*items) {
-       if (g_strcmp0 (*items++, item.toLatin1().data()) == 0) return true;
+    for (const QString& dep : info->getPluginDepends()) {
+        PluginInfo* d = modules.value(dep, nullptr);
+        if (nullptr == d) {
+            CT_SYSLOG(LOG_DEBUG, "plugin '%s' depends on unknown module '%s'", info->getPluginName().toUtf8().data(), dep.toUtf8().data());
+            continue;
+        }
+        if (d != info && !d->pluginIsactivate()) return false;
     }
-    return false;
+
+    return true;
+}
+
+static void resolve_schema (PluginCacheEntry& entry)
+{
+    entry.schema = QString("%1.plugins.%2").arg(DEFAULT_SETTINGS_PREFIX).arg(entry.location);
+
+    USD_TRACE_SPAN("schema", entry.schema);
+    entry.schemaExists = is_schema (entry.schema);
+}
+
+static PluginCacheEntry read_plugin_file (const QString& fileName)
+{
+    PluginCacheEntry entry = PluginInfo::readPluginFile(fileName);
+    resolve_schema(entry);
+
+    return entry;
+}
+
+/*
+ * Plugins with triggers wait for them in lazy mode, unless a plugin
+ * started at once depends on them: those are started at once as well,
+ * walking the sorted list backwards reaches every dependent first.
+ */
+static QSet<PluginInfo*> deferred_plugins (QList<PluginInfo*>& plugins, QHash<QString, PluginInfo*>& modules)
+{
+    QSet<PluginInfo*> deferred;
+    QSet<PluginInfo*> needed;
+
+    for (int i = plugins.size() - 1; i >= 0; --i) {
+        PluginInfo* info = plugins.at(i);
+        if (info->pluginHasTriggers() && !needed.contains(info)) {
+            deferred.insert(info);
+            continue;
+        }
+        for (const QString& dep : info->getPluginDepends()) {
+            PluginInfo* d = modules.value(dep, nullptr);
+            if (nullptr != d && d != info) needed.insert(d);
+        }
+        if (info->pluginHasTriggers()) {
+            CT_SYSLOG(LOG_DEBUG, "lazy plugin '%s' is depended on, start it at once", info->getPluginName().toUtf8().data());
+        }
+    }
+
+    return deferred;
 }
 
 bool is_schema (QString& schema)
 {
-    return is_item_in_schema (g_settings_list_schemas(), schema);
+    GSettingsSchemaSource* source = g_settings_schema_source_get_default ();
+    if (nullptr == source) return false;
+
+    GSettingsSchema* s = g_settings_schema_source_lookup (source, schema.toUtf8().data(), TRUE);
+    if (nullptr == s) return false;
+    g_settings_schema_unref (s);
+
+    return true;
+}
+
+static void write_startup_trace ()
+{
+    QString fileName = qgetenv(STARTUP_TRACE_FILE_ENV);
+
+    if (fileName.isEmpty()) return;
+    if (!StartupTrace::instance()->writeChromeTrace(fileName)) {
+        CT_SYSLOG(LOG_ERR, "write startup trace '%s' error", fileName.toUtf8().data());
+    }
 }
 
 static bool register_manager(PluginManager& pm)
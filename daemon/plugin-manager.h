@@ -22,12 +22,17 @@ class PluginManager : QObject
 public:
     ~PluginManager();
     static PluginManager* getInstance();
+    static void setLazyMode (bool lazy);
+    /* 依赖的插件都已激活，未知的依赖忽略 */
+    static bool dependsActivated (PluginInfo* info);
 
 private:
     PluginManager();
     PluginManager(PluginManager&)=delete;
     PluginManager& operator= (const PluginManager&)=delete;
 
+    static void add_plugin (PluginInfo* info, const PluginCacheEntry& entry);
+
 Q_SIGNALS:
     void exit ();
 
@@ -35,8 +40,14 @@ public Q_SLOTS:
     void managerStop ();
     bool managerStart ();
     bool managerAwake ();
+    QString GetStartupTimeline ();
+    QString GetMainLoopStalls ();
+    QString GetResourceUsage ();
+    int GetLogLevel ();
+    void SetLogLevel (int level);
 
 private:
+    static bool                     mLazy;
     static QList<PluginInfo*>*      mPlugin;
     static PluginManager*           mPluginManager;
 };
@@ -0,0 +1,401 @@
+#include "plugin-trigger.h"
+#include "clib-syslog.h"
+
+#include <QList>
+#include <QTimer>
+#include <QDBusConnection>
+#include <QSocketNotifier>
+#include <QDBusServiceWatcher>
+#include <QDBusConnectionInterface>
+#include <QGSettings/qgsettings.h>
+
+#include <X11/Xlib.h>
+#include <X11/extensions/XInput.h>
+#include <X11/extensions/XInput2.h>
+
+/* NumLock 和 CapsLock 不影响快捷键匹配 */
+#define IGNORED_MODIFIERS       (LockMask | Mod2Mask)
+
+/**
+ * xinput 和 key 类型的触发器共用一个私有的 X 连接，
+ * 由主循环中的 QSocketNotifier 驱动，没有触发器时关闭连接
+ */
+class XTriggerSource
+{
+public:
+    static XTriggerSource* instance ();
+
+    bool addTrigger (PluginTrigger* trigger);
+    void removeTrigger (PluginTrigger* trigger);
+    bool deviceExists (const QString& type);
+
+private:
+    XTriggerSource();
+    ~XTriggerSource();
+
+    bool open ();
+    void close ();
+    void dispatch ();
+    bool grabKey (PluginTrigger* trigger, bool grab);
+
+private:
+    Display*                mDisplay;
+    int                     mXiOpcode;
+    QSocketNotifier*        mNotifier;
+    QList<PluginTrigger*>   mTriggers;
+
+    static XTriggerSource*  mInstance;
+};
+
+XTriggerSource* XTriggerSource::mInstance = nullptr;
+
+static int trap_x_error (Display*, XErrorEvent*)
+{
+    return 0;
+}
+
+static bool parse_accelerator (const QString& accel, unsigned long* keysym, unsigned int* modifiers)
+{
+    QString str = accel.trimmed();
+
+    *keysym = NoSymbol;
+    *modifiers = 0;
+
+    while (str.startsWith("<")) {
+        int end = str.indexOf(">");
+        if (end < 0) return false;
+
+        QString mod = str.mid(1, end - 1).toLower();
+        if (mod == "control" || mod == "ctrl" || mod == "primary") {
+            *modifiers |= ControlMask;
+        } else if (mod == "shift") {
+            *modifiers |= ShiftMask;
+        } else if (mod == "alt" || mod == "mod1") {
+            *modifiers |= Mod1Mask;
+        } else if (mod == "super" || mod == "mod4") {
+            *modifiers |= Mod4Mask;
+        } else {
+            return false;
+        }
+        str = str.mid(end + 1);
+    }
+
+    if (str.isEmpty()) return false;
+    *keysym = XStringToKeysym(str.toLatin1().data());
+
+    return (NoSymbol != *keysym);
+}
+
+XTriggerSource::XTriggerSource()
+{
+    mDisplay = nullptr;
+    mXiOpcode = -1;
+    mNotifier = nullptr;
+}
+
+XTriggerSource::~XTriggerSource()
+{
+    close();
+}
+
+XTriggerSource* XTriggerSource::instance()
+{
+    if (nullptr == mInstance) mInstance = new XTriggerSource;
+
+    return mInstance;
+}
+
+bool XTriggerSource::open()
+{
+    int event, error;
+    int major = 2, minor = 0;
+    XIEventMask evmask;
+    unsigned char mask[XIMaskLen(XI_LASTEVENT)] = {0};
+
+    if (nullptr != mDisplay) return true;
+
+    mDisplay = XOpenDisplay(NULL);
+    if (nullptr == mDisplay) {
+        CT_SYSLOG(LOG_ERR, "unable to open display for plugin triggers");
+        return false;
+    }
+
+    if (XQueryExtension(mDisplay, "XInputExtension", &mXiOpcode, &event, &error)
+            && Success == XIQueryVersion(mDisplay, &major, &minor)) {
+        XISetMask(mask, XI_HierarchyChanged);
+        evmask.deviceid = XIAllDevices;
+        evmask.mask_len = sizeof(mask);
+        evmask.mask = mask;
+        XISelectEvents(mDisplay, DefaultRootWindow(mDisplay), &evmask, 1);
+    } else {
+        CT_SYSLOG(LOG_ERR, "XInput2 is not available, xinput triggers only check at startup");
+        mXiOpcode = -1;
+    }
+    XFlush(mDisplay);
+
+    mNotifier = new QSocketNotifier(ConnectionNumber(mDisplay), QSocketNotifier::Read);
+    QObject::connect(mNotifier, &QSocketNotifier::activated, [this] (int) { dispatch(); });
+
+    return true;
+}
+
+void XTriggerSource::close()
+{
+    if (nullptr != mNotifier) {delete mNotifier; mNotifier = nullptr;}
+    if (nullptr != mDisplay) {XCloseDisplay(mDisplay); mDisplay = nullptr;}
+}
+
+bool XTriggerSource::addTrigger(PluginTrigger* trigger)
+{
+    if (!open()) return false;
+
+    if (PluginTrigger::TRIGGER_KEY == trigger->mType && !grabKey(trigger, true)) {
+        CT_SYSLOG(LOG_ERR, "unable to grab key '%s'", trigger->mArg.toUtf8().data());
+        return false;
+    }
+    mTriggers.append(trigger);
+
+    return true;
+}
+
+void XTriggerSource::removeTrigger(PluginTrigger* trigger)
+{
+    if (!mTriggers.removeOne(trigger)) return;
+
+    if (PluginTrigger::TRIGGER_KEY == trigger->mType) grabKey(trigger, false);
+
+    // removeTrigger() may be called from dispatch(), close the display later
+    if (mTriggers.isEmpty()) {
+        QTimer::singleShot(0, [this] () { if (mTriggers.isEmpty()) close(); });
+    }
+}
+
+bool XTriggerSource::deviceExists(const QString& type)
+{
+    int n = 0;
+    bool found = false;
+
+    if (!open()) return false;
+
+    Atom atom = XInternAtom(mDisplay, type.toUpper().toLatin1().data(), True);
+    if (None == atom) return false;
+
+    XDeviceInfo* devices = XListInputDevices(mDisplay, &n);
+    for (int i = 0; i < n; ++i) {
+        if (devices[i].type == atom) {
+            found = true;
+            break;
+        }
+    }
+    if (nullptr != devices) XFreeDeviceList(devices);
+
+    return found;
+}
+
+bool XTriggerSource::grabKey(PluginTrigger* trigger, bool grab)
+{
+    static const unsigned int ignored[] = {0, LockMask, Mod2Mask, LockMask | Mod2Mask};
+    Window root = DefaultRootWindow(mDisplay);
+
+    KeyCode keycode = XKeysymToKeycode(mDisplay, trigger->mKeySym);
+    if (0 == keycode) return false;
+
+    XErrorHandler old = XSetErrorHandler(trap_x_error);
+    for (unsigned int mod : ignored) {
+        if (grab) {
+            XGrabKey(mDisplay, keycode, trigger->mModifiers | mod, root, True, GrabModeAsync, GrabModeAsync);
+        } else {
+            XUngrabKey(mDisplay, keycode, trigger->mModifiers | mod, root);
+        }
+    }
+    XSync(mDisplay, False);
+    XSetErrorHandler(old);
+
+    return true;
+}
+
+void XTriggerSource::dispatch()
+{
+    XEvent event;
+
+    while (nullptr != mDisplay && XPending(mDisplay)) {
+        XNextEvent(mDisplay, &event);
+
+        QList<PluginTrigger*> triggers = mTriggers;
+        if (KeyPress == event.type) {
+            KeySym keysym = XLookupKeysym(&event.xkey, 0);
+            unsigned int modifiers = event.xkey.state & ~IGNORED_MODIFIERS;
+            for (PluginTrigger* trigger : triggers) {
+                if (PluginTrigger::TRIGGER_KEY == trigger->mType
+                        && keysym == trigger->mKeySym && modifiers == trigger->mModifiers) {
+                    trigger->fire();
+                }
+            }
+        } else if (GenericEvent == event.type && event.xcookie.extension == mXiOpcode) {
+            if (XI_HierarchyChanged == event.xcookie.evtype) {
+                for (PluginTrigger* trigger : triggers) {
+                    if (PluginTrigger::TRIGGER_XINPUT == trigger->mType && trigger->check()) {
+                        trigger->fire();
+                    }
+                }
+            }
+        }
+    }
+}
+
+PluginTrigger::PluginTrigger(int type, const QString& trigger, const QString& arg, const QString& key, QObject* parent) : QObject(parent)
+{
+    mType = type;
+    mFired = false;
+    mStarted = false;
+    mTrigger = trigger;
+    mArg = arg;
+    mKey = key;
+    mKeySym = NoSymbol;
+    mModifiers = 0;
+    mSettings = nullptr;
+    mWatcher = nullptr;
+}
+
+PluginTrigger::~PluginTrigger()
+{
+    stop();
+}
+
+PluginTrigger* PluginTrigger::parse(const QString& trigger, QObject* parent)
+{
+    QString type = trigger.section(':', 0, 0).trimmed().toLower();
+    QString arg = trigger.section(':', 1).trimmed();
+
+    if (arg.isEmpty()) return nullptr;
+
+    if (type == "gsettings") {
+        QString schema = arg.section(':', 0, -2);
+        QString key = arg.section(':', -1);
+        if (schema.isEmpty() || key.isEmpty()) return nullptr;
+        return new PluginTrigger(TRIGGER_GSETTINGS, trigger, schema, key, parent);
+    } else if (type == "dbus") {
+        return new PluginTrigger(TRIGGER_DBUS, trigger, arg, QString(), parent);
+    } else if (type == "xinput") {
+        return new PluginTrigger(TRIGGER_XINPUT, trigger, arg, QString(), parent);
+    } else if (type == "key") {
+        unsigned long keysym;
+        unsigned int modifiers;
+        if (!parse_accelerator(arg, &keysym, &modifiers)) return nullptr;
+        PluginTrigger* t = new PluginTrigger(TRIGGER_KEY, trigger, arg, QString(), parent);
+        t->mKeySym = keysym;
+        t->mModifiers = modifiers;
+        return t;
+    }
+
+    return nullptr;
+}
+
+int PluginTrigger::start()
+{
+    if (mFired) return TRIGGER_READY;
+    if (mStarted) return TRIGGER_WATCHING;
+
+    switch (mType) {
+    case TRIGGER_GSETTINGS:
+        if (!QGSettings::isSchemaInstalled(mArg.toUtf8())) {
+            CT_SYSLOG(LOG_ERR, "trigger '%s', schema is not installed", mTrigger.toUtf8().data());
+            return TRIGGER_FAILED;
+        }
+        mSettings = new QGSettings(mArg.toUtf8(), QByteArray(), this);
+        if (!mSettings->keys().contains(mKey)) {
+            CT_SYSLOG(LOG_ERR, "trigger '%s', key does not exist", mTrigger.toUtf8().data());
+            delete mSettings;
+            mSettings = nullptr;
+            return TRIGGER_FAILED;
+        }
+        connect(mSettings, SIGNAL(changed(QString)), this, SLOT(settingsChangedSlot(QString)));
+        break;
+    case TRIGGER_DBUS:
+        mWatcher = new QDBusServiceWatcher(mArg, QDBusConnection::sessionBus(), QDBusServiceWatcher::WatchForRegistration, this);
+        connect(mWatcher, SIGNAL(serviceRegistered(QString)), this, SLOT(serviceRegisteredSlot(QString)));
+        break;
+    case TRIGGER_XINPUT:
+    case TRIGGER_KEY:
+        if (!XTriggerSource::instance()->addTrigger(this)) return TRIGGER_FAILED;
+        break;
+    default:
+        return TRIGGER_FAILED;
+    }
+    mStarted = true;
+
+    return check() ? TRIGGER_READY : TRIGGER_WATCHING;
+}
+
+void PluginTrigger::stop()
+{
+    if (!mStarted) return;
+    mStarted = false;
+
+    switch (mType) {
+    case TRIGGER_GSETTINGS:
+        if (nullptr != mSettings) {
+            disconnect(mSettings, nullptr, this, nullptr);
+            mSettings->deleteLater();
+            mSettings = nullptr;
+        }
+        break;
+    case TRIGGER_DBUS:
+        if (nullptr != mWatcher) {
+            disconnect(mWatcher, nullptr, this, nullptr);
+            mWatcher->deleteLater();
+            mWatcher = nullptr;
+        }
+        break;
+    case TRIGGER_XINPUT:
+    case TRIGGER_KEY:
+        XTriggerSource::instance()->removeTrigger(this);
+        break;
+    default:
+        break;
+    }
+}
+
+int PluginTrigger::getTriggerType()
+{
+    return mType;
+}
+
+QString& PluginTrigger::getTrigger()
+{
+    return mTrigger;
+}
+
+bool PluginTrigger::check()
+{
+    switch (mType) {
+    case TRIGGER_GSETTINGS:
+        return (nullptr != mSettings) && mSettings->get(mKey).toBool();
+    case TRIGGER_DBUS:
+        return QDBusConnection::sessionBus().interface()->isServiceRegistered(mArg);
+    case TRIGGER_XINPUT:
+        return XTriggerSource::instance()->deviceExists(mArg);
+    default:
+        return false;
+    }
+}
+
+void PluginTrigger::fire()
+{
+    if (mFired) return;
+    mFired = true;
+
+    CT_SYSLOG(LOG_DEBUG, "trigger '%s' fired", mTrigger.toUtf8().data());
+    stop();
+    Q_EMIT triggered();
+}
+
+void PluginTrigger::settingsChangedSlot(const QString& key)
+{
+    if (key == mKey && check()) fire();
+}
+
+void PluginTrigger::serviceRegisteredSlot(const QString& name)
+{
+    if (name == mArg) fire();
+}
@@ -0,0 +1,86 @@
+#ifndef PLUGINTRIGGER_H
+#define PLUGINTRIGGER_H
+
+#include <QObject>
+#include <QString>
+
+class QGSettings;
+class QDBusServiceWatcher;
+
+namespace UkuiSettingsDaemon {
+class PluginTrigger;
+}
+
+/**
+ * 插件延迟加载的触发条件，在插件描述文件中声明:
+ *  Triggers=gsettings:<schema>:<key>;dbus:<name>;xinput:<device type>;key:<accelerator>
+ *
+ * gsettings:   布尔 key 变为 true
+ * dbus:        session bus 上出现该名称
+ * xinput:      出现该类型的输入设备，如 TOUCHPAD、TOUCHSCREEN
+ * key:         按下该快捷键，如 <Control><Alt>t
+ */
+class PluginTrigger : public QObject
+{
+    Q_OBJECT
+public:
+    enum TriggerType {
+        TRIGGER_GSETTINGS,
+        TRIGGER_DBUS,
+        TRIGGER_XINPUT,
+        TRIGGER_KEY
+    };
+
+    enum TriggerState {
+        TRIGGER_FAILED,         // 无法监听，如 schema 未安装、抓取按键失败
+        TRIGGER_WATCHING,
+        TRIGGER_READY           // 条件已经满足
+    };
+
+    explicit PluginTrigger()=delete;
+    ~PluginTrigger();
+
+    /* 解析失败返回 nullptr */
+    static PluginTrigger* parse (const QString& trigger, QObject* parent = nullptr);
+
+    /* 开始监听，返回 TriggerState */
+    int start ();
+    void stop ();
+
+    int getTriggerType ();
+    QString& getTrigger ();
+
+Q_SIGNALS:
+    void triggered ();
+
+private Q_SLOTS:
+    void settingsChangedSlot (const QString& key);
+    void serviceRegisteredSlot (const QString& name);
+
+private:
+    PluginTrigger(int type, const QString& trigger, const QString& arg, const QString& key, QObject* parent);
+    PluginTrigger(PluginTrigger&)=delete;
+    PluginTrigger& operator= (const PluginTrigger&)=delete;
+
+    bool check ();
+    void fire ();
+
+    friend class XTriggerSource;
+
+private:
+    int                     mType;
+    bool                    mFired;
+    bool                    mStarted;
+
+    QString                 mTrigger;
+    QString                 mArg;
+    QString                 mKey;
+
+    unsigned long           mKeySym;
+    unsigned int            mModifiers;
+
+    QGSettings*             mSettings;
+    QDBusServiceWatcher*    mWatcher;
+};
+
+#endif // PLUGINTRIGGER_H
@@ -1,5 +1,7 @@
 #include "a11y-keyboard-manager.h"
 #include "clib-syslog.h"
+#include "startup-trace.h"
+#include "xevent-dispatcher.h"
 #include "config.h"
 
 #define CONFIG_SCHEMA "org.mate.accessibility-keyboard"
@@ -45,14 +47,12 @@ bool A11yKeyboardManager::A11yKeyboardManagerStart()
 void A11yKeyboardManager::A11yKeyboardManagerStop()
 {
    CT_SYSLOG(LOG_DEBUG,"Stoping A11y Keyboard manager");
-   gdk_window_remove_filter (NULL, devicepresence_filter, this);
+   XEventDispatcher::instance()->removeHandler (devicepresence_filter, this);
 
     if (status_icon)
        gtk_status_icon_set_visible (status_icon, FALSE);
 
-    gdk_window_remove_filter (NULL,
-                         (GdkFilterFunc) cb_xkb_event_filter,
-                         this);
+    XEventDispatcher::instance()->removeHandler ((GdkFilterFunc) cb_xkb_event_filter, this);
 
     /* Disable all the AccessX bits
     */
@@ -386,18 +386,11 @@ devicepresence_filter (GdkXEvent *xevent,
                        GdkEvent  *event,
                        gpointer   data)
 {
-        XEvent *xev = (XEvent *) xevent;
-        XEventClass class_presence;
-        int xi_presence;
-
-        DevicePresence (gdk_x11_get_default_xdisplay (), xi_presence, class_presence);
+        // only registered for the DevicePresence event type
+        XDevicePresenceNotifyEvent *dpn = (XDevicePresenceNotifyEvent *) xevent;
 
-        if (xev->type == xi_presence)
-        {
-            XDevicePresenceNotifyEvent *dpn = (XDevicePresenceNotifyEvent *) xev;
-            if (dpn->devchange == DeviceEnabled) {
-                A11yKeyboardManager::set_server_from_settings ((A11yKeyboardManager *)data);
-            }
+        if (dpn->devchange == DeviceEnabled) {
+            A11yKeyboardManager::set_server_from_settings ((A11yKeyboardManager *)data);
         }
         return GDK_FILTER_CONTINUE;
 }
@@ -425,7 +418,8 @@ void A11yKeyboardManager::set_devicepresence_handler (A11yKeyboardManager *manag
 
         gdk_flush ();
         if (!gdk_error_trap_pop ())
-                gdk_window_add_filter (NULL, devicepresence_filter, manager);
+                XEventDispatcher::instance()->addHandler ("a11y-keyboard", "devicepresence_filter", xi_presence,
+                                                          XEVENT_ANY_WINDOW, devicepresence_filter, manager);
 }
 
 GdkFilterReturn cb_xkb_event_filter (GdkXEvent              *xevent,
@@ -488,8 +482,9 @@ void A11yKeyboardManager::set_settings_from_server(A11yKeyboardManager *manager)
     if (! desc) {
             return;
     }
-    settings = new QGSettings(CONFIG_SCHEMA);
-    settings->delay();
+    // one dconf write for all keys, unchanged keys are not written
+    settings = manager->settings;
+    QGSettingsTransaction transaction(settings);
     /*
       fprintf (stderr, "changed to : 0x%x\n", desc->ctrls->enabled_ctrls);
       fprintf (stderr, "changed to : 0x%x (2)\n", desc->ctrls->ax_options);
@@ -585,14 +580,6 @@ void A11yKeyboardManager::set_settings_from_server(A11yKeyboardManager *manager)
     }
 
     XkbFreeKeyboard (desc, XkbAllComponentsMask, True);
-
-    changed |= (stickykeys_changed | slowkeys_changed);
-
-    if (changed) {
-            settings->apply();
-    }
-
-    delete settings;
 }
 
 void A11yKeyboardManager::start_a11y_keyboard_idle_cb()
@@ -600,6 +587,7 @@ void A11yKeyboardManager::start_a11y_keyboard_idle_cb()
     guint event_mask;
 
     CT_SYSLOG(LOG_DEBUG,"Starting a11y_keyboard manager");
+    USD_TRACE_SPAN("idle", "a11y-keyboard");
 
     time->stop();
 
@@ -626,9 +614,8 @@ void A11yKeyboardManager::start_a11y_keyboard_idle_cb()
                      event_mask,
                      event_mask);
 
-    gdk_window_add_filter (NULL,
-                           (GdkFilterFunc) cb_xkb_event_filter,
-                           this);
+    XEventDispatcher::instance()->addHandler ("a11y-keyboard", "cb_xkb_event_filter", xkbEventBase + XkbEventCode,
+                                              XEVENT_ANY_WINDOW, (GdkFilterFunc) cb_xkb_event_filter, this);
 
     maybe_show_status_icon (this);
 
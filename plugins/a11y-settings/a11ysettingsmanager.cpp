@@ -1,5 +1,6 @@
 #include "a11ysettingsmanager.h"
 #include "clib-syslog.h"
+#include "settings-registry.h"
 
 bool start_a11y_keyboard_idle(A11ySettingsManager*);
 
@@ -25,8 +26,8 @@ bool A11ySettingsManager::A11ySettingsManagerStart(GError**)
 {
     //
     CT_SYSLOG(LOG_DEBUG,"Starting a11y_settings manager!");
-    interface_settings=g_settings_new("org.mate.interface");
-    a11y_apps_settings=g_settings_new("org.gnome.desktop.a11y.applications");
+    interface_settings=SettingsRegistry::acquire("org.mate.interface");
+    a11y_apps_settings=SettingsRegistry::acquire("org.gnome.desktop.a11y.applications");
 
     g_signal_connect(G_OBJECT(a11y_apps_settings),"changed",
                      G_CALLBACK(apps_settings_changed),mA11ySettingsManager);
@@ -50,6 +51,8 @@ void A11ySettingsManager::A11ySettingsMAnagerStop()
         interface_settings = nullptr;
     }
     if(a11y_apps_settings){
+        // shared, the object may outlive this manager
+        g_signal_handlers_disconnect_by_func(a11y_apps_settings, (gpointer)apps_settings_changed, mA11ySettingsManager);
         g_object_unref(a11y_apps_settings);
         a11y_apps_settings = nullptr;
     }
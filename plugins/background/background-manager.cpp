@@ -1,5 +1,10 @@
 #include "background-manager.h"
 #include "clib-syslog.h"
+#include "loop-watchdog.h"
+#include "resource-usage.h"
+#include "startup-trace.h"
+#include "settings-registry.h"
+#include "atom-cache.h"
 
 #include <glib.h>
 #include <stdio.h>
@@ -56,7 +61,15 @@ BackgroundManager* BackgroundManager::getInstance()
 
 bool BackgroundManager::managerStart()
 {
-    mSetting = g_settings_new(MATE_BG_SCHEMA);
+    mSetting = SettingsRegistry::acquire(MATE_BG_SCHEMA);
+
+    ResourceUsage::instance()->registerCounter("background", "surface_bytes", this, [this] () -> qint64 {
+        if (nullptr == mSurface || CAIRO_SURFACE_TYPE_IMAGE != cairo_surface_get_type (mSurface)) return 0;
+        return (qint64) cairo_image_surface_get_stride (mSurface) * cairo_image_surface_get_height (mSurface);
+    });
+    ResourceUsage::instance()->registerCounter("background", "surfaces", this, [this] () -> qint64 {
+        return (nullptr != mSurface) + (nullptr != mFade);
+    });
 
     mUsdCanDraw = g_settings_get_boolean (mSetting, MATE_BG_KEY_DRAW_BACKGROUND);
     mPeonyCanDraw = g_settings_get_boolean (mSetting, MATE_BG_KEY_SHOW_DESKTOP);
@@ -79,6 +92,7 @@ bool BackgroundManager::managerStart()
 
 void BackgroundManager::managerStop()
 {
+    ResourceUsage::instance()->unregisterCounters(this);
     if (this->mProxy) {
         disconnect_session_manager_listener (this);
         g_object_unref (mProxy);
@@ -157,6 +171,9 @@ void queue_timeout (BackgroundManager* manager)
 
 bool queue_setup_background (BackgroundManager* manager)
 {
+    USD_TRACE_SPAN("idle", "background");
+    USD_WATCHDOG_SCOPE("background", "setup_background");
+    USD_RESOURCE_SCOPE("background");
     manager->mTimeoutID = 0;
 
     setup_background (manager);
@@ -288,9 +305,8 @@ bool peony_is_drawing_bg (BackgroundManager* manager)
     if (!manager->mPeonyCanDraw)
         return false;
 
-    peonyProp = XInternAtom (display, "PEONY_DESKTOP_WINDOW_ID", True);
-    if (peonyProp == None)
-        return false;
+    // created if peony has not run yet, so the cached atom stays valid when it starts
+    peonyProp = AtomCache::atom (display, "PEONY_DESKTOP_WINDOW_ID");
 
     XGetWindowProperty (display, window, peonyProp, 0, 1, False, XA_WINDOW, &type, &format, &nitems, &after, &data);
     if (data == NULL)
@@ -302,9 +318,7 @@ bool peony_is_drawing_bg (BackgroundManager* manager)
     if (type != XA_WINDOW || format != 32)
         return false;
 
-    wmclassProp = XInternAtom (display, "WM_CLASS", true);
-    if (wmclassProp == None)
-        return false;
+    wmclassProp = XA_WM_CLASS;
 
     gdk_error_trap_push();
 
@@ -328,6 +342,9 @@ bool peony_is_drawing_bg (BackgroundManager* manager)
 
 bool settings_change_event_idle_cb (BackgroundManager* manager)
 {
+    USD_TRACE_SPAN("idle", "background-changed");
+    USD_WATCHDOG_SCOPE("background", "settings_change_event_idle_cb");
+    USD_RESOURCE_SCOPE("background");
     mate_bg_load_from_gsettings (manager->mMateBG, manager->mSetting);
 
     return false;   /* remove from the list of event sources */
@@ -390,6 +407,8 @@ void remove_background (BackgroundManager* manager)
     disconnect_screen_signals (manager);
 
     g_signal_handlers_disconnect_by_func (manager->mSetting, (gpointer)settings_change_event_cb, manager);
+    // the shared object outlives the unref below
+    g_signal_handlers_disconnect_by_func (manager->mSetting, (gpointer)on_bg_handling_changed, manager);
 
     if (nullptr != manager->mSetting) {
         g_object_unref (G_OBJECT (manager->mSetting));
@@ -0,0 +1,110 @@
+#include "clipboard-dbus.h"
+#include "clipboard-history.h"
+#include "clipboard-manager.h"
+#include "clib-syslog.h"
+
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QDBusConnection>
+
+#define HISTORY_PREVIEW_LENGTH          200
+
+ClipboardDBus::ClipboardDBus(ClipboardManager* manager)
+{
+    mRegistered = false;
+    mManager = manager;
+}
+
+ClipboardDBus::~ClipboardDBus()
+{
+    if (mRegistered) QDBusConnection::sessionBus().unregisterObject(USD_CLIPBOARD_DBUS_PATH);
+}
+
+bool ClipboardDBus::registerObject()
+{
+    QDBusConnection bus = QDBusConnection::sessionBus();
+
+    // the service name belongs to the daemon
+    if (!bus.registerObject(USD_CLIPBOARD_DBUS_PATH, this, QDBusConnection::ExportAllSlots | QDBusConnection::ExportAllSignals)) {
+        CT_SYSLOG(LOG_ERR, "register clipboard dbus path error: '%s'", bus.lastError().message().toUtf8().data());
+        return false;
+    }
+    mRegistered = true;
+
+    return true;
+}
+
+static QString history_preview (const ClipboardHistoryEntry& entry)
+{
+    for (const ClipboardHistoryItem& item : entry.items) {
+        if (item.target == "UTF8_STRING" || item.target == "text/plain;charset=utf-8")
+            return QString::fromUtf8(item.data.left(4 * HISTORY_PREVIEW_LENGTH)).left(HISTORY_PREVIEW_LENGTH);
+    }
+    for (const ClipboardHistoryItem& item : entry.items) {
+        if (item.target == "STRING")
+            return QString::fromLatin1(item.data.left(HISTORY_PREVIEW_LENGTH));
+    }
+
+    return QString();
+}
+
+QString ClipboardDBus::GetHistory()
+{
+    QJsonArray list;
+
+    for (const ClipboardHistoryEntry& entry : mManager->history()->entries()) {
+        QJsonObject e;
+        QJsonArray targets;
+        qint64 size = 0;
+        for (const ClipboardHistoryItem& item : entry.items) {
+            targets.append(QString::fromLatin1(item.target));
+            size += item.data.size();
+        }
+        e.insert("id", (qint64) entry.id);
+        e.insert("time", entry.time);
+        e.insert("size", size);
+        e.insert("targets", targets);
+        e.insert("text", history_preview(entry));
+        list.append(e);
+    }
+
+    return QString::fromUtf8(QJsonDocument(list).toJson(QJsonDocument::Compact));
+}
+
+QByteArray ClipboardDBus::GetContent(qulonglong id, const QString& target)
+{
+    ClipboardHistoryEntry entry;
+
+    if (!mManager->history()->entry(id, &entry, false)) return QByteArray();
+
+    for (const ClipboardHistoryItem& item : entry.items) {
+        if (item.target == target.toLatin1()) return item.data;
+    }
+
+    return QByteArray();
+}
+
+bool ClipboardDBus::SetClipboard(qulonglong id)
+{
+    return mManager->restore(id);
+}
+
+bool ClipboardDBus::RemoveEntry(qulonglong id)
+{
+    if (!mManager->history()->remove(id)) return false;
+
+    Q_EMIT HistoryChanged();
+    return true;
+}
+
+void ClipboardDBus::ClearHistory()
+{
+    mManager->history()->clear();
+    Q_EMIT HistoryChanged();
+}
+
+QString ClipboardDBus::GetTransfers()
+{
+    return mManager->transfers();
+}
@@ -0,0 +1,48 @@
+#ifndef CLIPBOARDDBUS_H
+#define CLIPBOARDDBUS_H
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+
+#define USD_CLIPBOARD_DBUS_PATH         "/org/ukui/SettingsDaemon/Clipboard"
+#define USD_CLIPBOARD_DBUS_NAME         "org.ukui.SettingsDaemon.Clipboard"
+
+class ClipboardManager;
+
+/**
+ * 剪贴板历史的 D-Bus 接口，注册在守护进程的服务名下，剪贴板历史工具不必再各自轮询 CLIPBOARD。
+ * GetHistory() 返回 JSON 数组，最近使用的在前:
+ *   [{"id": 3, "time": 毫秒, "size": 字节, "targets": ["UTF8_STRING", ...], "text": "文本预览"}]
+ * 历史变化时发出 HistoryChanged。
+ * GetTransfers() 返回进行中和最近结束的分块发送(INCR)，包括大小、块大小和吞吐量。
+ */
+class ClipboardDBus : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO ("D-Bus Interface", USD_CLIPBOARD_DBUS_NAME)
+
+public:
+    explicit ClipboardDBus(ClipboardManager* manager);
+    ~ClipboardDBus();
+
+    bool registerObject ();
+
+Q_SIGNALS:
+    void HistoryChanged ();
+
+public Q_SLOTS:
+    QString GetHistory ();
+    QByteArray GetContent (qulonglong id, const QString& target);
+    /* 由守护进程重新提供这条记录作为 CLIPBOARD */
+    bool SetClipboard (qulonglong id);
+    bool RemoveEntry (qulonglong id);
+    void ClearHistory ();
+    QString GetTransfers ();
+
+private:
+    bool                    mRegistered;
+    ClipboardManager*       mManager;
+};
+
+#endif // CLIPBOARDDBUS_H
@@ -0,0 +1,185 @@
+#include "clipboard-history.h"
+
+#include <algorithm>
+
+#include <QDateTime>
+#include <QMutexLocker>
+#include <QCryptographicHash>
+
+ClipboardHistory::ClipboardHistory()
+{
+    mMaxBytes = 0;
+    mMaxEntries = 0;
+    mNextId = 1;
+    mBytes = 0;
+    mDuplicates = 0;
+}
+
+ClipboardHistory::~ClipboardHistory()
+{
+    qDeleteAll(mEntries);
+}
+
+void ClipboardHistory::setLimits(qint64 maxBytes, int maxEntries)
+{
+    QMutexLocker locker(&mLock);
+
+    mMaxBytes = maxBytes;
+    mMaxEntries = maxEntries;
+    evict();
+}
+
+quint64 ClipboardHistory::add(const QList<ClipboardHistoryItem>& items)
+{
+    QList<ClipboardHistoryItem> stored = items;
+    QCryptographicHash key(QCryptographicHash::Sha1);
+    qint64 size = 0;
+
+    if (stored.isEmpty()) return 0;
+
+    // the same copy may list its targets in another order
+    std::sort(stored.begin(), stored.end(), [] (const ClipboardHistoryItem& a, const ClipboardHistoryItem& b) {
+        return a.target < b.target;
+    });
+
+    // hashing a large image takes a while, not under the lock
+    for (ClipboardHistoryItem& item : stored) {
+        item.digest = QCryptographicHash::hash(item.data, QCryptographicHash::Sha1);
+        key.addData(item.target);
+        key.addData("\0", 1);
+        key.addData(item.digest);
+        size += item.data.size();
+    }
+
+    QMutexLocker locker(&mLock);
+    if (mMaxEntries <= 0 || size > mMaxBytes) return 0;
+
+    ClipboardHistoryEntry* entry = mByKey.value(key.result());
+    if (nullptr != entry) {
+        mDuplicates++;
+        mEntries.removeOne(entry);
+        mEntries.prepend(entry);
+        entry->time = QDateTime::currentMSecsSinceEpoch();
+        return entry->id;
+    }
+
+    entry = new ClipboardHistoryEntry;
+    entry->id = mNextId++;
+    entry->time = QDateTime::currentMSecsSinceEpoch();
+    entry->key = key.result();
+    for (ClipboardHistoryItem& item : stored) {
+        auto it = mBlobs.find(item.digest);
+        if (it != mBlobs.end()) {
+            // keep the stored copy, the new one is freed with the caller's list
+            it->refs++;
+            item.data = it->data;
+            mDuplicates++;
+        } else {
+            mBlobs.insert(item.digest, Blob{item.data, 1});
+            mBytes += item.data.size();
+        }
+    }
+    entry->items = stored;
+
+    mEntries.prepend(entry);
+    mById.insert(entry->id, entry);
+    mByKey.insert(entry->key, entry);
+    evict();
+
+    return entry->id;
+}
+
+bool ClipboardHistory::entry(quint64 id, ClipboardHistoryEntry* entry, bool touch)
+{
+    QMutexLocker locker(&mLock);
+    ClipboardHistoryEntry* e = mById.value(id);
+
+    if (nullptr == e) return false;
+
+    if (touch) {
+        mEntries.removeOne(e);
+        mEntries.prepend(e);
+        e->time = QDateTime::currentMSecsSinceEpoch();
+    }
+    if (entry) *entry = *e;
+
+    return true;
+}
+
+QList<ClipboardHistoryEntry> ClipboardHistory::entries()
+{
+    QMutexLocker locker(&mLock);
+    QList<ClipboardHistoryEntry> list;
+
+    list.reserve(mEntries.size());
+    for (ClipboardHistoryEntry* e : mEntries) list.append(*e);
+
+    return list;
+}
+
+bool ClipboardHistory::remove(quint64 id)
+{
+    QMutexLocker locker(&mLock);
+    ClipboardHistoryEntry* e = mById.value(id);
+
+    if (nullptr == e) return false;
+
+    mEntries.removeOne(e);
+    release(e);
+
+    return true;
+}
+
+void ClipboardHistory::clear()
+{
+    QMutexLocker locker(&mLock);
+
+    qDeleteAll(mEntries);
+    mEntries.clear();
+    mById.clear();
+    mByKey.clear();
+    mBlobs.clear();
+    mBytes = 0;
+}
+
+qint64 ClipboardHistory::bytes()
+{
+    QMutexLocker locker(&mLock);
+    return mBytes;
+}
+
+int ClipboardHistory::size()
+{
+    QMutexLocker locker(&mLock);
+    return mEntries.size();
+}
+
+qint64 ClipboardHistory::duplicates()
+{
+    QMutexLocker locker(&mLock);
+    return mDuplicates;
+}
+
+/* 调用者持有 mLock 并已从 mEntries 中删除 */
+void ClipboardHistory::release(ClipboardHistoryEntry* entry)
+{
+    for (const ClipboardHistoryItem& item : entry->items) {
+        auto it = mBlobs.find(item.digest);
+        if (it == mBlobs.end()) continue;
+        if (0 == --it->refs) {
+            mBytes -= it->data.size();
+            mBlobs.erase(it);
+        }
+    }
+    mById.remove(entry->id);
+    mByKey.remove(entry->key);
+    delete entry;
+}
+
+void ClipboardHistory::evict()
+{
+    // least recently used at the end
+    while (!mEntries.isEmpty() && (mEntries.size() > mMaxEntries || mBytes > mMaxBytes)) {
+        release(mEntries.takeLast());
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef CLIPBOARDHISTORY_H
+#define CLIPBOARDHISTORY_H
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QByteArray>
+
+struct ClipboardHistoryItem
+{
+    QByteArray                      target;         // target 名，如 UTF8_STRING、image/png
+    QByteArray                      type;           // 属性类型名
+    int                             format;
+    QByteArray                      data;
+    QByteArray                      digest;         // add() 计算
+};
+
+struct ClipboardHistoryEntry
+{
+    quint64                         id;
+    qint64                          time;           // 毫秒，最后一次复制或取用的时间
+    QByteArray                      key;            // 全部 target 和内容的摘要
+    QList<ClipboardHistoryItem>     items;
+};
+
+/**
+ * 剪贴板历史:
+ * 每条记录是 CLIPBOARD 换所有者时取得的一组 target。
+ * 内容按 SHA-1 去重，相同的数据只保存一份；target 和内容都相同的记录合并为一条并移到最前。
+ * 去重后的总字节数或条数超过上限时，按最近最少使用的顺序淘汰。
+ * 剪贴板线程写入，D-Bus 在主线程读取，所有函数线程安全；返回的数据与存储共享，不复制。
+ */
+class ClipboardHistory
+{
+public:
+    ClipboardHistory();
+    ~ClipboardHistory();
+
+    void setLimits (qint64 maxBytes, int maxEntries);
+
+    /* 返回记录 id，单条超过字节上限时不保存并返回 0 */
+    quint64 add (const QList<ClipboardHistoryItem>& items);
+    /* touch 为 true 时记录移到最前 */
+    bool entry (quint64 id, ClipboardHistoryEntry* entry, bool touch);
+    /* 最近使用的在前 */
+    QList<ClipboardHistoryEntry> entries ();
+    bool remove (quint64 id);
+    void clear ();
+
+    qint64 bytes ();
+    int size ();
+    qint64 duplicates ();
+
+private:
+    void release (ClipboardHistoryEntry* entry);
+    void evict ();
+
+private:
+    struct Blob
+    {
+        QByteArray                  data;
+        int                         refs;
+    };
+
+    QMutex                                          mLock;
+    qint64                                          mMaxBytes;
+    int                                             mMaxEntries;
+    quint64                                         mNextId;
+    qint64                                          mBytes;
+    qint64                                          mDuplicates;    // 合并的记录和共用的内容
+    QList<ClipboardHistoryEntry*>                   mEntries;       // 最近使用的在前
+    QHash<quint64, ClipboardHistoryEntry*>          mById;
+    QHash<QByteArray, ClipboardHistoryEntry*>       mByKey;
+    QHash<QByteArray, Blob>                         mBlobs;         // 以内容摘要为键
+};
+
+#endif // CLIPBOARDHISTORY_H
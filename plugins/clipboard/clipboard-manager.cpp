@@ -90,32 +90,77 @@
 #define HAVE_X11_EXTENSIONS_XKB_H 1
 
 #include <glib.h>
+#include <poll.h>
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <gdk/gdk.h>
-#include <gdk/gdkx.h>
 #include <X11/Xlib.h>
 #include <sys/wait.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <X11/Xatom.h>
+#include <X11/extensions/Xfixes.h>
 
 #include "list.h"
 #include "xutils.h"
 #include "clib-syslog.h"
+#include "clipboard-dbus.h"
+#include "resource-usage.h"
+
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+
+/* 历史中保存的 target，按优先顺序 */
+static const char* const history_targets[] = {
+    "UTF8_STRING",
+    "text/plain;charset=utf-8",
+    "STRING",
+    "text/html",
+    "text/uri-list",
+    "x-special/gnome-copied-files",
+    "image/png",
+};
+
+/* 密码管理器等标记为机密的复制，不进入历史 */
+static const char* const concealed_targets[] = {
+    "x-kde-passwordManagerHint",
+    "ExcludeClipboardContentFromMonitorProcessing",
+};
+
+/* 文本只保存其中一份，其余在被请求时转换，见 derive_text_target() */
+static const char* text_targets[] = {
+    "UTF8_STRING",
+    "text/plain;charset=utf-8",
+    "STRING",
+    "TEXT",
+    "text/plain",
+};
+
+/* 可以作为文本副本的 target，没有策略时按此顺序优先 */
+static const char* text_sources[] = {
+    "UTF8_STRING",
+    "text/plain;charset=utf-8",
+    "STRING",
+};
 
 void target_data_unref (TargetData *data);
 int clipboard_bytes_per_item (int format);
 void conversion_free (IncrConversion* rdata);
 TargetData* target_data_ref (TargetData *data);
-int find_content_type (TargetData* tdata, Atom type);
-int find_content_target (TargetData* tdata, Atom target);
+void clear_contents (ClipboardManager* manager);
+void drop_incremental (ClipboardManager* manager, TargetData* tdata);
+TargetData* text_source (ClipboardManager* manager);
+void save_finished (ClipboardManager* manager);
+TargetData* derive_text_target (ClipboardManager* manager, Atom target);
 void convert_clipboard (ClipboardManager* manager, XEvent* xev);
 void get_property (TargetData* tdata, ClipboardManager* manager);
 bool send_incrementally (ClipboardManager* manager, XEvent* xev);
-int find_conversion_requestor (IncrConversion* rdata, XEvent* xev);
+void serve_incrementally (ClipboardManager* manager);
+void conversion_remove (ClipboardManager* manager, quint64 key);
 bool receive_incrementally (ClipboardManager* manager, XEvent* xev);
 void send_selection_notify (ClipboardManager* manager, bool success);
 void convert_clipboard_manager (ClipboardManager* manager, XEvent* xev);
@@ -124,128 +169,767 @@ bool clipboard_manager_process_event(ClipboardManager* manager, XEvent* xev);
 void save_targets (ClipboardManager* manager, Atom* save_targets, int nitems);
 void convert_clipboard_target (IncrConversion* rdata, ClipboardManager* manager);
 void finish_selection_request (ClipboardManager* manager, XEvent* xev, bool success);
-GdkFilterReturn clipboard_manager_event_filter (GdkXEvent* xevent, GdkEvent* event, ClipboardManager* manager);
-void clipboard_manager_watch_cb(ClipboardManager* manager, Window window, bool isStart, long mask, void* cbData);
+
+/* gdk_error_trap_push() only covers the GDK connection */
+static Display*         sTrapDisplay = nullptr;
+static int              sTrapError = Success;
+static XErrorHandler    sPreviousHandler = nullptr;
+
+static int clipboard_error_handler (Display* display, XErrorEvent* error)
+{
+    // requestor windows may be gone at any time, errors on our connection are never fatal
+    if (display == sTrapDisplay) {
+        sTrapError = error->error_code;
+        return 0;
+    }
+
+    return sPreviousHandler ? sPreviousHandler (display, error) : 0;
+}
+
+/* 大的 target 不常驻堆内存: 写入 memfd，接收完成后封印并只读映射，发送过的页面随即从映射中丢弃 */
+static unsigned long spill_size (void)
+{
+    static unsigned long size = 0;
+
+    if (0 == size) {
+        bool ok = false;
+        size = qgetenv(CLIPBOARD_SPILL_SIZE_ENV).toULong(&ok);
+        if (!ok || 0 == size) size = CLIPBOARD_SPILL_SIZE;
+    }
+
+    return size;
+}
+
+static int spill_open (void)
+{
+    int fd = -1;
+
+#ifdef MFD_ALLOW_SEALING
+    fd = memfd_create ("usd-clipboard", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#endif
+    if (fd < 0) {
+        // no memfd, an unlinked file in the runtime dir (usually tmpfs)
+        char* path = g_build_filename (g_get_user_runtime_dir (), "usd-clipboard-XXXXXX", NULL);
+        fd = mkostemp (path, O_CLOEXEC);
+        if (fd >= 0) unlink (path);
+        g_free (path);
+    }
+    if (fd < 0) CT_SYSLOG(LOG_ERR, "create clipboard spill file error: %s", strerror(errno));
+
+    return fd;
+}
+
+static bool spill_write (int fd, const unsigned char* data, unsigned long length)
+{
+    while (length > 0) {
+        ssize_t n = write (fd, data, length);
+        if (n < 0 && EINTR == errno) continue;
+        if (n <= 0) {
+            CT_SYSLOG(LOG_ERR, "write clipboard spill file error: %s", strerror(errno));
+            return false;
+        }
+        data += n;
+        length -= n;
+    }
+
+    return true;
+}
+
+/* 堆中已收到的部分移到 memfd，失败时保持不变 */
+static bool target_data_spill (TargetData* tdata)
+{
+    int fd = spill_open ();
+
+    if (fd < 0) return false;
+    if (!spill_write (fd, tdata->data, tdata->length)) {
+        close (fd);
+        return false;
+    }
+
+    free (tdata->data);
+    tdata->data = NULL;
+    tdata->capacity = 0;
+    tdata->fd = fd;
+
+    return true;
+}
+
+static bool target_data_map (TargetData* tdata)
+{
+    void* data;
+
+    if (0 == tdata->length) {
+        close (tdata->fd);
+        tdata->fd = -1;
+        return true;
+    }
+
+#ifdef F_ADD_SEALS
+    // fails for the file fallback, the mapping is read-only anyway
+    fcntl (tdata->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+    data = mmap (NULL, tdata->length, PROT_READ, MAP_SHARED, tdata->fd, 0);
+    if (MAP_FAILED == data) {
+        CT_SYSLOG(LOG_ERR, "map clipboard spill file error: %s", strerror(errno));
+        return false;
+    }
+    tdata->data = (unsigned char*) data;
+
+    return true;
+}
+
+/* 超过大小上限，释放已收到的部分，剩余的块取走后丢弃 */
+static void target_data_discard (TargetData* tdata)
+{
+    // still receiving, the memfd is not mapped yet
+    if (tdata->fd >= 0) close (tdata->fd);
+    else free (tdata->data);
+
+    tdata->data = NULL;
+    tdata->length = 0;
+    tdata->capacity = 0;
+    tdata->fd = -1;
+    tdata->discard = true;
+}
+
+/* [from, to) 已经发送，丢弃其中完整的页面，再次读取时从 memfd 取回 */
+static void target_data_drop_pages (TargetData* tdata, unsigned long from, unsigned long to)
+{
+    static const unsigned long page = sysconf (_SC_PAGESIZE);
+    unsigned long start = (from + page - 1) / page * page;
+    unsigned long end = to / page * page;
+
+    if (tdata->fd < 0 || end <= start) return;
+
+    madvise (tdata->data + start, end - start, MADV_DONTNEED);
+}
+
+static inline quint64 conversion_key (Window requestor, Atom property)
+{
+    // window ids and atoms have 29 bits
+    return ((quint64) requestor << 32) | (quint32) property;
+}
+
+static void error_trap_push (void)
+{
+    sTrapError = Success;
+}
+
+static int error_trap_pop (Display* display)
+{
+    XSync (display, False);
+    return sTrapError;
+}
 
 ClipboardManager::ClipboardManager(QObject *parent) : QThread(parent)
 {
-    mExit = false;
     mDisplay = nullptr;
-    mContents = nullptr;
-    mConversions = nullptr;
-    gdk_init(NULL, NULL);
-    GdkDisplay* display = gdk_display_get_default();
-    if (nullptr == display) {
-        CT_SYSLOG(LOG_ERR, "get GdkDisplay error");
-        return;
+    mWindow = None;
+    mIncrPending = 0;
+    mMaxChunk = INCR_CHUNK_MIN;
+    mRequestor = None;
+    mDBus = nullptr;
+    mSettings = nullptr;
+    mXfixesEvent = -1;
+    mHistoryWindow = None;
+    mHistoryProperty = None;
+    mCaptureTarget = None;
+    mCaptureIncr = false;
+    if (pipe2(mWakeFd, O_CLOEXEC | O_NONBLOCK) < 0) {
+        CT_SYSLOG(LOG_ERR, "create wake pipe error: %s", strerror(errno));
+        mWakeFd[0] = mWakeFd[1] = -1;
     }
-
-    mDisplay = gdk_x11_display_get_xdisplay(display);
 }
 
 ClipboardManager::~ClipboardManager()
 {
+    managerStop();
+    if (mWakeFd[0] >= 0) close(mWakeFd[0]);
+    if (mWakeFd[1] >= 0) close(mWakeFd[1]);
 }
 
 bool ClipboardManager::managerStart()
 {
+    if (isRunning()) return true;
+    if (mWakeFd[0] < 0) return false;
+
+    // a connection of our own, the worker thread is the only user
+    mDisplay = XOpenDisplay (NULL);
     if (nullptr == mDisplay) {
+        CT_SYSLOG(LOG_ERR, "open X display error");
         return false;
     }
+
+    ResourceUsage::instance()->registerCounter("clipboard", "targets", this, [this] () -> qint64 {
+        return mTargetCount.load();
+    });
+    ResourceUsage::instance()->registerCounter("clipboard", "target_bytes", this, [this] () -> qint64 {
+        return mTargetBytes.load();
+    });
+    ResourceUsage::instance()->registerCounter("clipboard", "conversions", this, [this] () -> qint64 {
+        return mConversionCount.load();
+    });
+    ResourceUsage::instance()->registerCounter("clipboard", "incr_bytes", this, [this] () -> qint64 {
+        return mIncrBytes.load();
+    });
+    ResourceUsage::instance()->registerCounter("clipboard", "incr_transfers", this, [this] () -> qint64 {
+        return mIncrTransfers.load();
+    });
+    ResourceUsage::instance()->registerCounter("clipboard", "spilled_bytes", this, [this] () -> qint64 {
+        return mSpilledBytes.load();
+    });
+    ResourceUsage::instance()->registerCounter("clipboard", "history_entries", this, [this] () -> qint64 {
+        return mHistory.size();
+    });
+    ResourceUsage::instance()->registerCounter("clipboard", "history_bytes", this, [this] () -> qint64 {
+        return mHistory.bytes();
+    });
+    ResourceUsage::instance()->registerCounter("clipboard", "history_duplicates", this, [this] () -> qint64 {
+        return mHistory.duplicates();
+    });
+
+    mSettings = new QGSettings(CLIPBOARD_SCHEMA);
+    connect(mSettings, &QGSettings::changed, this, [this] (const QString&) {
+        applySettings();
+    });
+    applySettings();
+
+    // history is still kept without the dbus interface
+    mDBus = new ClipboardDBus(this);
+    if (!mDBus->registerObject()) {
+        delete mDBus;
+        mDBus = nullptr;
+    }
+
     start(QThread::LowestPriority);
     return true;
 }
 
-bool ClipboardManager::managerStop()
+void ClipboardManager::applySettings()
 {
-    clipboard_manager_watch_cb (this, mWindow, FALSE, 0, NULL);
-    XDestroyWindow (mDisplay, mWindow);
+    bool enabled = mSettings->get(KEY_HISTORY_ENABLED).toBool();
+    qint64 maxBytes = (qint64) mSettings->get(KEY_HISTORY_SIZE).toInt() * 1024 * 1024;
+
+    // no entries allowed clears the history
+    mHistoryEnabled.store(enabled ? 1 : 0);
+    mHistoryMaxBytes.store(maxBytes);
+    mHistory.setLimits(maxBytes, enabled ? mSettings->get(KEY_HISTORY_ITEMS).toInt() : 0);
+
+    ClipboardPolicy policy;
+    for (const QString& target : mSettings->get(KEY_SAVE_TARGETS).toStringList()) {
+        policy.targets.append(target.toUtf8());
+    }
+    for (const QString& limit : mSettings->get(KEY_SAVE_SIZE_LIMITS).toStringList()) {
+        bool ok = false;
+        int eq = limit.lastIndexOf('=');
+        unsigned long kib = eq > 0 ? limit.mid(eq + 1).toULong(&ok) : 0;
+        if (!ok) {
+            CT_SYSLOG(LOG_WARNING, "ignore clipboard size limit '%s'", limit.toUtf8().constData());
+            continue;
+        }
+        policy.limits.append(qMakePair(limit.left(eq).toUtf8(), kib * 1024));
+    }
+
+    // read by save_targets() on the clipboard thread
+    QMutexLocker locker(&mPolicyLock);
+    mPolicy = policy;
+}
+
+bool ClipboardManager::restore(quint64 id)
+{
+    if (!isRunning() || !mHistory.entry(id, nullptr, false)) return false;
+
+    mRestoreId.store(id);
+    if (write(mWakeFd[1], "r", 1) < 0 && errno != EAGAIN) {
+        CT_SYSLOG(LOG_ERR, "wake clipboard thread error: %s", strerror(errno));
+        return false;
+    }
 
-    list_foreach (mConversions, (Callback) conversion_free, NULL);
-    list_free (mConversions);
+    return true;
+}
+
+bool ClipboardManager::managerStop()
+{
+    ResourceUsage::instance()->unregisterCounters(this);
+    if (isRunning()) {
+        requestInterruption();
+        if (write(mWakeFd[1], "q", 1) < 0 && errno != EAGAIN) {
+            CT_SYSLOG(LOG_ERR, "wake clipboard thread error: %s", strerror(errno));
+        }
+        wait();
+    }
 
-    list_foreach (mContents, (Callback) target_data_unref, NULL);
-    list_free (mContents);
+    // queued HistoryChanged signals are dropped with the object
+    delete mDBus;
+    mDBus = nullptr;
+    delete mSettings;
+    mSettings = nullptr;
 
-    mExit = true;
-    QThread::exit(0);
     return true;
 }
 
 void ClipboardManager::run()
 {
-    while (!mExit) {
-        XClientMessageEvent xev;
-        if (nullptr == mDisplay) {
-            return;
+    ResourceUsage::instance()->registerThread("clipboard");
+    if (setup()) run_loop();
+    cleanup();
+    ResourceUsage::instance()->unregisterThread();
+}
+
+bool ClipboardManager::setup()
+{
+    XClientMessageEvent xev;
+
+    sTrapDisplay = mDisplay;
+    sPreviousHandler = XSetErrorHandler (clipboard_error_handler);
+
+    init_atoms (mDisplay);
+    /* check if there is a clipboard manager running */
+    if (XGetSelectionOwner (mDisplay, XA_CLIPBOARD_MANAGER)) {
+        CT_SYSLOG(LOG_ERR, "Clipboard manager is already running.");
+        return false;
+    }
+
+    clear_contents (this);
+    mRequestor = None;
+
+    // the request length is counted in 4 byte units, leave room for the ChangeProperty header
+    long maxRequest = XExtendedMaxRequestSize (mDisplay);
+    if (0 == maxRequest) maxRequest = XMaxRequestSize (mDisplay);
+    mMaxChunk = MIN ((unsigned long) maxRequest * 4 - 100, (unsigned long) INCR_CHUNK_MAX);
+    mMaxChunk = MAX (mMaxChunk, (unsigned long) INCR_CHUNK_MIN);
+
+    mWindow = XCreateSimpleWindow (mDisplay,
+              DefaultRootWindow (mDisplay), 0, 0, 10, 10, 0,
+              WhitePixel (mDisplay, DefaultScreen (mDisplay)),
+              WhitePixel (mDisplay, DefaultScreen (mDisplay)));
+
+    XSelectInput (mDisplay, mWindow, PropertyChangeMask);
+    mTimestamp = get_server_time (mDisplay, mWindow);
+
+    XSetSelectionOwner (mDisplay, XA_CLIPBOARD_MANAGER, mWindow, mTimestamp);
+
+    /* Check to see if we managed to claim the selection. If not, we treat it as if we got it then immediately lost it */
+    if (XGetSelectionOwner (mDisplay, XA_CLIPBOARD_MANAGER) != mWindow) {
+        CT_SYSLOG(LOG_ERR, "claim CLIPBOARD_MANAGER selection failed");
+        return false;
+    }
+
+    xev.type = ClientMessage;
+    xev.window = DefaultRootWindow (mDisplay);
+    xev.message_type = XA_MANAGER;
+    xev.format = 32;
+    xev.data.l[0] = mTimestamp;
+    xev.data.l[1] = XA_CLIPBOARD_MANAGER;
+    xev.data.l[2] = mWindow;
+    xev.data.l[3] = 0;      /* manager specific data */
+    xev.data.l[4] = 0;      /* manager specific data */
+
+    XSendEvent (mDisplay, DefaultRootWindow (mDisplay), False, StructureNotifyMask, (XEvent *)&xev);
+
+    // history is optional, the SAVE_TARGETS handoff works without XFixes
+    int xfixesError;
+    if (XFixesQueryExtension (mDisplay, &mXfixesEvent, &xfixesError)) {
+        mHistoryWindow = XCreateSimpleWindow (mDisplay,
+                         DefaultRootWindow (mDisplay), 0, 0, 10, 10, 0,
+                         WhitePixel (mDisplay, DefaultScreen (mDisplay)),
+                         WhitePixel (mDisplay, DefaultScreen (mDisplay)));
+        XSelectInput (mDisplay, mHistoryWindow, PropertyChangeMask);
+        mHistoryProperty = internAtom ("_USD_CLIPBOARD_HISTORY");
+        XFixesSelectSelectionInput (mDisplay, mHistoryWindow, XA_CLIPBOARD, XFixesSetSelectionOwnerNotifyMask);
+    } else {
+        CT_SYSLOG(LOG_WARNING, "XFixes is not available, clipboard history disabled");
+        mXfixesEvent = -1;
+    }
+
+    return true;
+}
+
+void ClipboardManager::run_loop()
+{
+    struct pollfd fds[2];
+    int timeout;
+
+    while (!isInterruptionRequested()) {
+        // XPending() flushes the requests and reads what the socket already has,
+        // events may also be read while a large chunk is written
+        do {
+            while (XPending (mDisplay)) {
+                XEvent xev;
+                XNextEvent (mDisplay, &xev);
+                USD_RESOURCE_SCOPE("clipboard");
+                clipboard_manager_process_event (this, &xev);
+            }
+            USD_RESOURCE_SCOPE("clipboard");
+            serve_incrementally (this);
+        } while (XPending (mDisplay));
+        updateUsage();
+
+        fds[0].fd = mWakeFd[0];
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd = ConnectionNumber (mDisplay);
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+        // only an owner that does not answer a capture needs a timeout
+        timeout = -1;
+        if (None != mCaptureTarget)
+            timeout = (int) MAX (0, (mCaptureDeadline - g_get_monotonic_time ()) / 1000 + 1);
+        if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+            CT_SYSLOG(LOG_ERR, "poll error: %s", strerror(errno));
+            break;
         }
-        init_atoms (mDisplay);
-        /* check if there is a clipboard manager running */
-        if (XGetSelectionOwner (mDisplay, XA_CLIPBOARD_MANAGER)) {
-            CT_SYSLOG(LOG_ERR, "Clipboard manager is already running.");
-            mExit = false;
-            return;
+
+        if (fds[0].revents & POLLIN) {
+            char buf[64];
+            while (read(mWakeFd[0], buf, sizeof(buf)) > 0);
+            quint64 id = mRestoreId.fetchAndStoreOrdered(0);
+            if (0 != id) restoreEntry (id);
         }
+        if (None != mCaptureTarget && g_get_monotonic_time () >= mCaptureDeadline) {
+            CT_SYSLOG(LOG_DEBUG, "clipboard owner did not answer, keep %d targets", mCaptureItems.size());
+            captureFinish ();
+        }
+        if (fds[1].revents & (POLLERR | POLLHUP)) {
+            CT_SYSLOG(LOG_ERR, "X connection closed");
+            break;
+        }
+    }
+}
 
-        mContents = nullptr;
-        mConversions = nullptr;
-        mRequestor = None;
-        mWindow = XCreateSimpleWindow (mDisplay,
-                  DefaultRootWindow (mDisplay), 0, 0, 10, 10, 0,
-                  WhitePixel (mDisplay, DefaultScreen (mDisplay)),
-                  WhitePixel (mDisplay, DefaultScreen (mDisplay)));
+void ClipboardManager::cleanup()
+{
+    XErrorHandler handler;
 
-        clipboard_manager_watch_cb (this, mWindow, True, PropertyChangeMask, NULL);
+    if (None != mWindow) {
+        XDestroyWindow (mDisplay, mWindow);
+        mWindow = None;
+    }
+    captureAbort ();
+    if (None != mHistoryWindow) {
+        XDestroyWindow (mDisplay, mHistoryWindow);
+        mHistoryWindow = None;
+    }
+    mXfixesEvent = -1;
+    mAtoms.clear();
+    mAtomNames.clear();
+
+    while (!mConversions.isEmpty()) conversion_remove (this, mConversions.constBegin().key());
+    mReady.clear();
+
+    clear_contents (this);
+    mRequestor = None;
+    updateUsage();
+
+    // closing the connection also gives up the selections
+    XCloseDisplay (mDisplay);
+    mDisplay = nullptr;
+
+    // keep a handler installed after ours, it still chains to sPreviousHandler
+    sTrapDisplay = nullptr;
+    handler = XSetErrorHandler (sPreviousHandler);
+    if (handler != clipboard_error_handler) XSetErrorHandler (handler);
+}
+
+void ClipboardManager::updateUsage()
+{
+    qint64 bytes = 0;
+    qint64 spilled = 0;
+
+    for (TargetData* tdata : mContents) {
+        bytes += tdata->length;
+        if (tdata->fd >= 0) spilled += tdata->length;
+    }
+    mTargetCount.store(mContents.size());
+    mTargetBytes.store(bytes);
+    mSpilledBytes.store(spilled);
+    mConversionCount.store(mConversions.size());
+}
+
+QString ClipboardManager::transfers()
+{
+    QMutexLocker locker(&mTransferLock);
+    QList<ClipboardTransfer> list = mTransfers.values() + mTransferLog;
+    QJsonArray array;
+    gint64 now = g_get_monotonic_time ();
+
+    for (const ClipboardTransfer& t : list) {
+        QJsonObject o;
+        gint64 time = (t.end ? t.end : now) - t.start;
+        o.insert("requestor", QString("0x%1").arg((qulonglong) t.requestor, 0, 16));
+        o.insert("target", QString::fromLatin1(t.target));
+        o.insert("state", 0 == t.end ? "running" : (t.sent >= t.size ? "done" : "aborted"));
+        o.insert("size", t.size);
+        o.insert("sent", t.sent);
+        o.insert("chunk", (qint64) t.chunk);
+        o.insert("ms", (qint64) time / 1000);
+        o.insert("bytes_per_sec", time > 0 ? t.sent * G_USEC_PER_SEC / (qint64) time : (qint64) 0);
+        array.append(o);
+    }
+
+    return QString::fromUtf8(QJsonDocument(array).toJson(QJsonDocument::Compact));
+}
+
+Atom ClipboardManager::internAtom(const QByteArray& name)
+{
+    auto it = mAtoms.constFind(name);
+    if (it != mAtoms.constEnd()) return it.value();
 
-        XSelectInput (mDisplay, mWindow, PropertyChangeMask);
-        mTimestamp = get_server_time (mDisplay, mWindow);
+    Atom atom = XInternAtom (mDisplay, name.constData(), False);
+    mAtoms.insert(name, atom);
+    mAtomNames.insert(atom, name);
+
+    return atom;
+}
+
+QByteArray ClipboardManager::atomName(Atom atom)
+{
+    auto it = mAtomNames.constFind(atom);
+    if (it != mAtomNames.constEnd()) return it.value();
+
+    char* name = XGetAtomName (mDisplay, atom);
+    QByteArray n = name ? QByteArray(name) : QByteArray();
+    if (name) XFree (name);
+    mAtoms.insert(n, atom);
+    mAtomNames.insert(atom, n);
+
+    return n;
+}
+
+/* 一次请求取得缓存中没有的 atom 名字 */
+void ClipboardManager::atomNames(const Atom* atoms, int count)
+{
+    int             i, n;
+    Atom*           missing;
+    char**          names;
+
+    missing = (Atom *) malloc (count * sizeof (Atom));
+    for (i = 0, n = 0; i < count; ++i) {
+        if (None != atoms[i] && !mAtomNames.contains (atoms[i])) missing[n++] = atoms[i];
+    }
+    if (0 == n) {
+        free (missing);
+        return;
+    }
+
+    names = (char **) calloc (n, sizeof (char*));
+    error_trap_push ();
+    XGetAtomNames (mDisplay, missing, n, names);
+    error_trap_pop (mDisplay);
+
+    // an invalid atom is left to atomName()
+    for (i = 0; i < n; ++i) {
+        if (!names[i]) continue;
+        QByteArray name (names[i]);
+        mAtoms.insert(name, missing[i]);
+        mAtomNames.insert(missing[i], name);
+        XFree (names[i]);
+    }
+    free (names);
+    free (missing);
+}
+
+/* mHistoryWindow 上的事件 */
+bool ClipboardManager::captureEvent(XEvent* xev)
+{
+    Atom                type;
+    int                 format;
+    unsigned long       nitems;
+    unsigned long       remaining;
+    unsigned char*      data = nullptr;
+
+    if (xev->type == mXfixesEvent + XFixesSelectionNotify) {
+        XFixesSelectionNotifyEvent* ev = (XFixesSelectionNotifyEvent*) xev;
+        // our own owner serves a copy that is saved already
+        if (ev->selection == XA_CLIPBOARD && None != ev->owner && mWindow != ev->owner)
+            captureStart (ev->selection_timestamp);
+        return true;
+    }
 
-        XSetSelectionOwner (mDisplay, XA_CLIPBOARD_MANAGER, mWindow, mTimestamp);
+    switch (xev->type) {
+    case SelectionNotify:
+        // answer to a conversion that was given up
+        if (xev->xselection.target != mCaptureTarget || mCaptureIncr) break;
+        if (None == xev->xselection.property) {
+            if (XA_TARGETS == mCaptureTarget) captureAbort (); else captureNext ();
+            break;
+        }
 
-        /* Check to see if we managed to claim the selection. If not, we treat it as if we got it then immediately lost it */
-        if (XGetSelectionOwner (mDisplay, XA_CLIPBOARD_MANAGER) == mWindow) {
-            xev.type = ClientMessage;
-            xev.window = DefaultRootWindow (mDisplay);
-            xev.message_type = XA_MANAGER;
-            xev.format = 32;
-            xev.data.l[0] = mTimestamp;
-            xev.data.l[1] = XA_CLIPBOARD_MANAGER;
-            xev.data.l[2] = mWindow;
-            xev.data.l[3] = 0;      /* manager specific data */
-            xev.data.l[4] = 0;      /* manager specific data */
+        XGetWindowProperty (mDisplay, mHistoryWindow, mHistoryProperty, 0, 0x1FFFFFFF, True, AnyPropertyType,
+                            &type, &format, &nitems, &remaining, &data);
+        if (XA_TARGETS == mCaptureTarget) {
+            if (XA_ATOM == type && 32 == format) captureTargets ((Atom*) data, nitems); else captureAbort ();
+        } else if (XA_INCR == type) {
+            // deleting the property above asked for the first chunk
+            mCaptureIncr = true;
+            mCaptureBuffer.clear();
+            mCaptureDeadline = g_get_monotonic_time () + CLIPBOARD_CAPTURE_TIMEOUT;
+        } else if (None != type) {
+            captureItem (type, format, QByteArray((const char*) data, nitems * clipboard_bytes_per_item (format)));
+            captureNext ();
+        } else {
+            captureNext ();
+        }
+        if (data) XFree (data);
+        break;
+    case PropertyNotify:
+        if (!mCaptureIncr || xev->xproperty.atom != mHistoryProperty || PropertyNewValue != xev->xproperty.state) break;
 
-            XSendEvent (mDisplay, DefaultRootWindow (mDisplay), False, StructureNotifyMask, (XEvent *)&xev);
+        XGetWindowProperty (mDisplay, mHistoryWindow, mHistoryProperty, 0, 0x1FFFFFFF, True, AnyPropertyType,
+                            &type, &format, &nitems, &remaining, &data);
+        if (0 == nitems) {
+            captureItem (type, format, mCaptureBuffer);
+            captureNext ();
         } else {
-            clipboard_manager_watch_cb (this, mWindow, False, 0, NULL);
-            /* FIXME: manager->priv->terminate (manager->priv->cb_data); */
+            mCaptureBuffer.append((const char*) data, nitems * clipboard_bytes_per_item (format));
+            mCaptureDeadline = g_get_monotonic_time () + CLIPBOARD_CAPTURE_TIMEOUT;
+            // larger than the whole history, the owner is left to time out
+            // on the property, so no other target is converted into it
+            if ((qint64) mCaptureBuffer.size() > mHistoryMaxBytes.load()) {
+                captureAbort ();
+            }
         }
+        if (data) XFree (data);
+        break;
+    default: ;
     }
+
+    return true;
 }
 
-void clipboard_manager_watch_cb(ClipboardManager* manager, Window window, bool isStart, long, void*)
+void ClipboardManager::captureStart(Time time)
 {
-    GdkWindow*                  gdkwin;
-    GdkDisplay*                 display;
+    captureAbort ();
+    if (!mHistoryEnabled.load()) return;
 
-    display = gdk_display_get_default ();
-    gdkwin = gdk_x11_window_lookup_for_display (display, window);
+    mCaptureTime = time;
+    captureConvert (XA_TARGETS);
+}
 
-    if (isStart) {
-        if (gdkwin == NULL) {
-            gdkwin = gdk_x11_window_foreign_new_for_display (display, window);
-        } else {
-            g_object_ref (gdkwin);
+void ClipboardManager::captureConvert(Atom target)
+{
+    mCaptureTarget = target;
+    mCaptureIncr = false;
+    mCaptureDeadline = g_get_monotonic_time () + CLIPBOARD_CAPTURE_TIMEOUT;
+    XConvertSelection (mDisplay, XA_CLIPBOARD, target, mHistoryProperty, mHistoryWindow, mCaptureTime);
+}
+
+void ClipboardManager::captureTargets(Atom* targets, unsigned long nitems)
+{
+    mCaptureTargets.clear();
+    for (unsigned int i = 0; i < G_N_ELEMENTS (concealed_targets); ++i) {
+        Atom atom = internAtom (concealed_targets[i]);
+        for (unsigned long j = 0; j < nitems; ++j) {
+            if (targets[j] == atom) {
+                CT_SYSLOG(LOG_DEBUG, "clipboard offers %s, not kept in history", concealed_targets[i]);
+                captureAbort ();
+                return;
+            }
         }
+    }
 
-        gdk_window_add_filter (gdkwin, (GdkFilterFunc)clipboard_manager_event_filter, manager);
-    } else {
-        if (gdkwin == NULL) {
-            return;
+    for (unsigned int i = 0; i < G_N_ELEMENTS (history_targets); ++i) {
+        Atom atom = internAtom (history_targets[i]);
+        for (unsigned long j = 0; j < nitems; ++j) {
+            if (targets[j] == atom) {
+                mCaptureTargets.append(atom);
+                break;
+            }
         }
+    }
+
+    captureNext ();
+}
+
+void ClipboardManager::captureItem(Atom type, int format, const QByteArray& data)
+{
+    ClipboardHistoryItem item;
+
+    if (data.isEmpty()) return;
+
+    item.target = atomName (mCaptureTarget);
+    item.type = atomName (type);
+    item.format = format;
+    item.data = data;
+    mCaptureItems.append(item);
+}
+
+void ClipboardManager::captureNext()
+{
+    mCaptureIncr = false;
+    mCaptureBuffer.clear();
 
-        gdk_window_remove_filter (gdkwin, (GdkFilterFunc)clipboard_manager_event_filter, manager);
-        g_object_unref (gdkwin);
+    if (mCaptureTargets.isEmpty()) {
+        captureFinish ();
+        return;
     }
+
+    captureConvert (mCaptureTargets.takeFirst());
+}
+
+void ClipboardManager::captureFinish()
+{
+    if (!mCaptureItems.isEmpty() && 0 != mHistory.add(mCaptureItems) && mDBus) {
+        QMetaObject::invokeMethod(mDBus, "HistoryChanged", Qt::QueuedConnection);
+    }
+
+    captureAbort ();
+}
+
+void ClipboardManager::captureAbort()
+{
+    mCaptureTarget = None;
+    mCaptureIncr = false;
+    mCaptureBuffer.clear();
+    mCaptureTargets.clear();
+    mCaptureItems.clear();
+}
+
+/* 把历史记录作为 mContents 提供，与保存的 SAVE_TARGETS 内容一样转换 */
+void ClipboardManager::restoreEntry(quint64 id)
+{
+    ClipboardHistoryEntry entry;
+
+    if (None != mRequestor) {
+        CT_SYSLOG(LOG_DEBUG, "clipboard is being saved, ignore history entry %llu", (unsigned long long) id);
+        return;
+    }
+    if (!mHistory.entry(id, &entry, true)) return;
+
+    captureAbort ();
+    clear_contents (this);
+    for (const ClipboardHistoryItem& item : entry.items) {
+        TargetData* tdata = (TargetData *) malloc (sizeof (TargetData));
+        tdata->length = item.data.size();
+        tdata->capacity = item.data.size() + 1;
+        tdata->data = (unsigned char*) malloc (tdata->capacity);
+        memcpy (tdata->data, item.data.constData(), item.data.size() + 1);
+        tdata->target = internAtom (item.target);
+        tdata->type = internAtom (item.type);
+        tdata->format = item.format;
+        tdata->fd = -1;
+        tdata->limit = 0;
+        tdata->discard = false;
+        tdata->refcount = 1;
+        mContents.insert(tdata->target, tdata);
+    }
+
+    mTime = get_server_time (mDisplay, mWindow);
+    XSetSelectionOwner (mDisplay, XA_CLIPBOARD, mWindow, mTime);
+    if (XGetSelectionOwner (mDisplay, XA_CLIPBOARD) != mWindow) {
+        CT_SYSLOG(LOG_ERR, "claim CLIPBOARD selection failed");
+        clear_contents (this);
+    }
+    if (mDBus) QMetaObject::invokeMethod(mDBus, "HistoryChanged", Qt::QueuedConnection);
+}
+
+void clear_contents (ClipboardManager* manager)
+{
+    for (TargetData* tdata : manager->mContents) target_data_unref (tdata);
+    manager->mContents.clear();
+    manager->mDerived.clear();
+    manager->mTextSources.clear();
+    manager->mIncrPending = 0;
 }
 
 void conversion_free (IncrConversion* rdata)
@@ -260,18 +944,22 @@ void target_data_unref (TargetData *data)
 {
     data->refcount--;
     if (data->refcount == 0) {
-        free (data->data);
+        if (data->fd >= 0) {
+            if (data->data) munmap (data->data, data->length);
+            close (data->fd);
+        } else {
+            free (data->data);
+        }
         free (data);
     }
 }
 
-GdkFilterReturn clipboard_manager_event_filter (GdkXEvent* xevent, GdkEvent*, ClipboardManager* manager)
+/* 分块接收失败的 target 不再保存 */
+void drop_incremental (ClipboardManager* manager, TargetData* tdata)
 {
-    if (clipboard_manager_process_event (manager, (XEvent *)xevent)) {
-        return GDK_FILTER_REMOVE;
-    } else {
-        return GDK_FILTER_CONTINUE;
-    }
+    manager->mContents.remove (tdata->target);
+    target_data_unref (tdata);
+    if (0 == --manager->mIncrPending) save_finished (manager);
 }
 
 bool clipboard_manager_process_event(ClipboardManager* manager, XEvent* xev)
@@ -284,15 +972,19 @@ bool clipboard_manager_process_event(ClipboardManager* manager, XEvent* xev)
 
     targets = nullptr;
 
+    if (None != manager->mHistoryWindow && xev->xany.window == manager->mHistoryWindow)
+        return manager->captureEvent (xev);
+
     switch (xev->xany.type) {
     case DestroyNotify:
         if (xev->xdestroywindow.window == manager->mRequestor) {
-            list_foreach (manager->mContents, (Callback)target_data_unref, nullptr);
-            list_free (manager->mContents);
-            manager->mContents = nullptr;
-            clipboard_manager_watch_cb (manager, manager->mRequestor, false, 0, nullptr);
+            clear_contents (manager);
             manager->mRequestor = None;
         }
+        for (IncrConversion* rdata : manager->mConversions.values()) {
+            if (rdata->requestor == xev->xdestroywindow.window)
+                conversion_remove (manager, conversion_key (rdata->requestor, rdata->property));
+        }
         break;
     case PropertyNotify:
         if (xev->xproperty.state == PropertyNewValue) {
@@ -304,10 +996,8 @@ bool clipboard_manager_process_event(ClipboardManager* manager, XEvent* xev)
         if (xev->xany.window != manager->mWindow) return false;
         if (xev->xselectionclear.selection == XA_CLIPBOARD_MANAGER) {
             /* We lost the manager selection */
-            if (manager->mContents) {
-                list_foreach (manager->mContents, (Callback)target_data_unref, nullptr);
-                list_free (manager->mContents);
-                manager->mContents = nullptr;
+            if (!manager->mContents.isEmpty()) {
+                clear_contents (manager);
                 XSetSelectionOwner (manager->mDisplay, XA_CLIPBOARD, None, manager->mTime);
             }
 
@@ -316,10 +1006,7 @@ bool clipboard_manager_process_event(ClipboardManager* manager, XEvent* xev)
 
         if (xev->xselectionclear.selection == XA_CLIPBOARD) {
             /* We lost the clipboard selection */
-            list_foreach (manager->mContents, (Callback)target_data_unref, nullptr);
-            list_free (manager->mContents);
-            manager->mContents = nullptr;
-            clipboard_manager_watch_cb (manager, manager->mRequestor, false, 0, nullptr);
+            clear_contents (manager);
             manager->mRequestor = None;
             return true;
         }
@@ -334,11 +1021,9 @@ bool clipboard_manager_process_event(ClipboardManager* manager, XEvent* xev)
                             0, 0x1FFFFFFF, True, XA_ATOM, &type, &format, &nitems, &remaining, (unsigned char **) &targets);
                 save_targets (manager, targets, nitems);
             } else if (xev->xselection.property == XA_MULTIPLE) {
-                List *tmp;
-
-                tmp = list_copy (manager->mContents);
-                list_foreach (tmp, (Callback) get_property, manager);
-                list_free (tmp);
+                // get_property() removes the targets that were not converted
+                const QList<TargetData*> contents = manager->mContents.values();
+                for (TargetData* tdata : contents) get_property (tdata, manager);
 
                 manager->mTime = xev->xselection.time;
                 XSetSelectionOwner (manager->mDisplay, XA_CLIPBOARD, manager->mWindow, manager->mTime);
@@ -347,15 +1032,10 @@ bool clipboard_manager_process_event(ClipboardManager* manager, XEvent* xev)
                     XChangeProperty (manager->mDisplay, manager->mRequestor, manager->mProperty,
                                      XA_ATOM, 32, PropModeReplace, (unsigned char *)&XA_NULL, 1);
 
-                if (!list_find (manager->mContents, (ListFindFunc)find_content_type, (void *)XA_INCR)) {
-                    /* all transfers done */
-                    send_selection_notify (manager, True);
-                    clipboard_manager_watch_cb (manager, manager->mRequestor, false, 0, nullptr);
-                    manager->mRequestor = None;
-                }
+                /* all transfers done */
+                if (0 == manager->mIncrPending) save_finished (manager);
             } else if (xev->xselection.property == None) {
                 send_selection_notify (manager, false);
-                clipboard_manager_watch_cb (manager, manager->mRequestor, false, 0, nullptr);
                 manager->mRequestor = None;
             }
             return true;
@@ -381,7 +1061,6 @@ bool clipboard_manager_process_event(ClipboardManager* manager, XEvent* xev)
 
 bool receive_incrementally (ClipboardManager* manager, XEvent* xev)
 {
-    List*                       list;
     TargetData*                 tdata;
     Atom                        type;
     int                         format;
@@ -390,59 +1069,209 @@ bool receive_incrementally (ClipboardManager* manager, XEvent* xev)
 
     if (xev->xproperty.window != manager->mWindow) return false;
 
-    list = list_find (manager->mContents, (ListFindFunc) find_content_target, (void *) xev->xproperty.atom);
-    if (!list) return false;
-    tdata = (TargetData *) list->data;
-    if (tdata->type != XA_INCR) return false;
+    tdata = manager->mContents.value (xev->xproperty.atom);
+    if (!tdata || tdata->type != XA_INCR) return false;
     XGetWindowProperty (xev->xproperty.display, xev->xproperty.window, xev->xproperty.atom, 0, 0x1FFFFFFF, True, AnyPropertyType, &type, &format, &nitems, &remaining, &data);
     length = nitems * clipboard_bytes_per_item (format);
+    if (tdata->discard) {
+        // the owner waits for every chunk to be taken before it exits
+        XFree (data);
+        if (length == 0) drop_incremental (manager, tdata);
+        return True;
+    }
     if (length == 0) {
+        XFree (data);
+        if (tdata->fd >= 0 && !target_data_map (tdata)) {
+            drop_incremental (manager, tdata);
+            return True;
+        }
         tdata->type = type;
         tdata->format = format;
-        if (!list_find (manager->mContents, (ListFindFunc) find_content_type, (void *)XA_INCR)) {
-            /* all incremental transfers done */
-            send_selection_notify (manager, True);
-            manager->mRequestor = None;
+        // give back what the doubling over-allocated
+        if (tdata->fd < 0 && tdata->data && tdata->capacity > tdata->length + 1) {
+            tdata->data = (unsigned char*) realloc (tdata->data, tdata->length + 1);
+            tdata->capacity = tdata->length + 1;
         }
+        /* all incremental transfers done */
+        if (0 == --manager->mIncrPending) save_finished (manager);
+    } else if (tdata->fd >= 0) {
+        bool ok = spill_write (tdata->fd, data, length);
         XFree (data);
+        if (!ok) {
+            drop_incremental (manager, tdata);
+            return True;
+        }
+        tdata->length += length;
     } else {
         if (!tdata->data) {
+            /* Xlib allocates one more byte for the terminating NUL */
             tdata->data = data;
             tdata->length = length;
+            tdata->capacity = length + 1;
         } else {
-            tdata->data = (unsigned char*)realloc (tdata->data, tdata->length + length + 1);
+            // grow by doubling, a large transfer is copied a constant number of times
+            if (tdata->length + length + 1 > (unsigned long) tdata->capacity) {
+                unsigned long capacity = 2 * (unsigned long) tdata->capacity;
+                if (capacity < tdata->length + length + 1) capacity = tdata->length + length + 1;
+                tdata->data = (unsigned char*) realloc (tdata->data, capacity);
+                tdata->capacity = capacity;
+            }
             memcpy (tdata->data + tdata->length, data, length + 1);
             tdata->length += length;
             XFree (data);
         }
     }
+
+    if (length != 0 && tdata->limit && (unsigned long) tdata->length > tdata->limit) {
+        CT_SYSLOG(LOG_DEBUG, "clipboard target '%s' exceeds %lu bytes, not saved",
+                  manager->atomName (tdata->target).constData(), tdata->limit);
+        target_data_discard (tdata);
+    } else if (length != 0 && tdata->fd < 0 && (unsigned long) tdata->length > spill_size ()) {
+        // stays on the heap when the spill file cannot be written
+        target_data_spill (tdata);
+    }
     return True;
 }
 
+/* 请求方删除了属性，取走了上一块 */
 bool send_incrementally (ClipboardManager* manager, XEvent* xev)
 {
-    List*                               list;
+    quint64                             key;
+    gint64                              ack;
+    IncrConversion*                     rdata;
+
+    key = conversion_key (xev->xproperty.window, xev->xproperty.atom);
+    rdata = manager->mConversions.value (key);
+    if (rdata == NULL) return false;
+    if (rdata->ready) return true;
+
+    // a requestor that keeps up gets larger chunks, fewer round-trips for the same data
+    ack = g_get_monotonic_time () - rdata->sent;
+    if (ack < INCR_FAST_ACK)
+        rdata->chunk = MIN (2 * rdata->chunk, manager->mMaxChunk);
+    else if (ack > INCR_SLOW_ACK)
+        rdata->chunk = MAX (rdata->chunk / 2, (unsigned long) INCR_CHUNK_MIN);
+
+    rdata->ready = true;
+    manager->mReady.enqueue (key);
+
+    return true;
+}
+
+/* 每个就绪的请求方发送一块，按取走上一块的先后顺序 */
+void serve_incrementally (ClipboardManager* manager)
+{
+    int                                 n;
+    int                                 bytes;
+    quint64                             key;
     unsigned long                       length;
     unsigned long                       items;
     unsigned char*                      data;
     IncrConversion*                     rdata;
 
-    list = list_find (manager->mConversions, (ListFindFunc) find_conversion_requestor, xev);
-    if (list == NULL) return false;
-    rdata = (IncrConversion *) list->data;
-    data = rdata->data->data + rdata->offset;
-    length = rdata->data->length - rdata->offset;
-    if (length > SELECTION_MAX_SIZE) length = SELECTION_MAX_SIZE;
-    rdata->offset += length;
-    items = length / clipboard_bytes_per_item (rdata->data->format);
-    XChangeProperty (manager->mDisplay, rdata->requestor, rdata->property, rdata->data->type, rdata->data->format, PropModeAppend, data, items);
+    // requestors that become ready meanwhile wait for the next round
+    for (n = manager->mReady.size(); n > 0; --n) {
+        key = manager->mReady.dequeue ();
+        rdata = manager->mConversions.value (key);
+        if (rdata == NULL || !rdata->ready) continue;
 
-    if (length == 0) {
-        manager->mConversions = list_remove (manager->mConversions, rdata);
-        conversion_free (rdata);
+        bytes = clipboard_bytes_per_item (rdata->data->format);
+        if (0 == bytes) {
+            conversion_remove (manager, key);
+            continue;
+        }
+        data = rdata->data->data + rdata->offset;
+        length = rdata->data->length - rdata->offset;
+        if (length > rdata->chunk) length = rdata->chunk / bytes * bytes;
+        items = length / bytes;
+        XChangeProperty (manager->mDisplay, rdata->requestor, rdata->property, rdata->data->type, rdata->data->format, PropModeAppend, data, items);
+        rdata->offset += length;
+        // Xlib has copied or written the chunk
+        target_data_drop_pages (rdata->data, rdata->offset - length, rdata->offset);
+
+        rdata->ready = false;
+        rdata->sent = g_get_monotonic_time ();
+        manager->mIncrBytes.fetchAndAddRelaxed (length);
+
+        if (length == 0) {
+            conversion_remove (manager, key);
+        } else {
+            QMutexLocker locker(&manager->mTransferLock);
+            ClipboardTransfer& t = manager->mTransfers[key];
+            t.sent = rdata->offset;
+            t.chunk = rdata->chunk;
+        }
     }
+}
 
-    return true;
+/* 结束一个分块发送，完成、请求方窗口销毁或被同一属性上的新请求替换 */
+void conversion_remove (ClipboardManager* manager, quint64 key)
+{
+    IncrConversion* rdata = manager->mConversions.take (key);
+    ClipboardTransfer t;
+
+    if (rdata == NULL) return;
+
+    {
+        QMutexLocker locker(&manager->mTransferLock);
+        t = manager->mTransfers.take (key);
+        t.sent = rdata->offset;
+        t.end = g_get_monotonic_time ();
+        manager->mTransferLog.prepend (t);
+        while (manager->mTransferLog.size() > INCR_TRANSFER_LOG) manager->mTransferLog.removeLast ();
+    }
+    if (t.sent >= t.size) manager->mIncrTransfers.ref ();
+
+    CT_SYSLOG(LOG_DEBUG, "INCR to 0x%lx %s: %lld of %lld bytes in %lld ms, last chunk %lu",
+              rdata->requestor, t.target.constData(), t.sent, t.size, (long long) (t.end - t.start) / 1000, t.chunk);
+
+    // still in mReady if it was waiting, skipped there
+    conversion_free (rdata);
+}
+
+static bool policy_match (const QList<QByteArray>& patterns, const QByteArray& name)
+{
+    for (const QByteArray& pattern : patterns) {
+        if (g_pattern_match_simple (pattern.constData(), name.constData())) return true;
+    }
+
+    return false;
+}
+
+static unsigned long policy_limit (const ClipboardPolicy& policy, const QByteArray& name)
+{
+    for (const auto& limit : policy.limits) {
+        if (g_pattern_match_simple (limit.first.constData(), name.constData())) return limit.second;
+    }
+
+    return 0;
+}
+
+static bool text_target (const QByteArray& name)
+{
+    for (const char* target : text_targets) {
+        if (name == target) return true;
+    }
+
+    return false;
+}
+
+/* 可以作为文本副本的 target 在 names 中的位置，按策略中的顺序 */
+static QList<int> text_source_order (const ClipboardPolicy& policy, const QList<QByteArray>& names)
+{
+    QList<QByteArray> order = policy.targets;
+    QList<int> indexes;
+
+    if (order.isEmpty()) order.append ("*");
+    for (const QByteArray& pattern : order) {
+        for (const char* source : text_sources) {
+            if (!g_pattern_match_simple (pattern.constData(), source)) continue;
+            int i = names.indexOf (source);
+            if (i >= 0 && !indexes.contains (i)) indexes.append (i);
+        }
+    }
+
+    return indexes;
 }
 
 void save_targets (ClipboardManager* manager, Atom* save_targets, int nitems)
@@ -450,28 +1279,53 @@ void save_targets (ClipboardManager* manager, Atom* save_targets, int nitems)
     int                                 nout, i;
     Atom                                *multiple;
     TargetData                          *tdata;
+    ClipboardPolicy                     policy;
+    QList<QByteArray>                   names;
+
+    {
+        QMutexLocker locker (&manager->mPolicyLock);
+        policy = manager->mPolicy;
+    }
+
+    // one round-trip for all names, browsers offer a dozen targets
+    manager->atomNames (save_targets, nitems);
+    for (i = 0; i < nitems; i++) names.append (manager->atomName (save_targets[i]));
+    for (int t : text_source_order (policy, names)) {
+        if (!manager->mTextSources.contains (save_targets[t])) manager->mTextSources.append (save_targets[t]);
+    }
 
     multiple = (Atom *) malloc (2 * nitems * sizeof (Atom));
 
     nout = 0;
     for (i = 0; i < nitems; i++) {
-            if (save_targets[i] != XA_TARGETS &&
-                save_targets[i] != XA_MULTIPLE &&
-                save_targets[i] != XA_DELETE &&
-                save_targets[i] != XA_INSERT_PROPERTY &&
-                save_targets[i] != XA_INSERT_SELECTION &&
-                save_targets[i] != XA_PIXMAP) {
-                    tdata = (TargetData *) malloc (sizeof (TargetData));
-                    tdata->data = NULL;
-                    tdata->length = 0;
-                    tdata->target = save_targets[i];
-                    tdata->type = None;
-                    tdata->format = 0;
-                    tdata->refcount = 1;
-                    manager->mContents = list_prepend (manager->mContents, tdata);
-                    multiple[nout++] = save_targets[i];
-                    multiple[nout++] = save_targets[i];
-            }
+        if (save_targets[i] == XA_TARGETS ||
+            save_targets[i] == XA_MULTIPLE ||
+            save_targets[i] == XA_DELETE ||
+            save_targets[i] == XA_INSERT_PROPERTY ||
+            save_targets[i] == XA_INSERT_SELECTION ||
+            save_targets[i] == XA_PIXMAP ||
+            manager->mContents.contains (save_targets[i]))
+            continue;
+        if (!policy.targets.isEmpty () && !policy_match (policy.targets, names[i])) continue;
+
+        // still requested in case the preferred copy fails, save_finished() keeps one
+        if (!manager->mTextSources.isEmpty () && text_target (names[i]) && !manager->mDerived.contains (save_targets[i]))
+            manager->mDerived.append (save_targets[i]);
+
+        tdata = (TargetData *) malloc (sizeof (TargetData));
+        tdata->data = NULL;
+        tdata->length = 0;
+        tdata->capacity = 0;
+        tdata->fd = -1;
+        tdata->limit = policy_limit (policy, names[i]);
+        tdata->discard = false;
+        tdata->target = save_targets[i];
+        tdata->type = None;
+        tdata->format = 0;
+        tdata->refcount = 1;
+        manager->mContents.insert (tdata->target, tdata);
+        multiple[nout++] = save_targets[i];
+        multiple[nout++] = save_targets[i];
     }
 
     XFree (save_targets);
@@ -493,25 +1347,37 @@ void get_property (TargetData* tdata, ClipboardManager* manager)
     XGetWindowProperty (manager->mDisplay, manager->mWindow, tdata->target, 0, 0x1FFFFFFF, true, AnyPropertyType, &type, &format, &length, &remaining, &data);
 
     if (type == None) {
-        manager->mContents = list_remove (manager->mContents, tdata);
+        manager->mContents.remove (tdata->target);
         free (tdata);
     } else if (type == XA_INCR) {
         tdata->type = type;
         tdata->length = 0;
+        manager->mIncrPending++;
+        // the INCR value is a lower bound of the size
+        if (tdata->limit && format == 32 && length == 1 && (unsigned long) ((long*) data)[0] > tdata->limit)
+            tdata->discard = true;
         XFree (data);
+    } else if (tdata->limit && length * clipboard_bytes_per_item (format) > tdata->limit) {
+        CT_SYSLOG(LOG_DEBUG, "clipboard target '%s' exceeds %lu bytes, not saved",
+                  manager->atomName (tdata->target).constData(), tdata->limit);
+        manager->mContents.remove (tdata->target);
+        XFree (data);
+        free (tdata);
     } else {
         tdata->type = type;
         tdata->data = data;
         tdata->length = length * clipboard_bytes_per_item (format);
+        tdata->capacity = tdata->length + 1;
         tdata->format = format;
+        // one property can be as large as the server's maximum request, keep the heap copy if spilling fails
+        if (tdata->length > spill_size () && target_data_spill (tdata) && !target_data_map (tdata)) {
+            close (tdata->fd);
+            manager->mContents.remove (tdata->target);
+            free (tdata);
+        }
     }
 }
 
-int find_content_type (TargetData* tdata, Atom type)
-{
-    return tdata->type == type;
-}
-
 void send_selection_notify (ClipboardManager* manager, bool success)
 {
     XSelectionEvent notify;
@@ -526,10 +1392,9 @@ void send_selection_notify (ClipboardManager* manager, bool success)
     notify.property = success ? manager->mProperty : None;
     notify.time = manager->mTime;
 
-    gdk_error_trap_push ();
+    error_trap_push ();
     XSendEvent (manager->mDisplay, manager->mRequestor, false, NoEventMask, (XEvent *)&notify);
-    XSync (manager->mDisplay, false);
-    gdk_error_trap_pop_ignored ();
+    error_trap_pop (manager->mDisplay);
 }
 
 void convert_clipboard_manager (ClipboardManager* manager, XEvent* xev)
@@ -541,22 +1406,20 @@ void convert_clipboard_manager (ClipboardManager* manager, XEvent* xev)
     Atom         *targets = NULL;
 
     if (xev->xselectionrequest.target == XA_SAVE_TARGETS) {
-        if (manager->mRequestor != None || manager->mContents != nullptr) {
+        if (manager->mRequestor != None || !manager->mContents.isEmpty()) {
             /* We're in the middle of a conversion request, or own the CLIPBOARD already */
             finish_selection_request (manager, xev, False);
         } else {
-            gdk_error_trap_push ();
-            clipboard_manager_watch_cb (manager, xev->xselectionrequest.requestor, true, StructureNotifyMask, nullptr);
+            error_trap_push ();
             XSelectInput (manager->mDisplay, xev->xselectionrequest.requestor, StructureNotifyMask);
-            XSync (manager->mDisplay, false);
 
-            if (gdk_error_trap_pop () != Success) return;
-            gdk_error_trap_push ();
+            if (error_trap_pop (manager->mDisplay) != Success) return;
+            error_trap_push ();
 
             if (xev->xselectionrequest.property != None) {
                 XGetWindowProperty (manager->mDisplay, xev->xselectionrequest.requestor, xev->xselectionrequest.property,
                                     0, 0x1FFFFFFF, False, XA_ATOM, &type, &format, &nitems, &remaining, (unsigned char **) &targets);
-                if (gdk_error_trap_pop () != Success) {
+                if (error_trap_pop (manager->mDisplay) != Success) {
                     if (targets) XFree (targets);
                     return;
                 }
@@ -672,15 +1535,9 @@ void finish_selection_request (ClipboardManager* manager, XEvent* xev, bool succ
     notify.property = success ? xev->xselectionrequest.property : None;
     notify.time = xev->xselectionrequest.time;
 
-    gdk_error_trap_push ();
+    error_trap_push ();
     XSendEvent (xev->xselectionrequest.display, xev->xselectionrequest.requestor, false, NoEventMask, (XEvent *) &notify);
-    XSync (manager->mDisplay, false);
-    gdk_error_trap_pop_ignored ();
-}
-
-int find_content_target (TargetData* tdata, Atom target)
-{
-    return tdata->target == target;
+    error_trap_pop (manager->mDisplay);
 }
 
 int clipboard_bytes_per_item (int format)
@@ -695,9 +1552,79 @@ int clipboard_bytes_per_item (int format)
     return 0;
 }
 
-int find_conversion_requestor (IncrConversion* rdata, XEvent* xev)
+/* 按策略顺序第一个收齐的文本副本，都没有收到时返回 NULL */
+TargetData* text_source (ClipboardManager* manager)
 {
-    return (rdata->requestor == xev->xproperty.window && rdata->property == xev->xproperty.atom);
+    for (Atom atom : manager->mTextSources) {
+        TargetData* tdata = manager->mContents.value (atom);
+        if (tdata && tdata->type != XA_INCR) return tdata;
+    }
+
+    return NULL;
+}
+
+/* 所有 target 收齐: 文本只保留一份，其余文本 target 在请求时由它转换 */
+void save_finished (ClipboardManager* manager)
+{
+    TargetData* source = text_source (manager);
+
+    if (source) {
+        for (Atom atom : manager->mDerived) {
+            if (atom == source->target) continue;
+            // a running conversion holds its own reference
+            TargetData* tdata = manager->mContents.take (atom);
+            if (tdata) target_data_unref (tdata);
+        }
+        manager->mDerived.removeOne (source->target);
+    } else {
+        // nothing to convert from, serve what arrived
+        manager->mDerived.clear ();
+    }
+
+    send_selection_notify (manager, True);
+    manager->mRequestor = None;
+}
+
+/* 由文本副本转换出没有保存的文本 target，结果放入 mContents 供以后的请求使用 */
+TargetData* derive_text_target (ClipboardManager* manager, Atom target)
+{
+    TargetData*         source;
+    TargetData*         tdata;
+    QByteArray          text;
+    QString             str;
+    Atom                type;
+
+    if (!manager->mDerived.contains (target)) return NULL;
+    source = text_source (manager);
+    if (!source) return NULL;
+
+    text = QByteArray::fromRawData ((const char*) source->data, source->length);
+    str = source->target == XA_STRING ? QString::fromLatin1 (text) : QString::fromUtf8 (text);
+
+    // TEXT lets the owner choose the encoding
+    type = target;
+    if (target == XA_STRING) {
+        text = str.toLatin1 ();
+    } else {
+        text = str.toUtf8 ();
+        if (target == manager->internAtom ("TEXT")) type = manager->internAtom ("UTF8_STRING");
+    }
+
+    tdata = (TargetData *) malloc (sizeof (TargetData));
+    tdata->length = text.size ();
+    tdata->capacity = text.size () + 1;
+    tdata->data = (unsigned char*) malloc (tdata->capacity);
+    memcpy (tdata->data, text.constData (), text.size () + 1);
+    tdata->fd = -1;
+    tdata->limit = 0;
+    tdata->discard = false;
+    tdata->target = target;
+    tdata->type = type;
+    tdata->format = 8;
+    tdata->refcount = 1;
+    manager->mContents.insert (target, tdata);
+
+    return tdata;
 }
 
 void convert_clipboard_target (IncrConversion* rdata, ClipboardManager* manager)
@@ -705,12 +1632,11 @@ void convert_clipboard_target (IncrConversion* rdata, ClipboardManager* manager)
     TargetData       *tdata;
     Atom             *targets;
     int               n_targets;
-    List             *list;
     unsigned long     items;
     XWindowAttributes atts;
 
     if (rdata->target == XA_TARGETS) {
-        n_targets = list_length (manager->mContents) + 2;
+        n_targets = manager->mContents.size() + manager->mDerived.size() + 2;
         targets = (Atom *) malloc (n_targets * sizeof (Atom));
 
         n_targets = 0;
@@ -718,21 +1644,25 @@ void convert_clipboard_target (IncrConversion* rdata, ClipboardManager* manager)
         targets[n_targets++] = XA_TARGETS;
         targets[n_targets++] = XA_MULTIPLE;
 
-        for (list = manager->mContents; list; list = list->next) {
-                tdata = (TargetData *) list->data;
-                targets[n_targets++] = tdata->target;
+        for (auto it = manager->mContents.constBegin(); it != manager->mContents.constEnd(); ++it) {
+                targets[n_targets++] = it.key();
+        }
+        if (text_source (manager)) {
+            for (Atom atom : manager->mDerived) {
+                if (!manager->mContents.contains (atom)) targets[n_targets++] = atom;
+            }
         }
 
         XChangeProperty (manager->mDisplay, rdata->requestor, rdata->property, XA_ATOM, 32, PropModeReplace, (unsigned char *) targets, n_targets);
         free (targets);
     } else  {
         /* Convert from stored CLIPBOARD data */
-        list = list_find (manager->mContents, (ListFindFunc) find_content_target, (void *) rdata->target);
+        tdata = manager->mContents.value (rdata->target);
+        if (!tdata) tdata = derive_text_target (manager, rdata->target);
 
         /* We got a target that we don't support */
-        if (!list) return;
+        if (!tdata) return;
 
-        tdata = (TargetData *)list->data;
         if (tdata->type == XA_INCR) {
             /* we haven't completely received this target yet  */
             rdata->property = None;
@@ -747,24 +1677,44 @@ void convert_clipboard_target (IncrConversion* rdata, ClipboardManager* manager)
             /* start incremental transfer */
             rdata->offset = 0;
 
-            gdk_error_trap_push ();
+            error_trap_push ();
 
             XGetWindowAttributes (manager->mDisplay, rdata->requestor, &atts);
-            XSelectInput (manager->mDisplay, rdata->requestor, atts.your_event_mask | PropertyChangeMask);
+            // StructureNotifyMask to forget the transfer when the requestor goes away
+            XSelectInput (manager->mDisplay, rdata->requestor, atts.your_event_mask | PropertyChangeMask | StructureNotifyMask);
 
             XChangeProperty (manager->mDisplay, rdata->requestor, rdata->property,
                              XA_INCR, 32, PropModeReplace, (unsigned char *) &items, 1);
-            XSync (manager->mDisplay, False);
-            gdk_error_trap_pop_ignored ();
+            error_trap_pop (manager->mDisplay);
         }
     }
 }
 
 void collect_incremental (IncrConversion* rdata, ClipboardManager* manager)
 {
-    if (rdata->offset >= 0)
-        manager->mConversions = list_prepend (manager->mConversions, rdata);
-    else {
+    if (rdata->offset >= 0) {
+        quint64 key = conversion_key (rdata->requestor, rdata->property);
+        ClipboardTransfer t;
+
+        // the requestor reuses the property, the old transfer cannot finish
+        conversion_remove (manager, key);
+
+        rdata->chunk = MAX ((unsigned long) INCR_CHUNK_MIN, MIN (SELECTION_MAX_SIZE, manager->mMaxChunk));
+        rdata->ready = false;
+        rdata->start = g_get_monotonic_time ();
+        rdata->sent = rdata->start;
+        manager->mConversions.insert (key, rdata);
+
+        t.requestor = rdata->requestor;
+        t.target = manager->atomName (rdata->target);
+        t.size = rdata->data->length;
+        t.sent = 0;
+        t.chunk = rdata->chunk;
+        t.start = rdata->start;
+        t.end = 0;
+        QMutexLocker locker(&manager->mTransferLock);
+        manager->mTransfers.insert (key, t);
+    } else {
         if (rdata->data) {
             target_data_unref (rdata->data);
             rdata->data = NULL;
@@ -1,18 +1,46 @@
 #ifndef CLIPBOARDMANAGER_H
 #define CLIPBOARDMANAGER_H
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QMutex>
+#include <QQueue>
 #include <QThread>
+#include <QAtomicInteger>
 
 #include "list.h"
+#include "clipboard-history.h"
+#include "QGSettings/qgsettings.h"
 
 #include <glib.h>
-#include <gdk/gdk.h>
-#include <gdk/gdkx.h>
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 
+#define CLIPBOARD_SCHEMA                "org.ukui.SettingsDaemon.plugins.clipboard"
+#define KEY_HISTORY_ENABLED             "history-enabled"
+#define KEY_HISTORY_SIZE                "history-size"          // MiB
+#define KEY_HISTORY_ITEMS               "history-items"
+#define KEY_SAVE_TARGETS                "save-targets"
+#define KEY_SAVE_SIZE_LIMITS            "save-size-limits"      // "模式=KiB"
+
+#define CLIPBOARD_SPILL_SIZE            (1024 * 1024)           // 分块接收超过该字节数的 target 存入 memfd
+#define CLIPBOARD_SPILL_SIZE_ENV        "USD_CLIPBOARD_SPILL_SIZE"
+#define INCR_CHUNK_MIN                  (64 * 1024)
+#define INCR_CHUNK_MAX                  (8 * 1024 * 1024)       // 同时不超过服务器的最大请求
+#define INCR_FAST_ACK                   (10 * 1000)             // 微秒，请求方这么快取走一块时块大小加倍
+#define INCR_SLOW_ACK                   (100 * 1000)            // 微秒，超过时块大小减半
+#define INCR_TRANSFER_LOG               16                      // GetTransfers 保留的已结束传输
+#define CLIPBOARD_CAPTURE_TIMEOUT       (2 * G_USEC_PER_SEC)    // 所有者不回应时放弃，已取得的 target 仍然保存
+
+class ClipboardDBus;
+
 typedef struct
 {
     int                         length;
+    int                         capacity;       // 分块接收(INCR)时 data 的容量，按倍数增长
+    int                         fd;             // >= 0 时内容在 memfd 中，接收完成后 data 是只读映射
+    unsigned long               limit;          // 字节上限，0 不限制
+    bool                        discard;        // 超过上限，继续取走剩余的块但不保存
     int                         format;
     int                         refcount;
     Atom                        target;
@@ -27,8 +55,43 @@ typedef struct
     Atom                        property;
     Window                      requestor;
     TargetData*                 data;
+    unsigned long               chunk;          // 下一块的字节数，按请求方取走的快慢调整
+    bool                        ready;          // 请求方已删除属性，等待下一块
+    gint64                      start;
+    gint64                      sent;           // 上一块发出的时间
 } IncrConversion;
 
+/* 程序退出时保存哪些 target，见 save_targets() */
+struct ClipboardPolicy
+{
+    QList<QByteArray>                           targets;        // 模式，空时保存全部
+    QList<QPair<QByteArray, unsigned long>>     limits;         // 模式和字节上限，第一个匹配的生效
+};
+
+/* 分块发送(INCR)的统计，见 ClipboardManager::transfers() */
+struct ClipboardTransfer
+{
+    Window                      requestor;
+    QByteArray                  target;
+    qint64                      size;
+    qint64                      sent;
+    unsigned long               chunk;
+    gint64                      start;
+    gint64                      end;            // 进行中为 0
+};
+
+/**
+ * 剪贴板管理:
+ * 使用自己的 X 连接，所有事件(SelectionRequest、PropertyNotify、INCR 传输)都在工作线程中处理，
+ * 空闲时阻塞在连接的 socket 上，不占用 CPU。managerStop() 通过 mWakeFd 唤醒并等待线程结束。
+ * 剪贴板历史: 通过 XFixes 得知 CLIPBOARD 换了所有者，在 mHistoryWindow 上取得文本、图片等 target
+ * 存入 ClipboardHistory，见 ClipboardDBus。默认关闭；提供密码管理器标记(concealed_targets)的复制不保存。
+ * 分块发送: 以 (请求方窗口, 属性) 为键，请求方取走一块后进入就绪队列，每轮给每个就绪的请求方发一块，
+ * 多个程序同时粘贴同一大内容时轮流进行；块大小在 INCR_CHUNK_MIN 和服务器最大请求之间自适应。
+ * 保存策略: 只取 save-targets 中的 target，超过 save-size-limits 的不保存；
+ * 文本 target 都请求，收齐后只保留按策略顺序第一个收到的一份(UTF8_STRING 等)，
+ * STRING、TEXT 等在被请求时由它转换；首选的一份失败时仍有其他文本可用。
+ */
 class ClipboardManager : public QThread
 {
     Q_OBJECT
@@ -41,19 +104,95 @@ public:
     bool managerStop ();
     void run() override;
 
+    ClipboardHistory* history () { return &mHistory; }
+    /* 可在任意线程调用，由剪贴板线程重新提供这条记录 */
+    bool restore (quint64 id);
+    /* 进行中和最近结束的分块发送，JSON 数组，可在任意线程调用 */
+    QString transfers ();
+
 private:
-    bool                    mExit;
+    bool setup ();
+    void cleanup ();
+    void run_loop ();
+    void updateUsage ();
+    void applySettings ();
+
+    bool captureEvent (XEvent* xev);
+    void captureStart (Time time);
+    void captureConvert (Atom target);
+    void captureTargets (Atom* targets, unsigned long nitems);
+    void captureItem (Atom type, int format, const QByteArray& data);
+    void captureNext ();
+    void captureFinish ();
+    void captureAbort ();
+    void restoreEntry (quint64 id);
+    Atom internAtom (const QByteArray& name);
+    QByteArray atomName (Atom atom);
+    void atomNames (const Atom* atoms, int count);
+
+private:
+    int                     mWakeFd[2];
     Display*                mDisplay;
     Window                  mWindow;
     Time                    mTimestamp;
 
-    List*                   mContents;
-    List*                   mConversions;
+    QHash<Atom, TargetData*>    mContents;      // 以 target 为键
+    int                     mIncrPending;   // mContents 中还在分块接收的 target 个数
+    QHash<quint64, IncrConversion*> mConversions;   // 见 conversion_key()
+    QQueue<quint64>         mReady;         // 等待下一块的分块发送，先取走的先发
+    unsigned long           mMaxChunk;
+
+    QMutex                  mTransferLock;
+    QHash<quint64, ClipboardTransfer>   mTransfers;
+    QList<ClipboardTransfer>            mTransferLog;   // 最近结束的在前
 
     Window                  mRequestor;
     Atom                    mProperty;
     Time                    mTime;
 
+    /* GetResourceUsage 在主线程读取 */
+    QAtomicInteger<qint64>  mTargetCount;
+    QAtomicInteger<qint64>  mTargetBytes;
+    QAtomicInteger<qint64>  mConversionCount;
+    QAtomicInteger<qint64>  mSpilledBytes;
+    QAtomicInteger<qint64>  mIncrBytes;
+    QAtomicInteger<qint64>  mIncrTransfers;
+
+    ClipboardHistory        mHistory;
+    ClipboardDBus*          mDBus;
+    QGSettings*             mSettings;
+    QAtomicInt              mHistoryEnabled;
+    QAtomicInteger<qint64>  mHistoryMaxBytes;
+
+    QMutex                  mPolicyLock;
+    ClipboardPolicy         mPolicy;
+    QList<Atom>             mDerived;       // 所有者提供的文本 target，保存完成后除副本外都由副本转换
+    QList<Atom>             mTextSources;   // 可以作为文本副本的 target，按策略顺序
+    QAtomicInteger<quint64> mRestoreId;     // 主线程请求、剪贴板线程处理
+
+    /* 以下只在剪贴板线程中使用 */
+    int                     mXfixesEvent;   // XFixes 事件号，-1 时没有历史
+    Window                  mHistoryWindow;
+    Atom                    mHistoryProperty;
+    QList<Atom>             mCaptureTargets;    // 还要取得的 target
+    Atom                    mCaptureTarget;     // 正在取得的 target，None 时空闲
+    Time                    mCaptureTime;
+    gint64                  mCaptureDeadline;
+    bool                    mCaptureIncr;
+    Atom                    mCaptureType;
+    int                     mCaptureFormat;
+    QByteArray              mCaptureBuffer;
+    QList<ClipboardHistoryItem> mCaptureItems;
+    QHash<QByteArray, Atom> mAtoms;
+    QHash<Atom, QByteArray> mAtomNames;
+
+    friend void clear_contents (ClipboardManager* manager);
+    friend void serve_incrementally (ClipboardManager* manager);
+    friend void conversion_remove (ClipboardManager* manager, quint64 key);
+    friend void drop_incremental (ClipboardManager* manager, TargetData* tdata);
+    friend TargetData* text_source (ClipboardManager* manager);
+    friend void save_finished (ClipboardManager* manager);
+    friend TargetData* derive_text_target (ClipboardManager* manager, Atom target);
     friend void get_property (TargetData* tdata, ClipboardManager* manager);
     friend bool send_incrementally (ClipboardManager* manager, XEvent* xev);
     friend bool receive_incrementally (ClipboardManager* manager, XEvent* xev);
@@ -64,7 +203,6 @@ private:
     friend void save_targets (ClipboardManager* manager, Atom* save_targets, int nitems);
     friend void convert_clipboard_target (IncrConversion* rdata, ClipboardManager* manager);
     friend void finish_selection_request (ClipboardManager* manager, XEvent* xev, bool success);
-    friend void clipboard_manager_watch_cb(ClipboardManager* manager, Window window, bool isStart, long mask, void* cbData);
 };
 
 #endif // CLIPBOARDMANAGER_H
@@ -1,7 +1,7 @@
 TEMPLATE = lib
 TARGET = clipboard
 
-QT += gui
+QT += gui dbus
 CONFIG += no_keywords c++11 plugin link_pkgconfig
 CONFIG -= app_bundle
 
@@ -12,19 +12,24 @@ include($$PWD/../../common/common.pri)
 INCLUDEPATH += \
 
 PKGCONFIG += \
-        gdk-3.0
+        gdk-3.0 \
+        xfixes
 
 SOURCES += \
     $$PWD/list.c \
     $$PWD/xutils.c \
     $$PWD/clipboard-plugin.cpp \
     $$PWD/clipboard-manager.cpp \
+    $$PWD/clipboard-history.cpp \
+    $$PWD/clipboard-dbus.cpp \
 
 HEADERS += \
     $$PWD/list.h \
     $$PWD/xutils.h \
     $$PWD/clipboard-plugin.h \
-    $$PWD/clipboard-manager.h
+    $$PWD/clipboard-manager.h \
+    $$PWD/clipboard-history.h \
+    $$PWD/clipboard-dbus.h
 
 DESTDIR = $$PWD/
 
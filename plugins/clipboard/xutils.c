@@ -46,23 +46,31 @@ void
 init_atoms (Display *display)
 {
   unsigned long max_request_size;
+  /* one round-trip for all of them */
+  static char *names[] = {
+    "ATOM_PAIR", "CLIPBOARD_MANAGER", "CLIPBOARD", "DELETE", "INCR",
+    "INSERT_PROPERTY", "INSERT_SELECTION", "MANAGER", "MULTIPLE", "NULL",
+    "SAVE_TARGETS", "TARGETS", "TIMESTAMP"
+  };
+  Atom atoms[sizeof (names) / sizeof (names[0])];
   
   if (SELECTION_MAX_SIZE > 0)
     return;
 
-  XA_ATOM_PAIR = XInternAtom (display, "ATOM_PAIR", False);
-  XA_CLIPBOARD_MANAGER = XInternAtom (display, "CLIPBOARD_MANAGER", False);
-  XA_CLIPBOARD = XInternAtom (display, "CLIPBOARD", False);
-  XA_DELETE = XInternAtom (display, "DELETE", False);
-  XA_INCR = XInternAtom (display, "INCR", False);
-  XA_INSERT_PROPERTY = XInternAtom (display, "INSERT_PROPERTY", False);
-  XA_INSERT_SELECTION = XInternAtom (display, "INSERT_SELECTION", False);
-  XA_MANAGER = XInternAtom (display, "MANAGER", False);
-  XA_MULTIPLE = XInternAtom (display, "MULTIPLE", False);
-  XA_NULL = XInternAtom (display, "NULL", False);
-  XA_SAVE_TARGETS = XInternAtom (display, "SAVE_TARGETS", False);
-  XA_TARGETS = XInternAtom (display, "TARGETS", False);
-  XA_TIMESTAMP = XInternAtom (display, "TIMESTAMP", False);
+  XInternAtoms (display, names, sizeof (names) / sizeof (names[0]), False, atoms);
+  XA_ATOM_PAIR = atoms[0];
+  XA_CLIPBOARD_MANAGER = atoms[1];
+  XA_CLIPBOARD = atoms[2];
+  XA_DELETE = atoms[3];
+  XA_INCR = atoms[4];
+  XA_INSERT_PROPERTY = atoms[5];
+  XA_INSERT_SELECTION = atoms[6];
+  XA_MANAGER = atoms[7];
+  XA_MULTIPLE = atoms[8];
+  XA_NULL = atoms[9];
+  XA_SAVE_TARGETS = atoms[10];
+  XA_TARGETS = atoms[11];
+  XA_TIMESTAMP = atoms[12];
   
   max_request_size = XExtendedMaxRequestSize (display);
   if (max_request_size == 0)
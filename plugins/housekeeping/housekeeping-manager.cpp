@@ -2,6 +2,7 @@
 
 #include "housekeeping-manager.h"
 #include "clib-syslog.h"
+#include "loop-watchdog.h"
 
 /* General */
 #define INTERVAL_ONCE_A_DAY     24*60*60
@@ -134,6 +135,8 @@ void HousekeepingManager::purge_thumbnail_cache ()
     PurgeData  purge_data;
     GTimeVal   current_time;
 
+    USD_WATCHDOG_SCOPE("housekeeping", "purge_thumbnail_cache");
+
     g_debug ("housekeeping: checking thumbnail cache size and freshness");
 
     purge_data.max_age  = settings->get(THUMB_CACHE_KEY_AGE).toInt() * 24 * 60 * 60;
@@ -2,6 +2,7 @@
 #include "config.h"
 #include "clib-syslog.h"
 #include "dconf-util.h"
+#include "xevent-dispatcher.h"
 #include <QMessageBox>
 #include <QScreen>
 
@@ -487,9 +488,8 @@ bool KeybindingsManager::KeybindingsManagerStart()
         window  = gdk_screen_get_root_window (screen);
         //xwindow = GDK_WINDOW_XID (window);
 
-        gdk_window_add_filter (window,
-                               (GdkFilterFunc) keybindings_filter,
-                               this);
+        XEventDispatcher::instance()->addHandler ("keybindings", "keybindings_filter", KeyPress,
+                                                  GDK_WINDOW_XID (window), (GdkFilterFunc) keybindings_filter, this);
 
         try {
             /* Add KeyPressMask to the currently reportable event masks */
@@ -521,12 +521,7 @@ void KeybindingsManager::KeybindingsManagerStop()
             client = NULL;
     }
 
-    for (l = screens; l; l = l->next) {
-            GdkScreen *screen = (GdkScreen *)l->data;
-            gdk_window_remove_filter (gdk_screen_get_root_window (screen),
-                                      (GdkFilterFunc) keybindings_filter,
-                                      this);
-    }
+    XEventDispatcher::instance()->removeHandler ((GdkFilterFunc) keybindings_filter, this);
 
     binding_unregister_keys ();
     bindings_clear ();
@@ -1,6 +1,9 @@
 #include "keyboard-manager.h"
 #include "clib-syslog.h"
+#include "startup-trace.h"
+#include "resource-usage.h"
 #include "config.h"
+#include "org.ukui.peripherals-keyboard.gschema.h"
 
 #define USD_KEYBOARD_SCHEMA  "org.ukui.peripherals-keyboard"
 #define KEY_REPEAT           "repeat"
@@ -13,6 +16,8 @@
 #define KEY_BELL_MODE        "bell-mode"
 #define KEY_NUMLOCK_STATE    "numlock-state"
 #define KEY_NUMLOCK_REMEMBER "remember-numlock-state"
+#define KEY_WRITE_COALESCE   300        // ms, lock key bursts are written to dconf once
+#define KEY_NOTIFY_INTERVAL  16         // ms, apply_repeat at most once per frame while rate/delay is dragged
 
 typedef enum {
         NUMLOCK_STATE_OFF = 0,
@@ -31,6 +36,10 @@ KeyboardManager::KeyboardManager(QObject * parent)
     if(mKeyXkb == nullptr)
         mKeyXkb = new KeyboardXkb;
     settings = new QGSettings(USD_KEYBOARD_SCHEMA);
+    // apply_settings reads the same keys several times per change
+    settings->setCached(true);
+    settings->setCoalesce(KEY_WRITE_COALESCE);
+    settings->setNotifyInterval(KEY_NOTIFY_INTERVAL);
 }
 
 KeyboardManager::~KeyboardManager()
@@ -53,6 +62,16 @@ bool KeyboardManager::KeyboardManagerStart()
 {
     CT_SYSLOG(LOG_DEBUG,"-- Keyboard Start Manager --");
 
+    ResourceUsage::instance()->registerCounter("keyboard", "gsettings_cache_hits", this, [this] () -> qint64 {
+        return settings->cacheHits();
+    });
+    ResourceUsage::instance()->registerCounter("keyboard", "gsettings_cache_misses", this, [this] () -> qint64 {
+        return settings->cacheMisses();
+    });
+    ResourceUsage::instance()->registerCounter("keyboard", "gsettings_notify_suppressed", this, [this] () -> qint64 {
+        return settings->notifySuppressed();
+    });
+
     time = new QTimer(this);
     connect(time,SIGNAL(timeout()),this,SLOT(start_keyboard_idle_cb()));
     time->start();
@@ -63,6 +82,7 @@ bool KeyboardManager::KeyboardManagerStart()
 void KeyboardManager::KeyboardManagerStop()
 {
     CT_SYSLOG(LOG_DEBUG,"-- Keyboard Stop Manager --");
+    ResourceUsage::instance()->unregisterCounters(this);
 
     old_state = 0;
     numlock_set_xkb_state((NumLockState)old_state);
@@ -264,15 +284,13 @@ void apply_repeat (KeyboardManager *manager)
 
 void KeyboardManager::apply_settings (QString keys)
 {
+    USD_RESOURCE_SCOPE("keyboard");
     /**
      * Fix by HB* system reboot but rnumlock not available;
     **/
 
-    char *key;
-    if(keys != NULL)
-        key = keys.toLatin1().data();
-    else
-        key=NULL;
+    QByteArray name = keys.toLatin1();
+    char *key = keys.isNull() ? NULL : name.data();
 
 #ifdef HAVE_X11_EXTENSIONS_XKB_H
     bool rnumlock;
@@ -287,29 +305,35 @@ void KeyboardManager::apply_settings (QString keys)
     }
 #endif /* HAVE_X11_EXTENSIONS_XKB_H */
 
-    if (keys.compare(QString::fromLocal8Bit(KEY_CLICK)) == 0||
-        keys.compare(QString::fromLocal8Bit(KEY_CLICK_VOLUME)) == 0 ||
-        keys.compare(QString::fromLocal8Bit(KEY_BELL_PITCH)) == 0 ||
-        keys.compare(QString::fromLocal8Bit(KEY_BELL_DURATION)) == 0 ||
-        keys.compare(QString::fromLocal8Bit(KEY_BELL_MODE)) == 0) {
-                qDebug ("Bell setting '%s' changed, applying bell settings", key);
-                apply_bell (this);
-
-    } else if (keys.compare(QString::fromLocal8Bit(KEY_NUMLOCK_REMEMBER)) == 0) {
+    switch (Schema::PeripheralsKeyboard::keyId(name.constData(), name.size())) {
+    case Schema::PeripheralsKeyboard::KeyClick:
+    case Schema::PeripheralsKeyboard::KeyClickVolume:
+    case Schema::PeripheralsKeyboard::KeyBellPitch:
+    case Schema::PeripheralsKeyboard::KeyBellDuration:
+    case Schema::PeripheralsKeyboard::KeyBellMode:
+            qDebug ("Bell setting '%s' changed, applying bell settings", key);
+            apply_bell (this);
+            break;
+
+    case Schema::PeripheralsKeyboard::KeyRememberNumlockState:
             qDebug ("Remember Num-Lock state '%s' changed, applying num-lock settings", key);
             apply_numlock (this);
+            break;
 
-    } else if (keys.compare(QString::fromLocal8Bit(KEY_NUMLOCK_STATE)) == 0) {
+    case Schema::PeripheralsKeyboard::KeyNumlockState:
             qDebug ("Num-Lock state '%s' changed, will apply at next startup", key);
+            break;
 
-    } else if (keys.compare(QString::fromLocal8Bit(KEY_REPEAT)) == 0 ||
-               keys.compare(QString::fromLocal8Bit(KEY_RATE)) == 0 ||
-               keys.compare(QString::fromLocal8Bit(KEY_DELAY)) == 0) {
+    case Schema::PeripheralsKeyboard::KeyRepeat:
+    case Schema::PeripheralsKeyboard::KeyRate:
+    case Schema::PeripheralsKeyboard::KeyDelay:
             qDebug ("Key repeat setting '%s' changed, applying key repeat settings", key);
             apply_repeat (this);
+            break;
 
-    } else {
+    default:
             qWarning ("Unhandled settings change, key '%s'", key);
+            break;
     }
 }
 
@@ -326,8 +350,11 @@ void KeyboardManager::XkbEventsFilter(int keyCode)
     {
         unsigned int lockedMods;
         Display *display = XOpenDisplay(NULL);
+        QGSettingsTransaction transaction(settings);
 
+        if (!display) return;
         XkbGetIndicatorState(display, XkbUseCoreKbd, &lockedMods);
+        XCloseDisplay(display);
         if(lockedMods == 1 || lockedMods == 3){
             settings->set("capslock-state",true);
         }
@@ -342,7 +369,8 @@ void KeyboardManager::XkbEventsFilter(int keyCode)
         //CT_SYSLOG(LOG_ERR,"old_state=%d,locked_mods=%d,numlockState=%d",
                   //old_state,lockedMods,numlockState);
         if (numlockState != old_state) {
-                settings->setEnum(KEY_NUMLOCK_STATE,numlockState);
+                // the enum nick, so both keys are written together
+                settings->set(KEY_NUMLOCK_STATE, numlockState == NUMLOCK_STATE_ON ? "on" : "off");
                 old_state = numlockState;
         }
     }
@@ -359,6 +387,7 @@ void KeyboardManager::numlock_install_xkb_callback ()
 
 void KeyboardManager::start_keyboard_idle_cb ()
 {
+    USD_TRACE_SPAN("idle", "keyboard");
     time->stop();
     have_xkb = 0;
     settings->set(KEY_NUMLOCK_REMEMBER,TRUE);
@@ -1,6 +1,7 @@
 #include <QIcon>
 #include "keyboard-xkb.h"
 #include "clib-syslog.h"
+#include "xevent-dispatcher.h"
 
 #define MATEKBD_DESKTOP_SCHEMA  "org.mate.peripherals-keyboard-xkb.general"
 #define MATEKBD_KBD_SCHEMA      "org.mate.peripherals-keyboard-xkb.kbd"
@@ -263,7 +264,9 @@ void KeyboardXkb::usd_keyboard_xkb_init(KeyboardManager* kbd_manager)
 
         QObject::connect(settings_kbd,SIGNAL(changed(QString)),this,SLOT(apply_xkb_settings_cb(QString)));
 
-        gdk_window_add_filter (NULL, (GdkFilterFunc)usd_keyboard_xkb_evt_filter, this);
+        // xklavier watches core and XKB events of every window
+        XEventDispatcher::instance()->addHandler ("keyboard", "usd_keyboard_xkb_evt_filter", XEVENT_ANY_TYPE,
+                                                  XEVENT_ANY_WINDOW, (GdkFilterFunc)usd_keyboard_xkb_evt_filter, this);
 
         if (xkl_engine_get_features (xkl_engine) &XKLF_DEVICE_DISCOVERY)
             g_signal_connect (xkl_engine, "X-new-device",
@@ -289,7 +292,7 @@ void KeyboardXkb::usd_keyboard_xkb_shutdown (void)
                             XKLL_MANAGE_LAYOUTS |
                             XKLL_MANAGE_WINDOW_STATES);
 
-    gdk_window_remove_filter (NULL, (GdkFilterFunc)usd_keyboard_xkb_evt_filter, NULL);
+    XEventDispatcher::instance()->removeHandler ((GdkFilterFunc)usd_keyboard_xkb_evt_filter, this);
 
     if (xkl_registry) {
         g_object_unref (xkl_registry);
@@ -10,6 +10,9 @@ DEFINES += QT_DEPRECATED_WARNINGS
 
 include($$PWD/../../common/common.pri)
 
+GSCHEMAS += org.ukui.peripherals-keyboard
+include($$PWD/../../common/gschema.pri)
+
 PKGCONFIG += \
         gtk+-3.0 \
         glib-2.0  harfbuzz  gmodule-2.0  \
@@ -1,5 +1,11 @@
 #include "mouse-manager.h"
 #include "clib-syslog.h"
+#include "startup-trace.h"
+#include "resource-usage.h"
+#include "xevent-dispatcher.h"
+#include "atom-cache.h"
+#include "org.ukui.peripherals-mouse.gschema.h"
+#include "org.ukui.peripherals-touchpad.gschema.h"
 
 /* Keys with same names for both touchpad and mouse */
 #define KEY_LEFT_HANDED                  "left-handed"          /*  a boolean for mouse, an enum for touchpad */
@@ -27,6 +33,8 @@
 #define KEY_HORIZ_TWO_FINGER_SCROLL      "horizontal-two-finger-scrolling"
 #define KEY_TOUCHPAD_ENABLED             "touchpad-enabled"
 
+#define SETTINGS_NOTIFY_INTERVAL         16     // ms, one callback per key per frame while a slider is dragged
+
 typedef enum {
         TOUCHPAD_HANDEDNESS_RIGHT,
         TOUCHPAD_HANDEDNESS_LEFT,
@@ -48,6 +56,11 @@ MouseManager::MouseManager(QObject *parent) : QObject (parent)
     gdk_init(NULL,NULL);
     settings_mouse =    new QGSettings(UKUI_MOUSE_SCHEMA);
     settings_touchpad = new QGSettings(UKUI_TOUCHPAD_SCHEMA);
+    // every device hotplug and callback reads most keys again
+    settings_mouse->setCached(true);
+    settings_touchpad->setCached(true);
+    settings_mouse->setNotifyInterval(SETTINGS_NOTIFY_INTERVAL);
+    settings_touchpad->setNotifyInterval(SETTINGS_NOTIFY_INTERVAL);
 }
 MouseManager::~MouseManager()
 {
@@ -69,6 +82,16 @@ bool MouseManager::MouseManagerStart()
 {
     CT_SYSLOG(LOG_DEBUG,"-- Mouse Start Manager --");
 
+    ResourceUsage::instance()->registerCounter("mouse", "gsettings_cache_hits", this, [this] () -> qint64 {
+        return settings_mouse->cacheHits() + settings_touchpad->cacheHits();
+    });
+    ResourceUsage::instance()->registerCounter("mouse", "gsettings_cache_misses", this, [this] () -> qint64 {
+        return settings_mouse->cacheMisses() + settings_touchpad->cacheMisses();
+    });
+    ResourceUsage::instance()->registerCounter("mouse", "gsettings_notify_suppressed", this, [this] () -> qint64 {
+        return settings_mouse->notifySuppressed() + settings_touchpad->notifySuppressed();
+    });
+
     if (!supports_xinput_devices()){
         CT_SYSLOG(LOG_ERR,"XInput is not supported, not applying any settings");
         return TRUE;
@@ -86,10 +109,11 @@ void MouseManager::MouseManagerStop()
 {
 
     syslog(LOG_DEBUG,"-- Stoping Mouse Manager --");
+    ResourceUsage::instance()->unregisterCounters(this);
 
     set_locate_pointer (this, FALSE);
 
-    gdk_window_remove_filter (NULL, devicepresence_filter, this);
+    XEventDispatcher::instance()->removeHandler (devicepresence_filter, this);
 }
 
 /*  transplant usd-input-helper.h  */
@@ -114,7 +138,7 @@ device_has_property (XDevice    *device,
     unsigned long nitems, bytes_after;
     unsigned char *data;
 
-    prop = XInternAtom (QX11Info::display(), property_name, True);
+    prop = AtomCache::atom (QX11Info::display(), property_name, true);
     if (!prop)
             return FALSE;
 
@@ -136,7 +160,7 @@ XDevice* device_is_touchpad (XDeviceInfo *deviceinfo)
 {
     XDevice *device;
 
-    if (deviceinfo->type != XInternAtom (QX11Info::display(), XI_TOUCHPAD, True))
+    if (deviceinfo->type != AtomCache::atom (QX11Info::display(), XI_TOUCHPAD, true))
             return NULL;
 
     try {
@@ -206,7 +230,7 @@ bool MouseManager::get_touchpad_handedness (bool  mouse_left_handed)
 }
 Atom property_from_name (const char *property_name)
 {
-    return XInternAtom (QX11Info::display(), property_name, True);
+    return AtomCache::atom (QX11Info::display(), property_name, true);
 }
 
 gboolean property_exists_on_device (XDeviceInfo *device_info, const char  *property_name)
@@ -878,20 +902,28 @@ void set_locate_pointer (MouseManager *manager, bool     state)
 
 void MouseManager::mouse_callback (QString keys)
 {
-    if (keys.compare(QString::fromLocal8Bit(KEY_LEFT_HANDED))==0){
-        bool mouse_left_handed = settings_mouse->get(keys).toBool();
+    USD_RESOURCE_SCOPE("mouse");
+    Schema::PeripheralsMouse mouse(settings_mouse);
+
+    switch (Schema::PeripheralsMouse::keyId(keys)) {
+    case Schema::PeripheralsMouse::KeyLeftHanded: {
+        bool mouse_left_handed = mouse.leftHanded();
         bool touchpad_left_handed = get_touchpad_handedness (mouse_left_handed);
         set_left_handed_all (this, mouse_left_handed, touchpad_left_handed);
-
-    } else if ((keys.compare(QString::fromLocal8Bit(KEY_MOTION_ACCELERATION))==0)
-               || (keys.compare(QString::fromLocal8Bit(KEY_MOTION_THRESHOLD))==0)){
+        break;
+    }
+    case Schema::PeripheralsMouse::KeyMotionAcceleration:
+    case Schema::PeripheralsMouse::KeyMotionThreshold:
         set_motion_all (this);
-
-    } else if (keys.compare(QString::fromLocal8Bit(KEY_MIDDLE_BUTTON_EMULATION))==0){
-        set_middle_button_all (settings_mouse->get(keys).toBool());
-
-    } else if (keys.compare(QString::fromLocal8Bit(KEY_MOUSE_LOCATE_POINTER))==0){
-        set_locate_pointer (this, settings_mouse->get(keys).toBool());
+        break;
+    case Schema::PeripheralsMouse::KeyMiddleButtonEnabled:
+        set_middle_button_all (mouse.middleButtonEnabled());
+        break;
+    case Schema::PeripheralsMouse::KeyLocatePointer:
+        set_locate_pointer (this, mouse.locatePointer());
+        break;
+    default:
+        break;
     }
 }
 
@@ -1240,35 +1272,49 @@ void set_touchpad_enabled_all (bool state)
 
 void MouseManager::touchpad_callback (QString keys)
 {
+    USD_RESOURCE_SCOPE("mouse");
+    Schema::PeripheralsTouchpad touchpad(settings_touchpad);
 
-    if (keys.compare(QString::fromLocal8Bit(KEY_TOUCHPAD_DISABLE_W_TYPING))==0) {
-            set_disable_w_typing (this, settings_touchpad->get(keys).toBool());
-    } else if (keys.compare(QString::fromLocal8Bit(KEY_LEFT_HANDED))== 0) {
-            bool mouse_left_handed = settings_mouse->get(keys).toBool();
+    switch (Schema::PeripheralsTouchpad::keyId(keys)) {
+    case Schema::PeripheralsTouchpad::KeyDisableWhileTyping:
+            set_disable_w_typing (this, touchpad.disableWhileTyping());
+            break;
+    case Schema::PeripheralsTouchpad::KeyLeftHanded: {
+            bool mouse_left_handed = Schema::PeripheralsMouse(settings_mouse).leftHanded();
             bool touchpad_left_handed = get_touchpad_handedness (mouse_left_handed);
             set_left_handed_all (this, mouse_left_handed, touchpad_left_handed);
-    } else if ((keys.compare(QString::fromLocal8Bit(KEY_TOUCHPAD_TAP_TO_CLICK))    == 0)
-            || (keys.compare(QString::fromLocal8Bit(KEY_TOUCHPAD_ONE_FINGER_TAP))  == 0)
-            || (keys.compare(QString::fromLocal8Bit(KEY_TOUCHPAD_TWO_FINGER_TAP))  == 0)
-            || (keys.compare(QString::fromLocal8Bit(KEY_TOUCHPAD_THREE_FINGER_TAP))== 0)) {
+            break;
+    }
+    case Schema::PeripheralsTouchpad::KeyTapToClick:
+    case Schema::PeripheralsTouchpad::KeyTapButtonOneFinger:
+    case Schema::PeripheralsTouchpad::KeyTapButtonTwoFinger:
+    case Schema::PeripheralsTouchpad::KeyTapButtonThreeFinger:
             set_tap_to_click_all (this);
+            break;
 /* Do not set click actions since ukwm take over this
-*        } else if ((keys.compare(QString::fromLocal8Bit(KEY_TOUCHPAD_TWO_FINGER_CLICK)) == 0)
-*                 ||(keys.compare(QString::fromLocal8Bit(KEY_TOUCHPAD_THREE_FINGER_CLICK)) == 0)) {
-*               set_click_actions_all (this);
+*   case Schema::PeripheralsTouchpad::KeyTwoFingerClick:
+*   case Schema::PeripheralsTouchpad::KeyThreeFingerClick:
+*           set_click_actions_all (this);
+*           break;
 */
-    } else if ((keys.compare(QString::fromLocal8Bit(KEY_VERT_EDGE_SCROLL))  == 0)
-            || (keys.compare(QString::fromLocal8Bit(KEY_HORIZ_EDGE_SCROLL)) == 0)
-            || (keys.compare(QString::fromLocal8Bit(KEY_VERT_TWO_FINGER_SCROLL))  == 0)
-            || (keys.compare(QString::fromLocal8Bit(KEY_HORIZ_TWO_FINGER_SCROLL)) == 0)) {
+    case Schema::PeripheralsTouchpad::KeyVerticalEdgeScrolling:
+    case Schema::PeripheralsTouchpad::KeyHorizontalEdgeScrolling:
+    case Schema::PeripheralsTouchpad::KeyVerticalTwoFingerScrolling:
+    case Schema::PeripheralsTouchpad::KeyHorizontalTwoFingerScrolling:
             set_scrolling_all (this->settings_touchpad);
-    } else if (keys.compare(QString::fromLocal8Bit(KEY_TOUCHPAD_NATURAL_SCROLL)) == 0) {
+            break;
+    case Schema::PeripheralsTouchpad::KeyNaturalScroll:
             set_natural_scroll_all (this);
-    } else if (keys.compare(QString::fromLocal8Bit(KEY_TOUCHPAD_ENABLED)) == 0) {
-            set_touchpad_enabled_all (settings_touchpad->get(keys).toBool());
-    } else if ((keys.compare(QString::fromLocal8Bit(KEY_MOTION_ACCELERATION)) == 0)
-            || (keys.compare(QString::fromLocal8Bit(KEY_MOTION_THRESHOLD)) == 0)) {
+            break;
+    case Schema::PeripheralsTouchpad::KeyTouchpadEnabled:
+            set_touchpad_enabled_all (touchpad.touchpadEnabled());
+            break;
+    case Schema::PeripheralsTouchpad::KeyMotionAcceleration:
+    case Schema::PeripheralsTouchpad::KeyMotionThreshold:
             set_motion_all (this);
+            break;
+    default:
+            break;
     }
 }
 
@@ -1298,17 +1344,15 @@ GdkFilterReturn devicepresence_filter (GdkXEvent *xevent,
                                        GdkEvent  *event,
                                        gpointer   data)
 {
-    XEvent *xev = (XEvent *) xevent;
-    XEventClass class_presence;
-    int xi_presence;
+    // only registered for the DevicePresence event type
+    XDevicePresenceNotifyEvent *dpn = (XDevicePresenceNotifyEvent *) xevent;
 
-    DevicePresence (gdk_x11_get_default_xdisplay (), xi_presence, class_presence);
-    if (xev->type == xi_presence)
-    {
-            XDevicePresenceNotifyEvent *dpn = (XDevicePresenceNotifyEvent *) xev;
-            if (dpn->devchange == DeviceEnabled)
-                    set_mouse_settings ((MouseManager *) data);
+    if (dpn->devchange == DeviceEnabled) {
+            // a new device may bring property names that did not exist before
+            AtomCache::instance()->forgetMissing (QX11Info::display());
+            set_mouse_settings ((MouseManager *) data);
     }
+
     return GDK_FILTER_CONTINUE;
 }
 
@@ -1327,11 +1371,39 @@ void set_devicepresence_handler (MouseManager *manager)
 
     gdk_flush ();
     //if (!gdk_error_trap_pop ())
-    gdk_window_add_filter (NULL, devicepresence_filter, manager);
+    XEventDispatcher::instance()->addHandler ("mouse", "devicepresence_filter", xi_presence,
+                                              XEVENT_ANY_WINDOW, devicepresence_filter, manager);
+}
+
+void preload_atoms (void)
+{
+    // every device property used here, one round-trip instead of one per name and device
+    static const char* const names[] = {
+        XI_TOUCHPAD,
+        "Device Enabled",
+        "Evdev Middle Button Emulation",
+        "Synaptics Capabilities",
+        "Synaptics Edge Scrolling",
+        "Synaptics Off",
+        "Synaptics Scrolling Distance",
+        "Synaptics Tap Action",
+        "Synaptics Two-Finger Scrolling",
+        "libinput Accel Speed",
+        "libinput Disable While Typing Enabled",
+        "libinput Horizontal Scroll Enabled",
+        "libinput Left Handed Enabled",
+        "libinput Middle Emulation Enabled",
+        "libinput Natural Scrolling Enabled",
+        "libinput Scroll Method Enabled",
+        "libinput Tapping Enabled",
+    };
+
+    AtomCache::instance()->preload (QX11Info::display(), names, G_N_ELEMENTS (names), true);
 }
 
 void MouseManager::usd_mouse_manager_idle_cb()
 {
+    USD_TRACE_SPAN("idle", "mouse");
 
     time->stop();
 
@@ -1340,6 +1412,7 @@ void MouseManager::usd_mouse_manager_idle_cb()
     QObject::connect(settings_touchpad,SIGNAL(changed(QString)),
                      this,SLOT(touchpad_callback(QString)));
     syndaemon_spawned = FALSE;
+    preload_atoms ();
     set_devicepresence_handler (this);
     set_mouse_settings (this);
     set_locate_pointer (this, settings_mouse->get(KEY_MOUSE_LOCATE_POINTER).toBool());
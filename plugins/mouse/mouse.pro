@@ -13,6 +13,11 @@ DEFINES += QT_DEPRECATED_WARNINGS
 
 include($$PWD/../../common/common.pri)
 
+GSCHEMAS += \
+        org.ukui.peripherals-mouse \
+        org.ukui.peripherals-touchpad
+include($$PWD/../../common/gschema.pri)
+
 PKGCONFIG += \
         gtk+-3.0 \
         glib-2.0  \
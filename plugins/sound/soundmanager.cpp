@@ -8,6 +8,7 @@ extern "C"{
 }
 
 #include "soundmanager.h"
+#include "loop-watchdog.h"
 
 SoundManager* SoundManager::mSoundManager = nullptr;
 
@@ -139,6 +140,7 @@ fail:
 
 bool SoundManager::flush_cb ()
 {
+    USD_WATCHDOG_SCOPE("sound", "flush_cache");
     flush_cache ();
     timer->stop();
     return false;
@@ -1,5 +1,8 @@
 #include "xrandr-manager.h"
 #include "clib-syslog.h"
+#include "loop-watchdog.h"
+#include "resource-usage.h"
+#include "xevent-dispatcher.h"
 #include <QDBusError>
 #include <QDBusConnectionInterface>
 #include <QString>
@@ -154,9 +157,9 @@ bool XrandrManager::XrandrManagerStart()
     log_msg ("State of screen after initial configuration:\n");
     log_screen (rw_screen);
 
-    gdk_window_add_filter (gdk_get_default_root_window(),
-                           (GdkFilterFunc)event_filter,
-                           this);
+    // KeyRelease is not handled
+    XEventDispatcher::instance()->addHandler ("xrandr", "event_filter", KeyPress, gdk_x11_get_default_root_xwindow (),
+                                              (GdkFilterFunc)event_filter, this);
 
     start_or_stop_icon (this);
 
@@ -188,9 +191,7 @@ void XrandrManager::XrandrManagerStop()
         //gdk_error_trap_pop_ignored ();
     }
 
-    gdk_window_remove_filter (gdk_get_default_root_window (),
-                              (GdkFilterFunc) event_filter,
-                              manager);
+    XEventDispatcher::instance()->removeHandler ((GdkFilterFunc) event_filter, manager);
     if (manager->settings != NULL) {
             g_object_unref (manager->settings);
             manager->settings = NULL;
@@ -1194,6 +1195,8 @@ void XrandrManager::on_randr_event(MateRRScreen *screen)
 {
     unsigned int change_timestamp, config_timestamp;
 
+    USD_WATCHDOG_SCOPE("xrandr", "on_randr_event");
+    USD_RESOURCE_SCOPE("xrandr");
     if (! manager->running)
         return;
     mate_rr_screen_get_timestamps(screen, &change_timestamp, &config_timestamp);
@@ -3,6 +3,7 @@
 #include "fontconfig-monitor.h"
 #include "ukui-xft-settings.h"
 #include "xsettings-const.h"
+#include "settings-registry.h"
 
 #include <gtk/gtk.h>
 #include <gdk/gdkx.h>
@@ -398,11 +399,11 @@ int ukuiXSettingsManager::start(GError               **error)
     gsettings = g_hash_table_new_full (g_str_hash, g_str_equal,
             NULL, (GDestroyNotify) g_object_unref);
     g_hash_table_insert ( gsettings,
-            (void*)MOUSE_SCHEMA, g_settings_new (MOUSE_SCHEMA));
+            (void*)MOUSE_SCHEMA, SettingsRegistry::acquire (MOUSE_SCHEMA));
     g_hash_table_insert ( gsettings,
-            (void*)INTERFACE_SCHEMA, g_settings_new (INTERFACE_SCHEMA));
+            (void*)INTERFACE_SCHEMA, SettingsRegistry::acquire (INTERFACE_SCHEMA));
     g_hash_table_insert ( gsettings,
-            (void*)SOUND_SCHEMA, g_settings_new (SOUND_SCHEMA));
+            (void*)SOUND_SCHEMA, SettingsRegistry::acquire (SOUND_SCHEMA));
     list = g_hash_table_get_values ( gsettings);
     for (l = list; l != NULL; l = l->next) {
         g_signal_connect_object (G_OBJECT (l->data), "changed",
@@ -422,7 +423,7 @@ int ukuiXSettingsManager::start(GError               **error)
         process_value (this, &translations[i], val);
         g_variant_unref (val);
     }
-    gsettings_font = g_settings_new (FONT_RENDER_SCHEMA);
+    gsettings_font = SettingsRegistry::acquire (FONT_RENDER_SCHEMA);
     g_signal_connect ( gsettings_font, "changed", G_CALLBACK (xft_callback), pManagers);
     update_xft_settings (this);
     start_fontconfig_monitor (this);
@@ -461,10 +462,17 @@ int ukuiXSettingsManager::stop()
         }
     }
     if (gsettings != NULL) {
+        // shared objects may outlive this manager
+        GList *list = g_hash_table_get_values (gsettings);
+        for (GList *l = list; l != NULL; l = l->next) {
+            g_signal_handlers_disconnect_by_func (l->data, (gpointer) xsettings_callback, this);
+        }
+        g_list_free (list);
         g_hash_table_destroy (gsettings);
         gsettings = NULL;
     }
     if (gsettings_font != NULL) {
+        g_signal_handlers_disconnect_by_func (gsettings_font, (gpointer) xft_callback, pManagers);
         g_object_unref (gsettings_font);
         gsettings_font = NULL;
     }
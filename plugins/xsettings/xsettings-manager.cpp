@@ -1,5 +1,6 @@
 #include "xsettings-manager.h"
 #include "xsettings-const.h"
+#include "atom-cache.h"
 #include <X11/Xmd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -64,7 +65,7 @@ static Time get_server_time (Display *display,
     XEvent xevent;
     TimeStampInfo info;
 
-    info.timestamp_prop_atom = XInternAtom  (display, "_TIMESTAMP_PROP", False);
+    info.timestamp_prop_atom = AtomCache::atom (display, "_TIMESTAMP_PROP");
     info.window = window;
 
     XChangeProperty (display, window,
@@ -189,7 +190,7 @@ Bool xsettings_manager_check_running (Display *display,
     Atom selection_atom;
 
     sprintf(buffer, "_XSETTINGS_S%d", screen);
-    selection_atom = XInternAtom (display, buffer, False);
+    selection_atom = AtomCache::atom (display, buffer);
 
     if (XGetSelectionOwner (display, selection_atom))
         return True;
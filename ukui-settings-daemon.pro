@@ -18,6 +18,11 @@ SUBDIRS += \
     $$PWD/plugins/xsettings/xsettings.pro      \
     $$PWD/daemon/daemon.pro  \
 
+# qmake CONFIG+=benchmarks, needs Xvfb, dbus-daemon and libXtst
+CONFIG(benchmarks) {
+    SUBDIRS += $$PWD/benchmarks/benchmarks.pro
+}
+
 include($$PWD/data/data.pri)
 
 OTHER_FILES += \